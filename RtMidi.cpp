@@ -42,7 +42,35 @@
 #include "RtMidiDummy.h"
 #include "RtMidiJack.h"
 #include "RtMidiWinMM.h"
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
 #include <sstream>
+#include <string.h>
+#include <mutex>
+#include <system_error>
+#include <thread>
+#include <cmath>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <errno.h>
+  #include <fcntl.h>
+  #include <poll.h>
+  #include <pthread.h>
+  #include <sched.h>
+  #include <sys/mman.h>
+  #include <unistd.h>
+  #if defined(__linux__)
+    #include <sys/eventfd.h>
+  #endif
+  #if defined(__APPLE__)
+    #include <mach/mach.h>
+    #include <mach/mach_time.h>
+    #include <mach/thread_policy.h>
+  #endif
+#endif
 
 #if defined(__MACOSX_CORE__)
   #if TARGET_OS_IPHONE
@@ -72,6 +100,12 @@ std::string RtMidi :: getVersion( void ) throw()
   return std::string( RTMIDI_VERSION );
 }
 
+unsigned long long RtMidi :: getCurrentTime( void ) throw()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+    std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
 void RtMidi :: getCompiledApi( std::vector<RtMidi::Api> &apis ) throw()
 {
   apis.clear();
@@ -95,44 +129,121 @@ void RtMidi :: getCompiledApi( std::vector<RtMidi::Api> &apis ) throw()
 #endif
 }
 
+//*********************************************************************//
+//  Common Definitions: default API selection
+//*********************************************************************//
+
+// Count the input or output ports of an API without constructing one
+// of its classes, which would create clients, ports, queues or threads.
+static void probePortCount( RtMidi::Api api, bool input, unsigned int *count )
+{
+  *count = 0;
+#if defined(__UNIX_JACK__)
+  if ( api == RtMidi::UNIX_JACK )
+    *count = input ? MidiInJack::probePortCount() : MidiOutJack::probePortCount();
+#endif
+#if defined(__LINUX_ALSA__)
+  if ( api == RtMidi::LINUX_ALSA )
+    *count = input ? MidiInAlsa::probePortCount() : MidiOutAlsa::probePortCount();
+#endif
+#if defined(__WINDOWS_MM__)
+  if ( api == RtMidi::WINDOWS_MM )
+    *count = input ? MidiInWinMM::probePortCount() : MidiOutWinMM::probePortCount();
+#endif
+#if defined(__MACOSX_CORE__)
+  if ( api == RtMidi::MACOSX_CORE )
+    *count = input ? MidiInCore::probePortCount() : MidiOutCore::probePortCount();
+#endif
+#if defined(__RTMIDI_DUMMY__)
+  if ( api == RtMidi::RTMIDI_DUMMY )
+    *count = input ? MidiInDummy::probePortCount() : MidiOutDummy::probePortCount();
+#endif
+}
+
+// Return the API to use when none is specified: the first compiled API
+// (in the order of getCompiledApi()) with at least one port, or the
+// last one if none has any.  All compiled APIs are probed at once, and
+// the choice is made only once per process for input and for output.
+static RtMidi::Api getDefaultApi( bool input )
+{
+  static std::mutex mutex;
+  static RtMidi::Api defaultApi[2] = { RtMidi::UNSPECIFIED, RtMidi::UNSPECIFIED };
+
+  std::lock_guard<std::mutex> lock( mutex );
+  if ( defaultApi[input] != RtMidi::UNSPECIFIED )
+    return defaultApi[input];
+
+  std::vector< RtMidi::Api > apis;
+  RtMidi::getCompiledApi( apis );
+  if ( apis.empty() ) return RtMidi::UNSPECIFIED;
+
+  // Probe the first API on this thread while the others run alongside.
+  std::vector<unsigned int> counts( apis.size(), 0 );
+  std::vector<std::thread> threads;
+  for ( unsigned int i=1; i<apis.size(); i++ ) {
+    try {
+      threads.push_back( std::thread( probePortCount, apis[i], input, &counts[i] ) );
+    }
+    catch ( const std::system_error & ) {
+      probePortCount( apis[i], input, &counts[i] );
+    }
+  }
+  probePortCount( apis[0], input, &counts[0] );
+  for ( unsigned int i=0; i<threads.size(); i++ )
+    threads[i].join();
+
+  RtMidi::Api api = apis.back();
+  for ( unsigned int i=0; i<apis.size(); i++ ) {
+    if ( counts[i] ) {
+      api = apis[i];
+      break;
+    }
+  }
+
+  defaultApi[input] = api;
+  return api;
+}
+
 //*********************************************************************//
 //  RtMidiIn Definitions
 //*********************************************************************//
 
-void RtMidiIn :: openMidiApi( RtMidi::Api api, const std::string clientName, unsigned int queueSizeLimit )
+void RtMidiIn :: openMidiApi( RtMidi::Api api, const std::string clientName, unsigned int queueSizeLimit,
+                             unsigned int sysexQueueSize, MidiContextApi *context )
 {
   if ( rtapi_ )
     delete rtapi_;
   rtapi_ = 0;
+  (void) context; // not used by the Windows MM and dummy APIs
 
 #if defined(__UNIX_JACK__)
   if ( api == UNIX_JACK )
-    rtapi_ = new MidiInJack( clientName, queueSizeLimit );
+    rtapi_ = new MidiInJack( clientName, queueSizeLimit, sysexQueueSize, context );
 #endif
 #if defined(__LINUX_ALSA__)
   if ( api == LINUX_ALSA )
-    rtapi_ = new MidiInAlsa( clientName, queueSizeLimit );
+    rtapi_ = new MidiInAlsa( clientName, queueSizeLimit, sysexQueueSize, context );
 #endif
 #if defined(__WINDOWS_MM__)
   if ( api == WINDOWS_MM )
-    rtapi_ = new MidiInWinMM( clientName, queueSizeLimit );
+    rtapi_ = new MidiInWinMM( clientName, queueSizeLimit, sysexQueueSize );
 #endif
 #if defined(__MACOSX_CORE__)
   if ( api == MACOSX_CORE )
-    rtapi_ = new MidiInCore( clientName, queueSizeLimit );
+    rtapi_ = new MidiInCore( clientName, queueSizeLimit, sysexQueueSize, context );
 #endif
 #if defined(__RTMIDI_DUMMY__)
   if ( api == RTMIDI_DUMMY )
-    rtapi_ = new MidiInDummy( clientName, queueSizeLimit );
+    rtapi_ = new MidiInDummy( clientName, queueSizeLimit, sysexQueueSize );
 #endif
 }
 
-RtMidiIn :: RtMidiIn( RtMidi::Api api, const std::string clientName, unsigned int queueSizeLimit )
+RtMidiIn :: RtMidiIn( RtMidi::Api api, const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize )
   : RtMidi()
 {
   if ( api != UNSPECIFIED ) {
     // Attempt to open the specified API.
-    openMidiApi( api, clientName, queueSizeLimit );
+    openMidiApi( api, clientName, queueSizeLimit, sysexQueueSize );
     if ( rtapi_ ) return;
 
     // No compiled support for specified API value.  Issue a warning
@@ -140,15 +251,9 @@ RtMidiIn :: RtMidiIn( RtMidi::Api api, const std::string clientName, unsigned in
     std::cerr << "\nRtMidiIn: no compiled support for specified API argument!\n\n" << std::endl;
   }
 
-  // Iterate through the compiled APIs and return as soon as we find
-  // one with at least one port or we reach the end of the list.
-  std::vector< RtMidi::Api > apis;
-  getCompiledApi( apis );
-  for ( unsigned int i=0; i<apis.size(); i++ ) {
-    openMidiApi( apis[i], clientName, queueSizeLimit );
-    if ( rtapi_->getPortCount() ) break;
-  }
-
+  // Open the first compiled API with at least one port, found by
+  // probing them all (once per process).
+  openMidiApi( getDefaultApi( true ), clientName, queueSizeLimit, sysexQueueSize );
   if ( rtapi_ ) return;
 
   // It should not be possible to get here because the preprocessor
@@ -159,6 +264,16 @@ RtMidiIn :: RtMidiIn( RtMidi::Api api, const std::string clientName, unsigned in
   throw( RtMidiError( errorText, RtMidiError::UNSPECIFIED ) );
 }
 
+RtMidiIn :: RtMidiIn( RtMidiContext &context, unsigned int queueSizeLimit, unsigned int sysexQueueSize )
+  : RtMidi()
+{
+  openMidiApi( context.api_, context.clientName_, queueSizeLimit, sysexQueueSize, context.rtapi_ );
+  if ( rtapi_ ) return;
+
+  std::string errorText = "RtMidiIn: no compiled support for the API of the context ... critical error!!";
+  throw( RtMidiError( errorText, RtMidiError::UNSPECIFIED ) );
+}
+
 RtMidiIn :: ~RtMidiIn() throw()
 {
 }
@@ -168,19 +283,22 @@ RtMidiIn :: ~RtMidiIn() throw()
 //  RtMidiOut Definitions
 //*********************************************************************//
 
-void RtMidiOut :: openMidiApi( RtMidi::Api api, const std::string clientName )
+void RtMidiOut :: openMidiApi( RtMidi::Api api, const std::string clientName, unsigned int bufferSize,
+                              MidiContextApi *context )
 {
   if ( rtapi_ )
     delete rtapi_;
   rtapi_ = 0;
+  (void) bufferSize; // only used by JACK
+  (void) context; // not used by the Windows MM and dummy APIs
 
 #if defined(__UNIX_JACK__)
   if ( api == UNIX_JACK )
-    rtapi_ = new MidiOutJack( clientName );
+    rtapi_ = new MidiOutJack( clientName, bufferSize, context );
 #endif
 #if defined(__LINUX_ALSA__)
   if ( api == LINUX_ALSA )
-    rtapi_ = new MidiOutAlsa( clientName );
+    rtapi_ = new MidiOutAlsa( clientName, context );
 #endif
 #if defined(__WINDOWS_MM__)
   if ( api == WINDOWS_MM )
@@ -188,7 +306,7 @@ void RtMidiOut :: openMidiApi( RtMidi::Api api, const std::string clientName )
 #endif
 #if defined(__MACOSX_CORE__)
   if ( api == MACOSX_CORE )
-    rtapi_ = new MidiOutCore( clientName );
+    rtapi_ = new MidiOutCore( clientName, context );
 #endif
 #if defined(__RTMIDI_DUMMY__)
   if ( api == RTMIDI_DUMMY )
@@ -196,11 +314,11 @@ void RtMidiOut :: openMidiApi( RtMidi::Api api, const std::string clientName )
 #endif
 }
 
-RtMidiOut :: RtMidiOut( RtMidi::Api api, const std::string clientName )
+RtMidiOut :: RtMidiOut( RtMidi::Api api, const std::string clientName, unsigned int bufferSize )
 {
   if ( api != UNSPECIFIED ) {
     // Attempt to open the specified API.
-    openMidiApi( api, clientName );
+    openMidiApi( api, clientName, bufferSize );
     if ( rtapi_ ) return;
 
     // No compiled support for specified API value.  Issue a warning
@@ -208,15 +326,9 @@ RtMidiOut :: RtMidiOut( RtMidi::Api api, const std::string clientName )
     std::cerr << "\nRtMidiOut: no compiled support for specified API argument!\n\n" << std::endl;
   }
 
-  // Iterate through the compiled APIs and return as soon as we find
-  // one with at least one port or we reach the end of the list.
-  std::vector< RtMidi::Api > apis;
-  getCompiledApi( apis );
-  for ( unsigned int i=0; i<apis.size(); i++ ) {
-    openMidiApi( apis[i], clientName );
-    if ( rtapi_->getPortCount() ) break;
-  }
-
+  // Open the first compiled API with at least one port, found by
+  // probing them all (once per process).
+  openMidiApi( getDefaultApi( false ), clientName, bufferSize );
   if ( rtapi_ ) return;
 
   // It should not be possible to get here because the preprocessor
@@ -227,8 +339,55 @@ RtMidiOut :: RtMidiOut( RtMidi::Api api, const std::string clientName )
   throw( RtMidiError( errorText, RtMidiError::UNSPECIFIED ) );
 }
 
+RtMidiOut :: RtMidiOut( RtMidiContext &context, unsigned int bufferSize )
+{
+  openMidiApi( context.api_, context.clientName_, bufferSize, context.rtapi_ );
+  if ( rtapi_ ) return;
+
+  std::string errorText = "RtMidiOut: no compiled support for the API of the context ... critical error!!";
+  throw( RtMidiError( errorText, RtMidiError::UNSPECIFIED ) );
+}
+
 RtMidiOut :: ~RtMidiOut() throw()
 {
+  // The flush thread calls the API, so it stops while the API is whole.
+  if ( rtapi_ ) ((MidiOutApi *)rtapi_)->setOutputCompression( false, 0.0 );
+}
+
+//*********************************************************************//
+//  RtMidiContext Definitions
+//*********************************************************************//
+
+RtMidiContext :: RtMidiContext( RtMidi::Api api, const std::string clientName )
+  : api_( api ), clientName_( clientName ), rtapi_( 0 )
+{
+  std::vector< RtMidi::Api > apis;
+  RtMidi::getCompiledApi( apis );
+  if ( api != RtMidi::UNSPECIFIED && std::find( apis.begin(), apis.end(), api ) == apis.end() ) {
+    std::cerr << "\nRtMidiContext: no compiled support for specified API argument!\n\n" << std::endl;
+    api_ = RtMidi::UNSPECIFIED;
+  }
+  if ( api_ == RtMidi::UNSPECIFIED )
+    api_ = getDefaultApi( true );
+
+#if defined(__UNIX_JACK__)
+  if ( api_ == RtMidi::UNIX_JACK )
+    rtapi_ = new MidiContextJack( clientName );
+#endif
+#if defined(__LINUX_ALSA__)
+  if ( api_ == RtMidi::LINUX_ALSA )
+    rtapi_ = new MidiContextAlsa( clientName );
+#endif
+#if defined(__MACOSX_CORE__)
+  if ( api_ == RtMidi::MACOSX_CORE )
+    rtapi_ = new MidiContextCore( clientName );
+#endif
+}
+
+RtMidiContext :: ~RtMidiContext() throw()
+{
+  if ( rtapi_ )
+    rtapi_->release();
 }
 
 //*********************************************************************//
@@ -236,7 +395,7 @@ RtMidiOut :: ~RtMidiOut() throw()
 //*********************************************************************//
 
 MidiApi :: MidiApi( void )
-  : apiData_( 0 ), connected_( false ), errorCallback_(0), firstErrorOccurred_(false), errorCallbackUserData_(0)
+  : apiData_( 0 ), context_( 0 ), connected_( false ), errorCallback_(0), firstErrorOccurred_(false), errorCallbackUserData_(0)
 {
 }
 
@@ -279,23 +438,120 @@ void MidiApi :: error( RtMidiError::Type type, std::string errorString )
   }
 }
 
+MidiApi::MidiStats :: MidiStats( void )
+  : messages( 0 ), bytes( 0 ), drops( 0 ), overruns( 0 ), sysexReassemblies( 0 ), queueHighWater( 0 ),
+    lastTime( 0 ), callback( 0 ), userData( 0 ), interval( 0 ), nextReport( 0 )
+{
+  for ( unsigned int i=0; i<RtMidiStats::HISTOGRAM_SIZE; ++i ) {
+    callbackTime[i].store( 0, std::memory_order_relaxed );
+    interArrival[i].store( 0, std::memory_order_relaxed );
+  }
+}
+
+// Return the histogram bin of a duration: 0 under a microsecond, then
+// one bin per power of two of microseconds.
+unsigned int MidiApi::MidiStats :: bin( unsigned long long nanoseconds )
+{
+  unsigned long long microseconds = nanoseconds / 1000;
+  unsigned int i = 0;
+  while ( microseconds && i < RtMidiStats::HISTOGRAM_SIZE - 1 ) {
+    microseconds >>= 1;
+    ++i;
+  }
+  return i;
+}
+
+// Count a message received or sent at the given absolute time, and
+// call the statistics callback when it is due.
+void MidiApi::MidiStats :: countMessage( size_t nBytes, unsigned long long time )
+{
+  add( messages );
+  add( bytes, nBytes );
+  unsigned long long last = lastTime.load( std::memory_order_relaxed );
+  if ( last && time >= last ) add( interArrival[bin( time - last )] );
+  lastTime.store( time, std::memory_order_relaxed );
+  report( time );
+}
+
+// Count a message like countMessage(), from one of two threads
+// counting the same messages.  The callback is left to report(), so
+// the function does not block and can be called from a realtime
+// thread.
+void MidiApi::MidiStats :: countShared( size_t nBytes, unsigned long long time )
+{
+  addShared( messages );
+  addShared( bytes, nBytes );
+  unsigned long long last = lastTime.exchange( time, std::memory_order_relaxed );
+  if ( last && time >= last ) addShared( interArrival[bin( time - last )] );
+}
+
+// Count a call of the input callback that started at the given time.
+void MidiApi::MidiStats :: countCallback( unsigned long long start )
+{
+  add( callbackTime[bin( RtMidi::getCurrentTime() - start )] );
+}
+
+void MidiApi::MidiStats :: countCallbackShared( unsigned long long start )
+{
+  addShared( callbackTime[bin( RtMidi::getCurrentTime() - start )] );
+}
+
+// Call the statistics callback if it is due at the given time.  Only
+// one thread at a time may call the function.
+void MidiApi::MidiStats :: report( unsigned long long time )
+{
+  if ( !due( time ) ) return;
+  nextReport.store( time + interval, std::memory_order_relaxed );
+  RtMidiStats stats;
+  get( &stats );
+  callback( stats, userData );
+}
+
+void MidiApi::MidiStats :: get( RtMidiStats *stats ) const
+{
+  stats->messages = messages.load( std::memory_order_relaxed );
+  stats->bytes = bytes.load( std::memory_order_relaxed );
+  stats->drops = drops.load( std::memory_order_relaxed );
+  stats->overruns = overruns.load( std::memory_order_relaxed );
+  stats->sysexReassemblies = sysexReassemblies.load( std::memory_order_relaxed );
+  stats->queueHighWater = queueHighWater.load( std::memory_order_relaxed );
+  for ( unsigned int i=0; i<RtMidiStats::HISTOGRAM_SIZE; ++i ) {
+    stats->callbackTime[i] = callbackTime[i].load( std::memory_order_relaxed );
+    stats->interArrival[i] = interArrival[i].load( std::memory_order_relaxed );
+  }
+}
+
+void MidiApi::MidiStats :: setCallback( RtMidiStatsCallback callback, void *userData, double interval )
+{
+  this->interval = interval > 0.0 ? (unsigned long long) ( interval * 1000000000.0 ) : 0;
+  this->userData = userData;
+  nextReport.store( RtMidi::getCurrentTime() + this->interval, std::memory_order_relaxed );
+  this->callback = callback;
+}
+
 //*********************************************************************//
 //  Common MidiInApi Definitions
 //*********************************************************************//
 
-MidiInApi :: MidiInApi( unsigned int queueSizeLimit )
+MidiInApi :: MidiInApi( unsigned int queueSizeLimit, unsigned int sysexQueueSize )
   : MidiApi()
 {
   // Allocate the MIDI queue.
-  inputData_.queue.ringSize = queueSizeLimit;
-  if ( inputData_.queue.ringSize > 0 )
-    inputData_.queue.ring = new MidiMessage[ inputData_.queue.ringSize ];
+  inputData_.queue.allocate( queueSizeLimit, sysexQueueSize );
+
+  // Everything passes but sysex, timing and active sensing messages.
+  setMessageFilter( 0, 0xFFFF );
+  MidiInApi::ignoreTypes( true, true, true );
 }
 
 MidiInApi :: ~MidiInApi( void )
 {
-  // Delete the MIDI queue.
-  if ( inputData_.queue.ringSize > 0 ) delete [] inputData_.queue.ring;
+  std::vector<MidiRoute> *routes = inputData_.routes.load();
+  if ( routes ) {
+    for ( size_t i=0; i<routes->size(); ++i )
+      if ( !(*routes)[i].handle ) (*routes)[i].output->detachRoute();
+  }
+  delete routes;
 }
 
 void MidiInApi :: setCallback( RtMidiIn::RtMidiCallback callback, void *userData )
@@ -312,11 +568,70 @@ void MidiInApi :: setCallback( RtMidiIn::RtMidiCallback callback, void *userData
     return;
   }
 
+  if ( inputData_.queue.subscribers() ) {
+    errorString_ = "MidiInApi::setCallback: subscribers are reading the messages of this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
   inputData_.userCallback = callback;
   inputData_.userData = userData;
   inputData_.usingCallback = true;
 }
 
+// Passes the absolute time of the message being delivered, which the
+// APIs store in the message of the input data, to a timed callback.
+static void midiInTimedCallback( double timeStamp, std::vector<unsigned char> *message, void *userData )
+{
+  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (userData);
+  data->timedCallback( timeStamp, data->message.absoluteTime, message, data->timedUserData );
+}
+
+void MidiInApi :: setTimedCallback( RtMidiIn::RtMidiTimedCallback callback, void *userData )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "MidiInApi::setTimedCallback: a callback function is already set!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( !callback ) {
+    errorString_ = "RtMidiIn::setTimedCallback: callback function value is invalid!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  inputData_.timedCallback = callback;
+  inputData_.timedUserData = userData;
+  setCallback( midiInTimedCallback, &inputData_ );
+}
+
+// Passes the bytes of the message vector to a view callback.
+static void midiInViewCallback( double timeStamp, std::vector<unsigned char> *message, void *userData )
+{
+  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (userData);
+  data->viewCallback( timeStamp, message->data(), message->size(), data->viewUserData );
+}
+
+void MidiInApi :: setViewCallback( RtMidiIn::RtMidiViewCallback callback, void *userData )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "MidiInApi::setViewCallback: a callback function is already set!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( !callback ) {
+    errorString_ = "RtMidiIn::setViewCallback: callback function value is invalid!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  inputData_.viewCallback = callback;
+  inputData_.viewUserData = userData;
+  setCallback( midiInViewCallback, &inputData_ );
+}
+
 void MidiInApi :: cancelCallback()
 {
   if ( !inputData_.usingCallback ) {
@@ -325,53 +640,1528 @@ void MidiInApi :: cancelCallback()
     return;
   }
 
+  // The input threads check the callback once they have counted their
+  // entry, so any call that started before it was cleared has left
+  // when the counters catch up.
+  inputData_.usingCallback = false;
+  inputData_.realtimeCallback = 0;
+  unsigned int entered = inputData_.callbackEntered.load();
+  while ( (int) ( inputData_.callbackLeft.load() - entered ) < 0 )
+    std::this_thread::yield();
+  entered = inputData_.realtimeEntered.load();
+  while ( (int) ( inputData_.realtimeLeft.load() - entered ) < 0 )
+    std::this_thread::yield();
   inputData_.userCallback = 0;
   inputData_.userData = 0;
-  inputData_.usingCallback = false;
 }
 
-void MidiInApi :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
+void MidiInApi :: setRealtimeCallback( RtMidiIn::RtMidiRealtimeCallback /*callback*/, void * /*userData*/ )
 {
-  inputData_.ignoreFlags = 0;
-  if ( midiSysex ) inputData_.ignoreFlags = 0x01;
-  if ( midiTime ) inputData_.ignoreFlags |= 0x02;
-  if ( midiSense ) inputData_.ignoreFlags |= 0x04;
+  errorString_ = "MidiInApi::setRealtimeCallback: realtime callbacks are not supported by this API.";
+  error( RtMidiError::WARNING, errorString_ );
 }
 
-double MidiInApi :: getMessage( std::vector<unsigned char> *message )
+void MidiInApi :: setSysexCallback( RtMidiIn::RtMidiSysexCallback callback, void *userData )
 {
-  message->clear();
+  // The input thread picks the callback up with the next fragment.
+  // The release pairs with the acquire of the input thread, so the
+  // user data is visible along with the callback.
+  inputData_.sysexCallback.store( 0, std::memory_order_release );
+  inputData_.sysexUserData.store( userData, std::memory_order_relaxed );
+  inputData_.sysexCallback.store( callback, std::memory_order_release );
+}
+
+void MidiInApi :: setBufferSize( unsigned int size, unsigned int count )
+{
+  if ( size == 0 || count == 0 ) {
+    errorString_ = "MidiInApi::setBufferSize: buffer size and count must be greater than zero!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  inputData_.bufferSize = size;
+  inputData_.bufferCount = count;
+}
+
+unsigned int MidiInApi :: getSysexBufferUnderruns( void )
+{
+  return 0;
+}
+
+void MidiInApi :: setThreadOptions( const RtMidiThreadOptions &options )
+{
+  inputData_.threadOptions = options;
+
+  if ( options.lockMemory ) {
+    int err = inputData_.queue.lock();
+    if ( err ) {
+      std::ostringstream ost;
+      ost << "MidiInApi::setThreadOptions: error locking the input queue in memory: ";
+#if defined(_WIN32)
+      ost << "system error " << err << " (the minimum working set of the process may be too small, see SetProcessWorkingSetSize).";
+#else
+      if ( err == EPERM || err == ENOMEM )
+        ost << "the process lacks the permission or exceeds its limit (see RLIMIT_MEMLOCK and CAP_IPC_LOCK).";
+      else
+        ost << strerror( err ) << '.';
+#endif
+      errorString_ = ost.str();
+      error( RtMidiError::WARNING, errorString_ );
+    }
+  }
+
+  applyThreadOptions();
+}
+
+// APIs that run an input thread of their own apply the options to it.
+void MidiInApi :: applyThreadOptions( void )
+{
+}
+
+// Apply the scheduling options to a thread, warning about each one
+// that fails.
+void MidiInApi :: scheduleThread( void *thread )
+{
+#if defined(_WIN32)
+  (void) thread;
+#else
+  pthread_t id = *(pthread_t *) thread;
+  const RtMidiThreadOptions &options = inputData_.threadOptions;
+
+#if defined(__APPLE__)
+  if ( options.policy != RtMidiThreadOptions::DEFAULT ) {
+    // Realtime threads use the time-constraint policy, here with a
+    // period of 1 ms, of which up to 0.5 ms of computation.
+    mach_timebase_info_data_t timebase;
+    mach_timebase_info( &timebase );
+    double ticksPerNanosecond = (double) timebase.denom / timebase.numer;
+    thread_time_constraint_policy_data_t policy;
+    policy.period = (uint32_t) ( 1000000 * ticksPerNanosecond );
+    policy.computation = (uint32_t) ( 500000 * ticksPerNanosecond );
+    policy.constraint = policy.period;
+    policy.preemptible = 1;
+    if ( thread_policy_set( pthread_mach_thread_np( id ), THREAD_TIME_CONSTRAINT_POLICY,
+                            (thread_policy_t) &policy, THREAD_TIME_CONSTRAINT_POLICY_COUNT ) != KERN_SUCCESS ) {
+      errorString_ = "MidiInApi::setThreadOptions: error setting the time-constraint policy of the input thread, which keeps the default policy.";
+      error( RtMidiError::WARNING, errorString_ );
+    }
+  }
+#else
+  // The default policy is set as well, for a running thread.
+  int policy = SCHED_OTHER;
+  if ( options.policy == RtMidiThreadOptions::FIFO ) policy = SCHED_FIFO;
+  else if ( options.policy == RtMidiThreadOptions::ROUND_ROBIN ) policy = SCHED_RR;
+  struct sched_param param;
+  memset( &param, 0, sizeof(param) );
+  if ( policy != SCHED_OTHER ) param.sched_priority = options.priority;
+  int err = pthread_setschedparam( id, policy, &param );
+  if ( err ) {
+    std::ostringstream ost;
+    ost << "MidiInApi::setThreadOptions: error setting the scheduling policy of the input thread, which keeps the default policy: ";
+    if ( err == EPERM )
+      ost << "the process lacks the permission for realtime scheduling (see RLIMIT_RTPRIO and CAP_SYS_NICE).";
+    else if ( err == EINVAL )
+      ost << "priority " << options.priority << " is outside the range " << sched_get_priority_min( policy )
+          << " to " << sched_get_priority_max( policy ) << " of the policy.";
+    else
+      ost << strerror( err ) << '.';
+    errorString_ = ost.str();
+    error( RtMidiError::WARNING, errorString_ );
+  }
+#endif
+
+#if defined(__linux__)
+  if ( options.affinity ) {
+    cpu_set_t cpus;
+    CPU_ZERO( &cpus );
+    for ( unsigned int i=0; i<64; ++i )
+      if ( options.affinity & ( 1ULL << i ) ) CPU_SET( i, &cpus );
+    int err = pthread_setaffinity_np( id, sizeof(cpus), &cpus );
+    if ( err ) {
+      errorString_ = "MidiInApi::setThreadOptions: error setting the CPU affinity of the input thread: ";
+      errorString_ += strerror( err );
+      errorString_ += '.';
+      error( RtMidiError::WARNING, errorString_ );
+    }
+  }
+
+  if ( !options.name.empty() ) {
+    int err = pthread_setname_np( id, options.name.substr( 0, 15 ).c_str() );
+    if ( err ) {
+      errorString_ = "MidiInApi::setThreadOptions: error setting the name of the input thread: ";
+      errorString_ += strerror( err );
+      errorString_ += '.';
+      error( RtMidiError::WARNING, errorString_ );
+    }
+  }
+#else
+  if ( options.affinity ) {
+    errorString_ = "MidiInApi::setThreadOptions: CPU affinity is not supported on this system.";
+    error( RtMidiError::WARNING, errorString_ );
+  }
+#endif
+#endif
+}
+
+RtMidiStats MidiInApi :: getStats( void )
+{
+  RtMidiStats stats;
+  inputData_.stats.get( &stats );
+  return stats;
+}
+
+void MidiInApi :: setStatsCallback( RtMidiStatsCallback callback, void *userData, double interval )
+{
+  inputData_.stats.setCallback( callback, userData, interval );
+}
+
+// The route list is copied on every change and swapped in whole, so
+// the input thread reads it without locking.  The previous list is
+// deleted once the input thread is done with it: it counts its uses
+// of the list in routesEntered before loading it, and in routesLeft
+// after.
+void MidiInApi :: updateRoutes( std::vector<MidiRoute> *routes )
+{
+  std::vector<MidiRoute> *previous = inputData_.routes.load();
+  inputData_.routes.store( routes );
+
+  unsigned int entered = inputData_.routesEntered.load();
+  while ( (int) ( inputData_.routesLeft.load() - entered ) < 0 )
+    std::this_thread::yield();
+  delete previous;
+}
+
+// The output is attached for each route forwarded by the input
+// thread, before the thread can use it, and detached once the thread
+// is done with it.
+void MidiInApi :: addRoute( MidiOutApi *output, const RtMidiRoute &route )
+{
+  std::vector<MidiRoute> *previous = inputData_.routes.load();
+  std::vector<MidiRoute> *routes = previous ? new std::vector<MidiRoute>( *previous ) : new std::vector<MidiRoute>;
+
+  bool detach = false;
+  for ( size_t i=0; i<routes->size(); ++i ) {
+    if ( (*routes)[i].output != output ) continue;
+    if ( (*routes)[i].handle ) disconnectRoute( (*routes)[i].handle );
+    else detach = true;
+    routes->erase( routes->begin() + i );
+    break;
+  }
+
+  MidiRoute entry;
+  entry.output = output;
+  entry.route = route;
+  entry.handle = route.isTransparent() ? connectRoute( output ) : 0;
+  if ( !entry.handle ) output->attachRoute();
+  routes->push_back( entry );
+  updateRoutes( routes );
+  if ( detach ) output->detachRoute();
+}
+
+void MidiInApi :: removeRoute( MidiOutApi *output )
+{
+  std::vector<MidiRoute> *previous = inputData_.routes.load();
+  if ( !previous ) return;
+
+  std::vector<MidiRoute> *routes = new std::vector<MidiRoute>;
+  bool detach = false;
+  for ( size_t i=0; i<previous->size(); ++i ) {
+    if ( (*previous)[i].output != output )
+      routes->push_back( (*previous)[i] );
+    else if ( (*previous)[i].handle )
+      disconnectRoute( (*previous)[i].handle );
+    else
+      detach = true;
+  }
+  if ( routes->empty() ) {
+    delete routes;
+    routes = 0;
+  }
+  updateRoutes( routes );
+  if ( detach ) output->detachRoute();
+}
+
+// Called from the destructors of the APIs with native routes, while
+// they can still be disconnected.
+void MidiInApi :: removeRoutes( void )
+{
+  std::vector<MidiRoute> *routes = inputData_.routes.load();
+  if ( !routes ) return;
+
+  std::vector<MidiOutApi *> outputs;
+  for ( size_t i=0; i<routes->size(); ++i ) {
+    if ( (*routes)[i].handle ) disconnectRoute( (*routes)[i].handle );
+    else outputs.push_back( (*routes)[i].output );
+  }
+  updateRoutes( 0 );
+  for ( size_t i=0; i<outputs.size(); ++i ) outputs[i]->detachRoute();
+}
+
+void *MidiInApi :: connectRoute( MidiOutApi * /*output*/ )
+{
+  return 0;
+}
+
+void MidiInApi :: disconnectRoute( void * /*handle*/ )
+{
+}
 
+int MidiInApi :: subscribe( RtMidiIn::RtMidiViewCallback callback, void *userData, RtMidiIn::Overflow overflow )
+{
   if ( inputData_.usingCallback ) {
-    errorString_ = "RtMidiIn::getNextMessage: a user callback is currently set for this port.";
+    errorString_ = "MidiInApi::subscribe: a user callback is currently set for this port.";
     error( RtMidiError::WARNING, errorString_ );
-    return 0.0;
+    return -1;
   }
 
-  if ( inputData_.queue.size == 0 ) return 0.0;
+  MidiQueue &queue = inputData_.queue;
+  if ( queue.ringSize == 0 ) {
+    errorString_ = "MidiInApi::subscribe: the input queue of this port holds no messages.";
+    error( RtMidiError::WARNING, errorString_ );
+    return -1;
+  }
 
-  // Copy queued message to the vector pointer argument and then "pop" it.
-  std::vector<unsigned char> *bytes = &(inputData_.queue.ring[inputData_.queue.front].bytes);
-  message->assign( bytes->begin(), bytes->end() );
-  double deltaTime = inputData_.queue.ring[inputData_.queue.front].timeStamp;
-  inputData_.queue.size--;
-  inputData_.queue.front++;
-  if ( inputData_.queue.front == inputData_.queue.ringSize )
-    inputData_.queue.front = 0;
+  MidiBroadcast *b = queue.broadcast.load();
+  if ( !b ) {
+    b = new MidiBroadcast;
+    queue.broadcast.store( b );
+  }
 
-  return deltaTime;
+  unsigned int active = b->active.load();
+  int i = 0;
+  while ( i < RTMIDI_MAX_SUBSCRIBERS && ( active & ( 1u << i ) ) ) ++i;
+  if ( i == RTMIDI_MAX_SUBSCRIBERS ) {
+    errorString_ = "MidiInApi::subscribe: the maximum number of subscribers is reached.";
+    error( RtMidiError::WARNING, errorString_ );
+    return -1;
+  }
+
+  // The subscriber starts with the next message, and is published to
+  // the producer once set up.
+  MidiSubscriber &subscriber = b->subscribers[i];
+  subscriber.callback = callback;
+  subscriber.userData = userData;
+  subscriber.lost.store( 0 );
+  subscriber.position.store( queue.back.load() );
+  if ( callback )
+    b->callbacks.fetch_or( 1u << i );
+  else if ( overflow == RtMidiIn::DROP_NEWEST )
+    b->holding.fetch_or( 1u << i );
+  b->active.fetch_or( 1u << i );
+  return i;
 }
 
-//*********************************************************************//
-//  Common MidiOutApi Definitions
-//*********************************************************************//
+void MidiInApi :: unsubscribe( int subscriber )
+{
+  MidiBroadcast *b = inputData_.queue.broadcast.load();
+  if ( !b || subscriber < 0 || subscriber >= RTMIDI_MAX_SUBSCRIBERS ||
+       !( b->active.load() & ( 1u << subscriber ) ) ) {
+    errorString_ = "MidiInApi::unsubscribe: the subscriber is not set.";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
 
-MidiOutApi :: MidiOutApi( void )
-  : MidiApi()
+  b->callbacks.fetch_and( ~( 1u << subscriber ) );
+  b->holding.fetch_and( ~( 1u << subscriber ) );
+  b->active.fetch_and( ~( 1u << subscriber ) );
+
+  // Wait until the producer is done with a callback it may be calling.
+  unsigned int entered = b->entered.load();
+  while ( (int) ( b->left.load() - entered ) < 0 )
+    std::this_thread::yield();
+}
+
+size_t MidiInApi :: poll( int subscriber, unsigned char *message, size_t capacity,
+                          double *timeStamp, unsigned long long *absoluteTime )
+{
+  MidiBroadcast *b = inputData_.queue.broadcast.load( std::memory_order_acquire );
+  if ( !b || subscriber < 0 || subscriber >= RTMIDI_MAX_SUBSCRIBERS ||
+       !( ( b->active.load( std::memory_order_relaxed ) & ~b->callbacks.load( std::memory_order_relaxed ) )
+          & ( 1u << subscriber ) ) ) {
+    errorString_ = "MidiInApi::poll: the subscriber is not set or has a callback.";
+    error( RtMidiError::WARNING, errorString_ );
+    return 0;
+  }
+
+  return inputData_.queue.poll( b->subscribers[subscriber], message, capacity, timeStamp, absoluteTime );
+}
+
+unsigned long long MidiInApi :: getSubscriberLosses( int subscriber )
 {
+  MidiBroadcast *b = inputData_.queue.broadcast.load();
+  if ( !b || subscriber < 0 || subscriber >= RTMIDI_MAX_SUBSCRIBERS ) return 0;
+  return b->subscribers[subscriber].lost.load( std::memory_order_relaxed );
 }
 
-MidiOutApi :: ~MidiOutApi( void )
+// Send a message to the outputs whose routes it passes.  Only channel
+// messages of up to three bytes can be remapped, on a copy.
+void MidiInApi::RtMidiInData :: forward( const unsigned char *bytes, size_t size )
 {
+  routesEntered.store( routesEntered.load( std::memory_order_relaxed ) + 1 );
+  std::vector<MidiRoute> *list = routes.load();
+
+  unsigned char status = size > 0 ? bytes[0] : 0;
+  if ( list && ( status & 0x80 ) ) {
+    for ( size_t i=0; i<list->size(); ++i ) {
+      const MidiRoute &entry = (*list)[i];
+      if ( entry.handle ) continue;
+
+      const unsigned char *message = bytes;
+      unsigned char buffer[3];
+      if ( status < 0xF0 ) {
+        unsigned int channel = status & 0x0F;
+        if ( !( entry.route.channels & ( 1 << channel ) ) ||
+             !( entry.route.types & ( 1 << ( ( status >> 4 ) - 8 ) ) ) ) continue;
+        if ( entry.route.channelMap[channel] != channel && size <= 3 ) {
+          buffer[0] = ( status & 0xF0 ) | ( entry.route.channelMap[channel] & 0x0F );
+          for ( size_t j=1; j<size; ++j ) buffer[j] = bytes[j];
+          message = buffer;
+        }
+      }
+      else if ( !entry.route.system ) continue;
+
+      entry.output->sendRouted( message, size );
+    }
+  }
+
+  routesLeft.store( routesEntered.load( std::memory_order_relaxed ) );
+}
+
+const unsigned char MidiInApi::MidiParser :: lengths[256] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, // 0x00: data bytes
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // 0x80: note off
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // 0x90: note on
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // 0xA0: polyphonic pressure
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // 0xB0: control change
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 0xC0: program change
+  2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, // 0xD0: channel pressure
+  3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, // 0xE0: pitch bend
+  0, 2, 3, 2, 1, 1, 1, 0, 1, 1, 1, 1, 1, 1, 1, 1  // 0xF0: system common and realtime
+};
+
+// The loop takes a byte at a time, except for the data bytes of a
+// sysex message, which are scanned at once into a single fragment.
+bool MidiInApi::MidiParser :: parse( const unsigned char *bytes, unsigned int nBytes, unsigned int *offset,
+                                     MidiParsed *parsed )
+{
+  unsigned int i = *offset;
+  while ( i < nBytes ) {
+    unsigned char byte = bytes[i];
+    unsigned int start = i;
+
+    if ( byte >= 0xF8 ) {
+      // A realtime message, which may come anywhere.
+      *offset = i + 1;
+      parsed->bytes = &bytes[i];
+      parsed->size = 1;
+      parsed->sysex = false;
+      return true;
+    }
+
+    if ( !inSysex ) {
+      if ( byte & 0x80 ) {
+        // A status byte; those of system messages cancel running status.
+        runningStatus = byte < 0xF0 ? byte : 0;
+        count = 0;
+        size = lengths[byte];
+        if ( byte == 0xF0 ) {
+          inSysex = true;
+          firstFragment = true;
+          ++i;
+        }
+        else {
+          // An end of sysex with no start, if the size is zero.
+          ++i;
+          if ( size == 0 ) continue;
+          message[count++] = byte;
+        }
+      }
+      else if ( count > 0 ) {
+        message[count++] = byte;
+        ++i;
+      }
+      else if ( runningStatus ) {
+        size = lengths[runningStatus];
+        message[0] = runningStatus;
+        message[1] = byte;
+        count = 2;
+        ++i;
+      }
+      else {
+        // A data byte with no status to follow, which is skipped.
+        ++i;
+        continue;
+      }
+
+      if ( !inSysex ) {
+        if ( count < size ) continue;
+        count = 0;
+        *offset = i;
+        parsed->bytes = message;
+        parsed->size = size;
+        parsed->sysex = false;
+        return true;
+      }
+    }
+
+    // Take the sysex bytes up to a realtime or status byte, or the end
+    // of the input.
+    while ( i < nBytes && bytes[i] < 0x80 ) ++i;
+    bool last = i < nBytes && bytes[i] < 0xF8;
+    if ( last ) {
+      if ( bytes[i] == 0xF7 ) ++i;
+      inSysex = false;
+    }
+    else if ( i == start ) continue;
+
+    *offset = i;
+    parsed->bytes = &bytes[start];
+    parsed->size = i - start;
+    parsed->sysex = true;
+    parsed->first = firstFragment;
+    parsed->last = last;
+    firstFragment = false;
+    return true;
+  }
+
+  *offset = nBytes;
+  return false;
+}
+
+// Sysex messages are passed to the sysex callback as they come, or
+// assembled in sysex.  Whether a message is filtered out, and whether
+// it is streamed, is decided with its first fragment.
+void MidiInApi::RtMidiInData :: receive( const unsigned char *bytes, unsigned int size, double timeStamp,
+                                         unsigned long long time )
+{
+  MidiParsed parsed;
+  unsigned int offset = 0;
+  while ( parser.parse( bytes, size, &offset, &parsed ) ) {
+    if ( !parsed.sysex ) {
+      if ( !filter[parsed.bytes[0]] ) continue;
+      message.bytes.assign( parsed.bytes, parsed.bytes + parsed.size );
+      deliver( &message.bytes, timeStamp, time );
+      continue;
+    }
+
+    if ( parsed.first ) {
+      sysexSkipped = !filter[0xF0];
+      sysexStreamed = ( sysexCallback.load( std::memory_order_relaxed ) != 0 );
+      sysexTimeStamp = timeStamp;
+      sysexTime = time;
+      sysex.clear();
+    }
+    if ( sysexSkipped ) continue;
+
+    if ( sysexStreamed ) {
+      RtMidiIn::RtMidiSysexCallback callback = sysexCallback.load( std::memory_order_acquire );
+      if ( !callback ) continue;
+      MidiStats::add( stats.bytes, parsed.size );
+      if ( parsed.last ) stats.countMessage( 0, time );
+      callback( timeStamp, parsed.bytes, parsed.size, parsed.first, parsed.last,
+                sysexUserData.load( std::memory_order_relaxed ) );
+      continue;
+    }
+
+    sysex.insert( sysex.end(), parsed.bytes, parsed.bytes + parsed.size );
+    if ( !parsed.last ) continue;
+    if ( !parsed.first && parsed.size > 0 ) MidiStats::add( stats.sysexReassemblies );
+    deliver( &sysex, sysexTimeStamp, sysexTime );
+  }
+}
+
+// Deliver a complete message to the routes, then the callback or the
+// queue.
+void MidiInApi::RtMidiInData :: deliver( std::vector<unsigned char> *bytes, double timeStamp,
+                                         unsigned long long time )
+{
+  stats.countMessage( bytes->size(), time );
+  route( bytes->data(), bytes->size() );
+  enterCallback();
+  if ( usingCallback ) {
+    RtMidiIn::RtMidiCallback callback = userCallback;
+    message.timeStamp = timeStamp;
+    message.absoluteTime = time;
+    unsigned long long start = RtMidi::getCurrentTime();
+    callback( timeStamp, bytes, userData );
+    stats.countCallback( start );
+  }
+  else {
+    // As long as we haven't reached our queue size limit, push the message.
+    if ( !queue.push( bytes->data(), (unsigned int) bytes->size(), timeStamp, time ) )
+      std::cerr << "\nRtMidiIn: message queue limit reached!!\n\n";
+  }
+  leaveCallback();
+}
+
+void MidiInApi :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense )
+{
+  unsigned char *filter = inputData_.filter;
+  filter[0xF0] = !midiSysex;
+  filter[0xF1] = filter[0xF8] = filter[0xF9] = !midiTime;
+  filter[0xFE] = !midiSense;
+  for ( unsigned int i=0; i<0x80; ++i ) filter[i] = filter[0xF0];
+}
+
+// The channel mask is folded into the table, so that the input
+// threads decide with a single lookup.  Data bytes, which continue a
+// sysex message, follow the entry of 0xF0.
+void MidiInApi :: setMessageFilter( const unsigned char *filter, unsigned short channels )
+{
+  for ( unsigned int i=0x80; i<0x100; ++i ) {
+    bool pass = filter ? filter[i] != 0 : true;
+    if ( i < 0xF0 && !( channels & ( 1 << ( i & 0x0F ) ) ) ) pass = false;
+    inputData_.filter[i] = pass;
+  }
+  for ( unsigned int i=0; i<0x80; ++i ) inputData_.filter[i] = inputData_.filter[0xF0];
+}
+
+double MidiInApi :: getMessage( std::vector<unsigned char> *message )
+{
+  message->clear();
+
+  if ( inputData_.usingCallback ) {
+    errorString_ = "RtMidiIn::getNextMessage: a user callback is currently set for this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return 0.0;
+  }
+
+  if ( inputData_.queue.subscribers() ) {
+    errorString_ = "RtMidiIn::getNextMessage: subscribers are reading the messages of this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    return 0.0;
+  }
+
+  double deltaTime = 0.0;
+  inputData_.queue.pop( message, &deltaTime, &inputData_.lastAbsoluteTime, &inputData_.lastFrameTime );
+
+  return deltaTime;
+}
+
+unsigned long long MidiInApi :: getMessageTime( unsigned int *frameTime )
+{
+  // In callback mode the message being delivered is held in
+  // inputData_.message, otherwise it is the last one popped.
+  if ( inputData_.usingCallback ) {
+    if ( frameTime ) *frameTime = inputData_.message.frameTime;
+    return inputData_.message.absoluteTime;
+  }
+
+  if ( frameTime ) *frameTime = inputData_.lastFrameTime;
+  return inputData_.lastAbsoluteTime;
+}
+
+unsigned int MidiInApi :: getMessages( double *timeStamps, size_t *offsets, unsigned char *data, size_t dataSize, unsigned int maxCount )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "RtMidiIn::getMessages: a user callback is currently set for this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    offsets[0] = 0;
+    return 0;
+  }
+
+  if ( inputData_.queue.subscribers() ) {
+    errorString_ = "RtMidiIn::getMessages: subscribers are reading the messages of this port.";
+    error( RtMidiError::WARNING, errorString_ );
+    offsets[0] = 0;
+    return 0;
+  }
+
+  return inputData_.queue.pop( timeStamps, offsets, data, dataSize, maxCount );
+}
+
+RtMidiIn::RtMidiWaitHandle MidiInApi :: getWaitHandle( void )
+{
+  if ( !inputData_.queue.openWaitHandle() ) {
+    errorString_ = "MidiInApi::getWaitHandle: error creating the wait handle of the input queue.";
+    error( RtMidiError::SYSTEM_ERROR, errorString_ );
+#if defined(_WIN32)
+    return 0;
+#else
+    return -1;
+#endif
+  }
+
+  return inputData_.queue.waitHandle;
+}
+
+bool MidiInApi :: waitForMessage( double timeout )
+{
+  if ( inputData_.usingCallback || inputData_.queue.subscribers() ) return false;
+  if ( inputData_.queue.size() > 0 ) return true;
+
+  if ( !inputData_.queue.openWaitHandle() ) {
+    errorString_ = "MidiInApi::waitForMessage: error creating the wait handle of the input queue.";
+    error( RtMidiError::SYSTEM_ERROR, errorString_ );
+    return false;
+  }
+
+  // The handle may be left signalled by a message that was read, so
+  // wait again for whatever remains of the timeout when it shows an
+  // empty queue.
+  std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() +
+    std::chrono::duration_cast<std::chrono::steady_clock::duration>( std::chrono::duration<double>( timeout > 0.0 ? timeout : 0.0 ) );
+  while ( inputData_.queue.size() == 0 ) {
+    int milliseconds = -1;
+    if ( timeout >= 0.0 ) {
+      double remaining = std::chrono::duration<double>( deadline - std::chrono::steady_clock::now() ).count();
+      if ( remaining <= 0.0 ) break;
+      milliseconds = (int) std::ceil( remaining * 1000.0 );
+    }
+
+#if defined(_WIN32)
+    WaitForSingleObject( (HANDLE) inputData_.queue.waitHandle, milliseconds < 0 ? INFINITE : (DWORD) milliseconds );
+#else
+    struct pollfd pfd;
+    pfd.fd = inputData_.queue.waitHandle;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    ::poll( &pfd, 1, milliseconds );
+#endif
+
+    // Reset a handle left signalled with the queue empty.
+    if ( inputData_.queue.size() == 0 )
+      inputData_.queue.signalPop( inputData_.queue.front.load( std::memory_order_relaxed ) );
+    if ( inputData_.usingCallback ) return false;
+  }
+
+  return inputData_.queue.size() > 0;
+}
+
+//*********************************************************************//
+//  Common MidiInApi::MidiQueue Definitions
+//*********************************************************************//
+
+MidiInApi::MidiQueue :: ~MidiQueue( void )
+{
+  if ( locked ) {
+#if defined(_WIN32)
+    if ( ring ) VirtualUnlock( ring, ( ringMask + 1 ) * sizeof(MidiQueueSlot) );
+    if ( arena ) VirtualUnlock( arena, arenaSize );
+#else
+    if ( ring ) munlock( ring, ( ringMask + 1 ) * sizeof(MidiQueueSlot) );
+    if ( arena ) munlock( arena, arenaSize );
+#endif
+  }
+  delete [] ring;
+  delete [] arena;
+  delete broadcast.load();
+  if ( waitable.load() ) {
+#if defined(_WIN32)
+    CloseHandle( (HANDLE) waitHandle );
+#else
+    if ( waitSignal != waitHandle ) close( waitSignal );
+    close( waitHandle );
+#endif
+  }
+}
+
+// Round a non-zero size up to a power of two so indices can be masked.
+static unsigned int nextPowerOfTwo( unsigned int size )
+{
+  unsigned int n = 1;
+  while ( n < size ) n <<= 1;
+  return n;
+}
+
+void MidiInApi::MidiQueue :: allocate( unsigned int queueSizeLimit, unsigned int sysexQueueSize )
+{
+  delete [] ring;
+  delete [] arena;
+  ring = 0;
+  arena = 0;
+  ringSize = queueSizeLimit;
+  ringMask = 0;
+  arenaSize = 0;
+  arenaMask = 0;
+  arenaHead = 0;
+  pendingStart = 0;
+  pendingSize = 0;
+  pendingValid = 0;
+  front.store( 0, std::memory_order_relaxed );
+  back.store( 0, std::memory_order_relaxed );
+  arenaTail.store( 0, std::memory_order_relaxed );
+  if ( ringSize == 0 ) return;
+
+  unsigned int nSlots = nextPowerOfTwo( ringSize );
+  ringMask = nSlots - 1;
+  ring = new MidiQueueSlot[ nSlots ];
+
+  if ( sysexQueueSize == 0 ) return;
+  arenaSize = nextPowerOfTwo( sysexQueueSize );
+  arenaMask = arenaSize - 1;
+  arena = new unsigned char[ arenaSize ];
+}
+
+// Publish the index or arena position the producer is about to write
+// up to, before writing it, like the sequence number of a seqlock.
+static inline void claim( std::atomic<unsigned int> &counter, unsigned int position )
+{
+  counter.store( position, std::memory_order_relaxed );
+  std::atomic_thread_fence( std::memory_order_release );
+}
+
+// Called only from the producer (API input) thread.
+bool MidiInApi::MidiQueue :: push( const unsigned char *bytes, unsigned int size, double timeStamp,
+                                   unsigned long long absoluteTime, unsigned int frameTime )
+{
+  unsigned int _back = back.load( std::memory_order_relaxed );
+
+  MidiBroadcast *b = subscribers();
+
+  // The acquire pairs with the consumer's release of front, so the
+  // slot we are about to overwrite has been completely read.
+  unsigned int _front = b ? holdFront( b, _back ) : front.load( std::memory_order_acquire );
+  if ( _back - _front >= ringSize )
+    return drop();
+
+  unsigned int start = arenaHead;
+  if ( size > 3 ) {
+    if ( size > arenaSize ) return drop();
+
+    // Keep each message contiguous: if it doesn't fit before the end
+    // of the arena, skip the remainder and start at the beginning.
+    unsigned int index = start & arenaMask;
+    if ( index + size > arenaSize ) start += arenaSize - index;
+    if ( start + size - arenaTail.load( std::memory_order_acquire ) > arenaSize )
+      return drop();
+  }
+
+  if ( b ) {
+    claim( b->slotClaim, _back + 1 );
+    if ( size > 3 ) claim( b->arenaClaim, start + size );
+  }
+  MidiQueueSlot& slot = ring[_back & ringMask];
+  slot.arenaStart = arenaHead;
+  if ( size <= 3 ) {
+    for ( unsigned int i=0; i<size; ++i ) slot.bytes[i] = bytes[i];
+  }
+  else {
+    memcpy( arena + ( start & arenaMask ), bytes, size );
+    slot.offset = start;
+    arenaHead = start + size;
+  }
+  slot.size = size;
+  slot.timeStamp = timeStamp;
+  slot.absoluteTime = absoluteTime;
+  slot.frameTime = frameTime;
+  back.store( _back + 1, std::memory_order_release );
+  if ( !b && waitable.load( std::memory_order_relaxed ) ) signalPush( _back + 1 );
+  countSize( _back + 1 - _front );
+  if ( b ) dispatch( b, slot );
+  return true;
+}
+
+// Called only from the producer thread, to start assembling a message.
+void MidiInApi::MidiQueue :: beginPending( void )
+{
+  pendingStart = arenaHead;
+  pendingSize = 0;
+  pendingValid = 1;
+}
+
+// Called only from the producer thread.  The pending message is kept
+// contiguous: if it outgrows the end of the arena, the part already
+// written is moved to the start.  Once a chunk doesn't fit, the whole
+// message is dropped.
+bool MidiInApi::MidiQueue :: appendPending( const unsigned char *bytes, unsigned int size )
+{
+  if ( !pendingValid ) return false;
+
+  unsigned int total = pendingSize + size;
+  unsigned int start = pendingStart;
+  unsigned int index = start & arenaMask;
+  if ( total > arenaSize ) {
+    pendingValid = 0;
+    return false;
+  }
+  if ( index + total > arenaSize ) start += arenaSize - index;
+  MidiBroadcast *b = subscribers();
+  if ( b ) holdFront( b, back.load( std::memory_order_relaxed ) );
+  if ( start + total - arenaTail.load( std::memory_order_acquire ) > arenaSize ) {
+    pendingValid = 0;
+    return false;
+  }
+
+  if ( b ) claim( b->arenaClaim, start + total );
+  if ( start != pendingStart ) {
+    memmove( arena, arena + index, pendingSize );
+    pendingStart = start;
+  }
+  memcpy( arena + ( ( start & arenaMask ) + pendingSize ), bytes, size );
+  pendingSize = total;
+  return true;
+}
+
+// Called only from the producer thread.  Publishes the pending
+// message where it was assembled.
+bool MidiInApi::MidiQueue :: pushPending( double timeStamp, unsigned long long absoluteTime, unsigned int frameTime )
+{
+  if ( !pendingValid ) return drop();
+  pendingValid = 0;
+
+  unsigned int _back = back.load( std::memory_order_relaxed );
+  MidiBroadcast *b = subscribers();
+  unsigned int _front = b ? holdFront( b, _back ) : front.load( std::memory_order_acquire );
+  if ( _back - _front >= ringSize )
+    return drop();
+
+  if ( b ) claim( b->slotClaim, _back + 1 );
+  MidiQueueSlot& slot = ring[_back & ringMask];
+  slot.arenaStart = arenaHead;
+  if ( pendingSize <= 3 ) {
+    const unsigned char *bytes = arena + ( pendingStart & arenaMask );
+    for ( unsigned int i=0; i<pendingSize; ++i ) slot.bytes[i] = bytes[i];
+  }
+  else {
+    slot.offset = pendingStart;
+    arenaHead = pendingStart + pendingSize;
+  }
+  slot.size = pendingSize;
+  slot.timeStamp = timeStamp;
+  slot.absoluteTime = absoluteTime;
+  slot.frameTime = frameTime;
+  back.store( _back + 1, std::memory_order_release );
+  if ( !b && waitable.load( std::memory_order_relaxed ) ) signalPush( _back + 1 );
+  countSize( _back + 1 - _front );
+  if ( b ) dispatch( b, slot );
+  return true;
+}
+
+// Called only from the consumer (user) thread.
+bool MidiInApi::MidiQueue :: pop( std::vector<unsigned char> *message, double *timeStamp,
+                                  unsigned long long *absoluteTime, unsigned int *frameTime )
+{
+  unsigned int _front = front.load( std::memory_order_relaxed );
+
+  // The acquire pairs with the producer's release of back, so the
+  // slot contents are visible before we read them.
+  if ( _front == back.load( std::memory_order_acquire ) )
+    return false;
+
+  // Copy queued message to the vector pointer argument and then "pop" it.
+  const MidiQueueSlot& slot = ring[_front & ringMask];
+  if ( slot.size <= 3 )
+    message->assign( slot.bytes, slot.bytes + slot.size );
+  else {
+    const unsigned char *bytes = arena + ( slot.offset & arenaMask );
+    message->assign( bytes, bytes + slot.size );
+    arenaTail.store( slot.offset + slot.size, std::memory_order_release );
+  }
+  *timeStamp = slot.timeStamp;
+  *absoluteTime = slot.absoluteTime;
+  *frameTime = slot.frameTime;
+  front.store( _front + 1, std::memory_order_release );
+  if ( waitable.load( std::memory_order_relaxed ) ) signalPop( _front + 1 );
+  return true;
+}
+
+// Called only from the consumer (user) thread.  The indices are read
+// and published once for the whole batch.
+unsigned int MidiInApi::MidiQueue :: pop( double *timeStamps, size_t *offsets, unsigned char *data, size_t dataSize, unsigned int maxCount )
+{
+  unsigned int _front = front.load( std::memory_order_relaxed );
+  unsigned int _back = back.load( std::memory_order_acquire );
+  unsigned int _arenaTail = arenaTail.load( std::memory_order_relaxed );
+  bool releaseArena = false;
+
+  unsigned int nMessages = _back - _front;
+  if ( nMessages > maxCount ) nMessages = maxCount;
+
+  size_t offset = 0;
+  unsigned int i;
+  for ( i=0; i<nMessages; ++i ) {
+    const MidiQueueSlot& slot = ring[( _front + i ) & ringMask];
+    if ( slot.size > dataSize - offset ) break;
+
+    offsets[i] = offset;
+    timeStamps[i] = slot.timeStamp;
+    if ( slot.size <= 3 ) {
+      for ( unsigned int j=0; j<slot.size; ++j ) data[offset + j] = slot.bytes[j];
+    }
+    else {
+      memcpy( data + offset, arena + ( slot.offset & arenaMask ), slot.size );
+      _arenaTail = slot.offset + slot.size;
+      releaseArena = true;
+    }
+    offset += slot.size;
+  }
+  offsets[i] = offset;
+
+  if ( releaseArena ) arenaTail.store( _arenaTail, std::memory_order_release );
+  front.store( _front + i, std::memory_order_release );
+  if ( i > 0 && waitable.load( std::memory_order_relaxed ) ) signalPop( _front + i );
+  return i;
+}
+
+// Called only from the producer thread while subscribers are set.
+// The queue is held back only by the polled subscribers dropping new
+// messages: the oldest message one of them has not read is the front,
+// and the arena head stored with it the arena tail.  A subscriber that
+// was overwritten meanwhile, before the producer saw it, is skipped
+// until it catches up.
+unsigned int MidiInApi::MidiQueue :: holdFront( MidiBroadcast *b, unsigned int _back )
+{
+  unsigned int _front = _back;
+  unsigned int holding = b->holding.load( std::memory_order_acquire );
+  for ( unsigned int i=0; holding; ++i, holding >>= 1 ) {
+    if ( !( holding & 1 ) ) continue;
+    unsigned int unread = _back - b->subscribers[i].position.load( std::memory_order_acquire );
+    if ( unread > _back - _front && unread <= ringSize ) _front = _back - unread;
+  }
+
+  front.store( _front, std::memory_order_relaxed );
+  arenaTail.store( _front == _back ? arenaHead : ring[_front & ringMask].arenaStart, std::memory_order_relaxed );
+  return _front;
+}
+
+// Called only from the producer thread, with the slot it has just
+// published.  While no subscriber holds the queue back, the front is
+// moved past the message, which is then left to the subscribers only.
+// Like the route list, a subscriber is released once the producer is
+// done calling it: its uses are counted in entered before loading the
+// masks, and in left after.
+void MidiInApi::MidiQueue :: dispatch( MidiBroadcast *b, const MidiQueueSlot &slot )
+{
+  if ( !b->holding.load( std::memory_order_acquire ) ) {
+    front.store( back.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+    arenaTail.store( arenaHead, std::memory_order_relaxed );
+  }
+
+  b->entered.store( b->entered.load( std::memory_order_relaxed ) + 1 );
+  unsigned int callbacks = b->callbacks.load();
+  if ( callbacks ) {
+    const unsigned char *bytes = slot.size <= 3 ? slot.bytes : arena + ( slot.offset & arenaMask );
+    for ( unsigned int i=0; callbacks; ++i, callbacks >>= 1 ) {
+      if ( !( callbacks & 1 ) ) continue;
+      MidiSubscriber &subscriber = b->subscribers[i];
+      subscriber.callback( slot.timeStamp, bytes, slot.size, subscriber.userData );
+    }
+  }
+  b->left.store( b->entered.load( std::memory_order_relaxed ) );
+}
+
+// Called only from the thread reading the subscriber.  The message is
+// copied first and checked afterwards against the claims of the
+// producer: if its slot or bytes were claimed for a newer message
+// while they were copied, the subscriber was lapped, so it skips to
+// the middle of the queue and counts the messages it lost.
+size_t MidiInApi::MidiQueue :: poll( MidiSubscriber &subscriber, unsigned char *message, size_t capacity,
+                                     double *timeStamp, unsigned long long *absoluteTime )
+{
+  MidiBroadcast *b = broadcast.load( std::memory_order_acquire );
+  for ( ;; ) {
+    unsigned int position = subscriber.position.load( std::memory_order_relaxed );
+    unsigned int _back = back.load( std::memory_order_acquire );
+    if ( position == _back ) return 0;
+
+    MidiQueueSlot slot;
+    bool valid = _back - position <= ringSize;
+    if ( valid ) {
+      memcpy( &slot, &ring[position & ringMask], sizeof(MidiQueueSlot) );
+      bool inArena = slot.size > 3 && slot.size <= capacity &&
+        ( slot.offset & arenaMask ) + slot.size <= arenaSize;
+      if ( inArena ) memcpy( message, arena + ( slot.offset & arenaMask ), slot.size );
+
+      std::atomic_thread_fence( std::memory_order_acquire );
+      valid = b->slotClaim.load( std::memory_order_relaxed ) - position <= ringMask + 1;
+      if ( valid && inArena )
+        valid = b->arenaClaim.load( std::memory_order_relaxed ) - slot.offset <= arenaSize;
+    }
+
+    if ( !valid ) {
+      _back = back.load( std::memory_order_acquire );
+      unsigned int next = _back - ringSize / 2;
+      if ( (int) ( next - position ) <= 0 ) next = position + 1;
+      subscriber.lost.store( subscriber.lost.load( std::memory_order_relaxed ) + ( next - position ),
+                             std::memory_order_relaxed );
+      subscriber.position.store( next, std::memory_order_release );
+      continue;
+    }
+
+    if ( slot.size > capacity ) return slot.size;
+    if ( slot.size <= 3 )
+      for ( unsigned int i=0; i<slot.size; ++i ) message[i] = slot.bytes[i];
+    if ( timeStamp ) *timeStamp = slot.timeStamp;
+    if ( absoluteTime ) *absoluteTime = slot.absoluteTime;
+
+    // The release pairs with the acquire of holdFront(), so the slot
+    // is read before the producer may overwrite it.
+    subscriber.position.store( position + 1, std::memory_order_release );
+    if ( slot.size > 0 ) return slot.size;
+  }
+}
+
+unsigned int MidiInApi::MidiQueue :: size( void ) const
+{
+  return back.load( std::memory_order_acquire ) - front.load( std::memory_order_acquire );
+}
+
+// Count a message that could not be queued, and return false.
+bool MidiInApi::MidiQueue :: drop( void )
+{
+  if ( stats ) MidiStats::add( stats->drops );
+  return false;
+}
+
+// Lock the storage of the queue in memory, which also faults its
+// pages in, and return 0 or the error code of the system.
+int MidiInApi::MidiQueue :: lock( void )
+{
+  if ( locked ) return 0;
+
+#if defined(_WIN32)
+  if ( ring && !VirtualLock( ring, ( ringMask + 1 ) * sizeof(MidiQueueSlot) ) )
+    return (int) GetLastError();
+  if ( arena && !VirtualLock( arena, arenaSize ) ) {
+    int err = (int) GetLastError();
+    if ( ring ) VirtualUnlock( ring, ( ringMask + 1 ) * sizeof(MidiQueueSlot) );
+    return err;
+  }
+#else
+  if ( ring && mlock( ring, ( ringMask + 1 ) * sizeof(MidiQueueSlot) ) )
+    return errno;
+  if ( arena && mlock( arena, arenaSize ) ) {
+    int err = errno;
+    if ( ring ) munlock( ring, ( ringMask + 1 ) * sizeof(MidiQueueSlot) );
+    return err;
+  }
+#endif
+
+  locked = true;
+  return 0;
+}
+
+// Record the number of messages held after a push.
+void MidiInApi::MidiQueue :: countSize( unsigned int size )
+{
+  if ( stats && size > stats->queueHighWater.load( std::memory_order_relaxed ) )
+    stats->queueHighWater.store( size, std::memory_order_relaxed );
+}
+
+static void setWaitHandle( MidiInApi::MidiQueue *queue, bool signalled )
+{
+#if defined(_WIN32)
+  if ( signalled ) SetEvent( (HANDLE) queue->waitHandle );
+  else ResetEvent( (HANDLE) queue->waitHandle );
+#elif defined(__linux__)
+  uint64_t value = 1;
+  if ( signalled ) { if ( write( queue->waitSignal, &value, sizeof(value) ) < 0 ) return; }
+  else if ( read( queue->waitHandle, &value, sizeof(value) ) < 0 ) return;
+#else
+  char buffer[64] = { 0 };
+  if ( signalled ) { if ( write( queue->waitSignal, buffer, 1 ) < 0 ) return; }
+  else while ( read( queue->waitHandle, buffer, sizeof(buffer) ) > 0 ) {}
+#endif
+}
+
+// Called only from the consumer thread.  The handle starts out
+// signalled, so that a message pushed while it was being opened is not
+// missed; a spurious wakeup is reset by the next read of the queue.
+bool MidiInApi::MidiQueue :: openWaitHandle( void )
+{
+  if ( waitable.load() ) return true;
+
+#if defined(_WIN32)
+  HANDLE event = CreateEvent( NULL, TRUE, TRUE, NULL );
+  if ( event == NULL ) return false;
+  waitHandle = (RtMidiIn::RtMidiWaitHandle) event;
+#elif defined(__linux__)
+  int fd = eventfd( 1, EFD_NONBLOCK | EFD_CLOEXEC );
+  if ( fd < 0 ) return false;
+  waitHandle = fd;
+  waitSignal = fd;
+#else
+  int fds[2];
+  if ( pipe( fds ) < 0 ) return false;
+  for ( int i=0; i<2; ++i ) {
+    fcntl( fds[i], F_SETFL, fcntl( fds[i], F_GETFL ) | O_NONBLOCK );
+    fcntl( fds[i], F_SETFD, FD_CLOEXEC );
+  }
+  waitHandle = fds[0];
+  waitSignal = fds[1];
+  setWaitHandle( this, true );
+#endif
+
+  waitable.store( true );
+  return true;
+}
+
+// Called only from the producer thread.  The handle is signalled when
+// a push makes the queue non-empty.  The fence orders the publication
+// of back before the read of front, against the opposite order in
+// signalPop(), so that one of the two threads sees the other's update.
+void MidiInApi::MidiQueue :: signalPush( unsigned int _back )
+{
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  if ( _back - front.load( std::memory_order_acquire ) == 1 )
+    setWaitHandle( this, true );
+}
+
+// Called only from the consumer thread.  Once the queue is empty, the
+// handle is reset, then signalled again if a message was pushed
+// meanwhile.
+void MidiInApi::MidiQueue :: signalPop( unsigned int _front )
+{
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  if ( back.load( std::memory_order_acquire ) != _front ) return;
+
+  setWaitHandle( this, false );
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  if ( back.load( std::memory_order_acquire ) != _front )
+    setWaitHandle( this, true );
+}
+
+//*********************************************************************//
+//  Common MidiOutApi Definitions
+//*********************************************************************//
+
+// The state of the output compression.  Once created it is kept until
+// the instance is deleted, but the send functions only go through it
+// while compressing_ is set, and otherwise send directly without its
+// lock.  The mutex serializes the sends of the caller, of the input
+// threads routing to the port and of the flush thread.
+struct MidiOutApi::MidiEncoder {
+  std::mutex mutex;
+  std::condition_variable wake;       // of the flush thread, when a first controller is held
+  std::thread thread;
+  bool running;                       // the flush thread goes on
+  bool runningStatus;
+  unsigned char status;               // the running status, 0 if none
+  unsigned long long coalesceTime;    // in nanoseconds, 0 if off
+  unsigned long long windowEnd;       // the time until which control changes are held
+  unsigned char held[16][128];        // the value held by channel and controller, 0x80 if none
+  std::vector<unsigned short> order;  // channel << 7 | controller of those held, in order
+
+  MidiEncoder() : running(false), runningStatus(false), status(0), coalesceTime(0), windowEnd(0)
+  { memset( held, 0x80, sizeof(held) ); order.reserve( 16 * 128 ); }
+};
+
+MidiOutApi :: MidiOutApi( void )
+  : MidiApi(), asyncSysexCount_( 0 ), sysexSentCallback_( 0 ), sysexSentUserData_( 0 ), encoder_( 0 ),
+    compressing_( false ), routeCount_( 0 ), sendsEntered_( 0 ), sendsLeft_( 0 )
+{
+}
+
+MidiOutApi :: ~MidiOutApi( void )
+{
+  MidiEncoder *encoder = encoder_.load();
+  if ( encoder && encoder->thread.joinable() ) {
+    { std::lock_guard<std::mutex> lock( encoder->mutex ); encoder->running = false; }
+    encoder->wake.notify_one();
+    encoder->thread.join();
+  }
+  delete encoder;
+}
+
+// Without an output buffer of its own a message can always be sent.
+bool MidiOutApi :: trySendMessage( const unsigned char *message, size_t size )
+{
+  sendMessage( message, size );
+  return true;
+}
+
+void MidiOutApi :: setAsyncSysex( unsigned int bufferCount, RtMidiOut::RtMidiSysexSentCallback callback, void *userData )
+{
+  asyncSysexCount_ = bufferCount;
+  sysexSentCallback_ = callback;
+  sysexSentUserData_ = userData;
+}
+
+RtMidiStats MidiOutApi :: getStats( void )
+{
+  RtMidiStats stats;
+  stats_.get( &stats );
+  return stats;
+}
+
+void MidiOutApi :: setStatsCallback( RtMidiStatsCallback callback, void *userData, double interval )
+{
+  stats_.setCallback( callback, userData, interval );
+}
+
+// The sends are counted by whichever thread makes them, one at a time
+// since they are serialized like the sends themselves.
+void MidiOutApi :: countSent( size_t nBytes, unsigned long long time )
+{
+  stats_.countShared( nBytes, time );
+  stats_.report( time );
+}
+
+// Without routes, the application alone sends to the output and needs
+// no lock.  Its sends count themselves in sendsEntered_ before testing
+// routeCount_, and attachRoute() counts the route before waiting for
+// sendsLeft_ to catch up, so each sees the other: either the send takes
+// the mutex, or the route waits until it is done.
+bool MidiOutApi :: enterSend( void )
+{
+  sendsEntered_.fetch_add( 1 );
+  if ( !routeCount_.load() ) return true;
+  leaveSend();
+  return false;
+}
+
+void MidiOutApi :: attachRoute( void )
+{
+  routeCount_.fetch_add( 1 );
+  unsigned int entered = sendsEntered_.load();
+  while ( (int) ( sendsLeft_.load() - entered ) < 0 )
+    std::this_thread::yield();
+}
+
+void MidiOutApi :: detachRoute( void )
+{
+  routeCount_.fetch_sub( 1 );
+}
+
+void MidiOutApi :: send( const unsigned char *message, size_t size )
+{
+  if ( enterSend() ) {
+    sendDirect( message, size, false );
+    countSent( size, RtMidi::getCurrentTime() );
+    leaveSend();
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock( sendMutex_ );
+  sendDirect( message, size, false );
+  countSent( size, RtMidi::getCurrentTime() );
+}
+
+bool MidiOutApi :: trySend( const unsigned char *message, size_t size )
+{
+  bool locked = !enterSend();
+  if ( locked ) sendMutex_.lock();
+  bool sent = sendDirect( message, size, true );
+  if ( sent ) countSent( size, RtMidi::getCurrentTime() );
+  if ( locked ) sendMutex_.unlock();
+  else leaveSend();
+  return sent;
+}
+
+void MidiOutApi :: send( const size_t *offsets, const unsigned char *data, unsigned int count,
+                         const double *timeStamps, bool deltaTime )
+{
+  bool locked = !enterSend();
+  if ( locked ) sendMutex_.lock();
+  sendDirect( offsets, data, count, timeStamps, deltaTime );
+  unsigned long long time = RtMidi::getCurrentTime();
+  for ( unsigned int i=0; i<count; ++i ) countSent( offsets[i+1] - offsets[i], time );
+  if ( locked ) sendMutex_.unlock();
+  else leaveSend();
+}
+
+// Called by the input threads, which always take the mutex: several
+// inputs may be routed to the output.
+void MidiOutApi :: sendRouted( const unsigned char *message, size_t size )
+{
+  std::lock_guard<std::mutex> lock( sendMutex_ );
+  sendDirect( message, size, false );
+  countSent( size, RtMidi::getCurrentTime() );
+}
+
+bool MidiOutApi :: sendDirect( const unsigned char *message, size_t size, bool tryOnly )
+{
+  if ( compressing_.load( std::memory_order_acquire ) ) return encode( message, size, tryOnly );
+  if ( tryOnly ) return trySendMessage( message, size );
+  sendMessage( message, size );
+  return true;
+}
+
+void MidiOutApi :: setOutputCompression( bool runningStatus, double coalesceTime )
+{
+  if ( coalesceTime < 0.0 ) {
+    errorString_ = "MidiOutApi::setOutputCompression: the coalescing time cannot be negative.";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( runningStatus && !allowsRunningStatus() ) {
+    errorString_ = "MidiOutApi::setOutputCompression: running status is not supported by this API.";
+    error( RtMidiError::WARNING, errorString_ );
+    runningStatus = false;
+  }
+
+  bool enabled = runningStatus || coalesceTime > 0.0;
+  MidiEncoder *encoder = encoder_.load();
+  if ( !encoder ) {
+    if ( !enabled ) return;
+    encoder = new MidiEncoder;
+    encoder_.store( encoder, std::memory_order_release );
+  }
+
+  bool coalescing = coalesceTime > 0.0;
+  bool stop = false;
+  {
+    std::lock_guard<std::mutex> lock( encoder->mutex );
+    flushHeld();
+    encoder->status = 0;
+    encoder->runningStatus = runningStatus;
+    encoder->coalesceTime = (unsigned long long) ( coalesceTime * 1000000000.0 );
+    encoder->windowEnd = 0;
+    if ( coalescing != encoder->running ) {
+      encoder->running = coalescing;
+      stop = !coalescing;
+    }
+  }
+
+  if ( coalescing && !encoder->thread.joinable() )
+    encoder->thread = std::thread( &MidiOutApi::runFlushThread, this );
+  else if ( stop ) {
+    encoder->wake.notify_one();
+    encoder->thread.join();
+  }
+
+  // Switched off, the sends go back to the direct path once the held
+  // controllers are sent and the flush thread is stopped, so that
+  // nothing else is still sending through the encoder.
+  compressing_.store( enabled, std::memory_order_release );
+}
+
+void MidiOutApi :: flushOutput( void )
+{
+  if ( !compressing_.load( std::memory_order_acquire ) ) return;
+  MidiEncoder *encoder = encoder_.load( std::memory_order_acquire );
+
+  std::lock_guard<std::mutex> lock( encoder->mutex );
+  flushHeld();
+  encoder->status = 0;
+}
+
+// Batches go through the compression message by message, except for
+// scheduled ones: the system sends those later, with their status.
+void MidiOutApi :: sendDirect( const size_t *offsets, const unsigned char *data, unsigned int count,
+                               const double *timeStamps, bool deltaTime )
+{
+  if ( !compressing_.load( std::memory_order_acquire ) ) {
+    sendMessages( offsets, data, count, timeStamps, deltaTime );
+    return;
+  }
+
+  MidiEncoder *encoder = encoder_.load( std::memory_order_acquire );
+  std::lock_guard<std::mutex> lock( encoder->mutex );
+  if ( timeStamps ) {
+    flushHeld();
+    encoder->status = 0;
+    sendMessages( offsets, data, count, timeStamps, deltaTime );
+    return;
+  }
+
+  for ( unsigned int i=0; i<count; ++i )
+    encodeLocked( data + offsets[i], offsets[i+1] - offsets[i], false );
+}
+
+bool MidiOutApi :: encode( const unsigned char *message, size_t size, bool tryOnly )
+{
+  MidiEncoder *encoder = encoder_.load( std::memory_order_acquire );
+  std::lock_guard<std::mutex> lock( encoder->mutex );
+  return encodeLocked( message, size, tryOnly );
+}
+
+// Hold a control change, or send the message, with its status byte
+// left out when it repeats the running status.
+bool MidiOutApi :: encodeLocked( const unsigned char *message, size_t size, bool tryOnly )
+{
+  MidiEncoder *encoder = encoder_.load( std::memory_order_relaxed );
+  unsigned char status = size > 0 ? message[0] : 0;
+
+  if ( encoder->coalesceTime && size == 3 && ( status & 0xF0 ) == 0xB0 ) {
+    unsigned long long now = RtMidi::getCurrentTime();
+    if ( now < encoder->windowEnd ) {
+      unsigned char &value = encoder->held[status & 0x0F][message[1] & 0x7F];
+      if ( value & 0x80 ) {
+        encoder->order.push_back( ( ( status & 0x0F ) << 7 ) | ( message[1] & 0x7F ) );
+        if ( encoder->order.size() == 1 ) encoder->wake.notify_one();
+      }
+      value = message[2] & 0x7F;
+      return true;
+    }
+    flushHeld();
+    encoder->windowEnd = now + encoder->coalesceTime;
+  }
+  else if ( status < 0xF8 && !encoder->order.empty() )
+    flushHeld();
+
+  if ( status >= 0x80 && status < 0xF0 && size > 1 ) {
+    if ( encoder->runningStatus && status == encoder->status ) {
+      ++message;
+      --size;
+    }
+    encoder->status = status;
+  }
+  else if ( status >= 0xF0 && status < 0xF8 )
+    encoder->status = 0;
+
+  if ( tryOnly ) return trySendMessage( message, size );
+  sendMessage( message, size );
+  return true;
+}
+
+// Send the control changes held, with the lock of the encoder taken.
+void MidiOutApi :: flushHeld( void )
+{
+  MidiEncoder *encoder = encoder_.load( std::memory_order_relaxed );
+  for ( size_t i=0; i<encoder->order.size(); ++i ) {
+    unsigned int channel = encoder->order[i] >> 7;
+    unsigned int controller = encoder->order[i] & 0x7F;
+    unsigned char message[3] = { (unsigned char) ( 0xB0 | channel ), (unsigned char) controller,
+                                 encoder->held[channel][controller] };
+    encoder->held[channel][controller] = 0x80;
+
+    const unsigned char *bytes = message;
+    size_t size = 3;
+    if ( encoder->runningStatus && message[0] == encoder->status ) {
+      ++bytes;
+      --size;
+    }
+    encoder->status = message[0];
+    sendMessage( bytes, size );
+  }
+  encoder->order.clear();
+}
+
+// The flush thread sends the controllers held once their time is up,
+// and starts a new window then, so that each controller is sent at
+// most once per coalescing time.
+void MidiOutApi :: runFlushThread( void )
+{
+  MidiEncoder *encoder = encoder_.load();
+  std::unique_lock<std::mutex> lock( encoder->mutex );
+  while ( encoder->running ) {
+    if ( encoder->order.empty() ) {
+      encoder->wake.wait( lock );
+      continue;
+    }
+
+    unsigned long long now = RtMidi::getCurrentTime();
+    if ( now < encoder->windowEnd ) {
+      encoder->wake.wait_for( lock, std::chrono::nanoseconds( encoder->windowEnd - now ) );
+      continue;
+    }
+
+    flushHeld();
+    encoder->windowEnd = now + encoder->coalesceTime;
+  }
+}
+
+// The default batch implementation, for APIs that have no native way
+// of sending several messages at once or of scheduling them.
+void MidiOutApi :: sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count,
+                                 const double *timeStamps, bool /*deltaTime*/ )
+{
+  if ( timeStamps ) {
+    errorString_ = "MidiOutApi::sendMessages: message scheduling is not supported by this API, sending immediately.";
+    error( RtMidiError::WARNING, errorString_ );
+  }
+
+  for ( unsigned int i=0; i<count; ++i )
+    sendMessage( data + offsets[i], offsets[i+1] - offsets[i] );
 }
 
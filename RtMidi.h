@@ -45,11 +45,25 @@
 
 #define RTMIDI_VERSION "2.1.1"
 
+#include <atomic>
 #include <exception>
 #include <iostream>
+#include <mutex>
 #include <string>
 #include <vector>
 
+// The size (in bytes) of a cache line, used to keep data written by
+// different threads apart.
+#ifndef RTMIDI_CACHE_LINE_SIZE
+#define RTMIDI_CACHE_LINE_SIZE 64
+#endif
+
+// The maximum number of subscribers of an input, see
+// RtMidiIn::subscribe(); at most 32.
+#ifndef RTMIDI_MAX_SUBSCRIBERS
+#define RTMIDI_MAX_SUBSCRIBERS 16
+#endif
+
 /************************************************************************/
 /*! \class RtMidiError
     \brief Exception handling class for RtMidi.
@@ -111,7 +125,82 @@ class RtMidiError : public std::exception
  */
 typedef void (*RtMidiErrorCallback)( RtMidiError::Type type, const std::string &errorText, void *userData );
 
+//! Runtime statistics of an RtMidiIn or RtMidiOut instance.
+/*!
+    The counters run from the creation of the instance, across the
+    ports it opens.  The histograms count durations by powers of two:
+    bin 0 holds those under one microsecond, bin \e i those from
+    2^(i-1) up to 2^i microseconds, and the last bin all longer ones.
+ */
+struct RtMidiStats
+{
+  enum { HISTOGRAM_SIZE = 16 };
+
+  unsigned long long messages;          /*!< Messages received, or sent. */
+  unsigned long long bytes;             /*!< The bytes of those messages. */
+  unsigned long long drops;             /*!< Messages lost because a queue or buffer of RtMidi was full. */
+  unsigned long long overruns;          /*!< Times the API reported lost input (ALSA -ENOSPC, Windows MM sysex buffer underruns). */
+  unsigned long long sysexReassemblies; /*!< Sysex messages assembled from several pieces. */
+  unsigned int queueHighWater;          /*!< The largest number of messages held by the input queue. */
+  unsigned long long callbackTime[HISTOGRAM_SIZE]; /*!< Durations of the calls of the input callback. */
+  unsigned long long interArrival[HISTOGRAM_SIZE]; /*!< Intervals between messages received, or sent. */
+};
+
+//! RtMidi statistics callback function prototype, see RtMidiIn::setStatsCallback().
+typedef void (*RtMidiStatsCallback)( const RtMidiStats &stats, void *userData );
+
+//! Scheduling options of the input threads created by RtMidi, see RtMidiIn::setThreadOptions().
+struct RtMidiThreadOptions
+{
+  //! Scheduling policy specifiers.
+  enum Policy {
+    DEFAULT,        /*!< The default time-sharing policy of the system. */
+    FIFO,           /*!< SCHED_FIFO, or the time-constraint policy on macOS. */
+    ROUND_ROBIN     /*!< SCHED_RR, or the time-constraint policy on macOS. */
+  };
+
+  Policy policy;
+  int priority;                   /*!< The realtime priority for FIFO and ROUND_ROBIN. */
+  unsigned long long affinity;    /*!< The CPUs the thread may run on, bit \e i for CPU \e i, or 0 for any (Linux only). */
+  std::string name;               /*!< The name of the thread, at most 15 characters on Linux, or empty for none. */
+  bool lockMemory;                /*!< Pre-fault and lock the storage of the input queue in memory. */
+
+  //! The default constructor, which leaves everything to the system.
+  RtMidiThreadOptions()
+  : policy(DEFAULT), priority(0), affinity(0), lockMemory(false) {}
+};
+
+//! A route from an RtMidiIn to an RtMidiOut, see RtMidiIn::addRoute().
+/*!
+    By default, every message passes unchanged.
+ */
+struct RtMidiRoute
+{
+  unsigned short channels;        /*!< The channels whose messages pass, bit \e i for channel \e i+1. */
+  unsigned char types;            /*!< The channel messages that pass, bit \e i for status 0x80 + 16 * \e i (note off to pitch bend). */
+  bool system;                    /*!< Whether system messages (sysex, common and realtime) pass. */
+  unsigned char channelMap[16];   /*!< The output channel (0-15) of each input channel. */
+
+  //! The default constructor, for a route passing everything unchanged.
+  RtMidiRoute()
+  : channels(0xFFFF), types(0x7F), system(true)
+  { for ( unsigned char i=0; i<16; i++ ) channelMap[i] = i; }
+
+  //! Returns true if the route passes every message unchanged.
+  bool isTransparent( void ) const
+  {
+    if ( channels != 0xFFFF || ( types & 0x7F ) != 0x7F || !system ) return false;
+    for ( unsigned char i=0; i<16; i++ )
+      if ( channelMap[i] != i ) return false;
+    return true;
+  }
+};
+
 class MidiApi;
+class MidiOutApi;
+class RtMidiOut;
+class MidiContextApi;
+class RtMidiContext;
 
 class RtMidi
 {
@@ -124,7 +213,7 @@ class RtMidi
     LINUX_ALSA,     /*!< The Advanced Linux Sound Architecture API. */
     UNIX_JACK,      /*!< The JACK Low-Latency MIDI Server API. */
     WINDOWS_MM,     /*!< The Microsoft Multimedia MIDI API. */
-    RTMIDI_DUMMY    /*!< A compilable but non-functional API. */
+    RTMIDI_DUMMY    /*!< An in-process loopback between virtual ports. */
   };
 
   //! A static function to determine the current RtMidi version.
@@ -138,6 +227,15 @@ class RtMidi
   */
   static void getCompiledApi( std::vector<RtMidi::Api> &apis ) throw();
 
+  //! A static function returning the current time, in nanoseconds, of the clock used for the absolute time of input messages.
+  /*!
+    The clock is monotonic and shared by all the instances and APIs
+    of the process, so the absolute times of messages received on
+    different ports (see RtMidiIn::getMessageTime()) can be compared
+    directly.
+  */
+  static unsigned long long getCurrentTime( void ) throw();
+
   //! Pure virtual openPort() function.
   virtual void openPort( unsigned int portNumber = 0, const std::string portName = std::string( "RtMidi" ) ) = 0;
 
@@ -210,27 +308,95 @@ class RtMidiIn : public RtMidi
   //! User callback function type definition.
   typedef void (*RtMidiCallback)( double timeStamp, std::vector<unsigned char> *message, void *userData);
 
-  //! Default constructor that allows an optional api, client name and queue size.
+  //! A system handle that can be waited on for input, see getWaitHandle().
+#if defined(_WIN32)
+  typedef void *RtMidiWaitHandle;  // an event HANDLE
+#else
+  typedef int RtMidiWaitHandle;    // a file descriptor
+#endif
+
+  //! View callback function type definition.
+  /*!
+    The message bytes are only valid for the duration of the call.
+  */
+  typedef void (*RtMidiViewCallback)( double timeStamp, const unsigned char *message, size_t size, void *userData );
+
+  //! Timed callback function type definition.
+  /*!
+    Besides the delta time in seconds, the callback receives the
+    absolute time of the message in nanoseconds, on the clock of
+    RtMidi::getCurrentTime(), or zero if the API does not provide it.
+  */
+  typedef void (*RtMidiTimedCallback)( double timeStamp, unsigned long long absoluteTime,
+                                       std::vector<unsigned char> *message, void *userData );
+
+  //! Realtime callback function type definition.
+  /*!
+    The message bytes are only valid for the duration of the call.
+  */
+  typedef void (*RtMidiRealtimeCallback)( double timeStamp, const unsigned char *message, size_t size, void *userData );
+
+  //! Sysex fragment callback function type definition.
+  /*!
+    \e isFirst is set for the fragment starting with 0xF0 and \e isLast
+    for the one ending with 0xF7, so a short sysex message is a single
+    fragment with both set.  The bytes are only valid for the duration
+    of the call.
+  */
+  typedef void (*RtMidiSysexCallback)( double timeStamp, const unsigned char *fragment, size_t size,
+                                       bool isFirst, bool isLast, void *userData );
+
+  //! What a polled subscriber that falls behind loses, see subscribe().
+  enum Overflow {
+    DROP_OLDEST,    /*!< The subscriber skips its oldest unread messages and never holds back the input. */
+    DROP_NEWEST     /*!< Incoming messages are dropped, for every subscriber, until the subscriber catches up. */
+  };
+
+  //! Default constructor that allows an optional api, client name and queue sizes.
   /*!
     An exception will be thrown if a MIDI system initialization
     error occurs.  The queue size defines the maximum number of
     messages that can be held in the MIDI queue (when not using a
     callback function).  If the queue size limit is reached,
-    incoming messages will be ignored.
+    incoming messages will be ignored.  Messages of three bytes or
+    less are stored directly in the queue, while longer (sysex)
+    messages are stored in a separate buffer whose size, in bytes, is
+    fixed at construction.  Queue storage is never reallocated during
+    input, so a sysex message that does not fit in the free space of
+    that buffer is ignored as well.
 
     If no API argument is specified and multiple API support has been
     compiled, the default order of use is ALSA, JACK (Linux) and CORE,
-    JACK (OS-X).
+    JACK (OS-X), and the first API with at least one port is used.
+    The APIs are probed concurrently, without creating any ports, by
+    the first instance created in the process; later instances reuse
+    the result.
 
     \param api        An optional API id can be specified.
     \param clientName An optional client name can be specified. This
                       will be used to group the ports that are created
                       by the application.
     \param queueSizeLimit An optional size of the MIDI input queue can be specified.
+    \param sysexQueueSize An optional size, in bytes, of the queue storage
+                          for messages longer than three bytes can be specified.
   */
   RtMidiIn( RtMidi::Api api=UNSPECIFIED,
             const std::string clientName = std::string( "RtMidi Input Client"),
-            unsigned int queueSizeLimit = 100 );
+            unsigned int queueSizeLimit = 100,
+            unsigned int sysexQueueSize = 65536 );
+
+  //! Constructor attaching the new instance to a shared client context.
+  /*!
+    The instance uses the API and the system client of \e context, so
+    its ports are created on that client and, with ALSA, its input is
+    read by the thread of the context instead of a thread of its own.
+    The context may be destroyed before the instances attached to it.
+    An exception will be thrown if a MIDI system initialization error
+    occurs.
+  */
+  RtMidiIn( RtMidiContext &context,
+            unsigned int queueSizeLimit = 100,
+            unsigned int sysexQueueSize = 65536 );
 
   //! If a MIDI connection is still open, it will be closed by the destructor.
   ~RtMidiIn ( void ) throw();
@@ -271,13 +437,63 @@ class RtMidiIn : public RtMidi
   */
   void setCallback( RtMidiCallback callback, void *userData = 0 );
 
+  //! Set a callback function to be invoked for incoming MIDI messages with their absolute time.
+  /*!
+    This is the same as setCallback(), but the callback is also passed
+    the absolute time of each message.  It is removed with
+    cancelCallback().
+  */
+  void setTimedCallback( RtMidiTimedCallback callback, void *userData = 0 );
+
+  //! Set a callback function to be invoked for incoming MIDI messages, passed as a pointer and a size.
+  /*!
+    This is the same as setCallback(), but the callback receives the
+    bytes of the message instead of a vector, so it can hand them on
+    (to another language binding, a network buffer...) without
+    copying.  It is removed with cancelCallback().
+  */
+  void setViewCallback( RtMidiViewCallback callback, void *userData = 0 );
+
   //! Cancel use of the current callback function (if one exists).
   /*!
     Subsequent incoming MIDI messages will be written to the queue
-    and can be retrieved with the \e getMessage function.
+    and can be retrieved with the \e getMessage function.  The
+    function waits for a call of the callback in progress on another
+    thread to return, so the user data may be freed afterwards, and it
+    must not be called from within the callback.
   */
   void cancelCallback();
 
+  //! Set a callback function to be invoked for incoming MIDI messages directly from the API's realtime thread.
+  /*!
+    Unlike setCallback(), no copy of the message is made and the
+    callback is invoked from the realtime thread that receives the
+    message (the JACK process thread), so it must not block, allocate
+    memory or otherwise take more than a small fraction of the audio
+    period.  The pointer passed to the callback is only valid during
+    the call.  The callback is removed with cancelCallback().  APIs
+    that do not receive MIDI on a realtime thread issue a warning and
+    do not install the callback.
+  */
+  void setRealtimeCallback( RtMidiRealtimeCallback callback, void *userData = 0 );
+
+  //! Set a callback function to be invoked with each fragment of incoming sysex messages.
+  /*!
+    Sysex messages are then no longer assembled: every fragment is
+    passed on as the system delivers it (an ALSA event, a CoreMIDI
+    packet, a Windows MM buffer or a JACK event) and never reaches
+    the normal callback or the queue.  Other messages are delivered
+    as before.  The time stamp of a fragment is the delta time since
+    the previous message or fragment.  Sysex messages must not be
+    ignored (see ignoreTypes()) for the callback to be invoked.
+
+    \param callback A callback function, or NULL to assemble sysex
+                    messages again.
+    \param userData Optionally, a pointer to additional data can be
+                    passed to the callback function whenever it is called.
+  */
+  void setSysexCallback( RtMidiSysexCallback callback, void *userData = 0 );
+
   //! Close an open MIDI connection (if one exists).
   void closePort( void );
 
@@ -303,10 +519,26 @@ class RtMidiIn : public RtMidi
     during message input because of their relative high data rates.
     MIDI sysex messages are ignored by default as well.  Variable
     values of "true" imply that the respective message type will be
-    ignored.
+    ignored.  Timing messages are MIDI time code, clock and tick
+    (0xF1, 0xF8, 0xF9).  The settings are entries of the table of
+    setMessageFilter(), whose other entries are left unchanged.
   */
   void ignoreTypes( bool midiSysex = true, bool midiTime = true, bool midiSense = true );
 
+  //! Specify, by status byte and channel, which MIDI messages are delivered.
+  /*!
+    \e filter holds a flag for each of the 256 status bytes, and the
+    messages whose status has a zero flag are discarded by the input
+    thread before they are copied or queued.  Its entries below 0x80
+    are not used: the parts of a sysex message follow the entry of
+    0xF0.  Channel messages must also be on a channel set in \e
+    channels, bit \e i for channel \e i+1.  A NULL \e filter passes
+    every status, so that, for instance, the channel mask alone
+    selects the channels to receive.  The whole table is replaced,
+    including the settings of ignoreTypes().
+  */
+  void setMessageFilter( const unsigned char *filter, unsigned short channels = 0xFFFF );
+
   //! Fill the user-provided vector with the data bytes for the next available MIDI message in the input queue and return the event delta-time in seconds.
   /*!
     This function returns immediately whether a new message is
@@ -317,6 +549,197 @@ class RtMidiIn : public RtMidi
   */
   double getMessage( std::vector<unsigned char> *message );
 
+  //! Move up to \e maxCount messages from the input queue into user-provided flat buffers and return the number of messages retrieved.
+  /*!
+    This function returns immediately, draining as many queued
+    messages as are available and fit, in a single pass over the
+    queue.  The bytes of message \e i are packed into \e data from
+    offsets[i] up to offsets[i+1] and its delta-time in seconds is
+    written to timeStamps[i], so \e offsets must have room for
+    maxCount + 1 entries.  Retrieval stops early when the next message
+    does not fit in the remaining \e dataSize bytes; if that happens
+    for the first message the function returns 0 and the message can
+    be read with getMessage().  An exception is thrown if an error
+    occurs during message retrieval or an input connection was not
+    previously established.
+  */
+  unsigned int getMessages( double *timeStamps, size_t *offsets, unsigned char *data, size_t dataSize, unsigned int maxCount );
+
+  //! Return a system handle which is signalled while messages are waiting in the input queue.
+  /*!
+    The handle lets the input queue be watched by an event loop
+    (poll, epoll, kqueue, io_uring or WaitForMultipleObjects) instead
+    of polling getMessage().  It is a file descriptor that is readable
+    while the queue holds messages (an eventfd on Linux, the read end
+    of a pipe on other POSIX systems), or a manual-reset event on
+    Windows.  The handle is reset by getMessage() and getMessages()
+    when they empty the queue, so the caller must not read from or
+    reset it, and it remains owned by this instance.  It is not
+    signalled while a callback is set.  An error is reported and an
+    invalid handle (-1, or NULL on Windows) returned if the handle
+    cannot be created.
+  */
+  RtMidiWaitHandle getWaitHandle( void );
+
+  //! Wait until a message is in the input queue, for at most \e timeout seconds, and return whether one is.
+  /*!
+    A negative timeout waits indefinitely.  The function returns at
+    once if a message is already waiting, and returns false without
+    waiting while a callback is set.
+  */
+  bool waitForMessage( double timeout = -1.0 );
+
+  //! Return the absolute time, in nanoseconds, of the last message returned by getMessage() or passed to the callback.
+  /*!
+    The time is taken from the API's own clock (the real time of the
+    ALSA input queue, the JACK frame time, the CoreMIDI host time or
+    the Windows MM input time) and converted to the clock of
+    RtMidi::getCurrentTime(), so times of different ports and APIs can
+    be compared and, unlike the accumulated delta-times, do not drift.
+    With JACK it is reconstructed from the start of the process period
+    and the frame offset of the event, and the JACK frame time of the
+    message is written to \e frameTime if it is not NULL.  The value
+    refers to the message most recently delivered to the calling
+    thread, so call this from within the callback or right after
+    getMessage().  APIs that do not provide absolute times return zero.
+  */
+  unsigned long long getMessageTime( unsigned int *frameTime = 0 );
+
+  //! Set the size and number of the buffers in which the API receives sysex messages (Windows MM only).
+  /*!
+    Sysex messages longer than \e size bytes are delivered in several
+    pieces, and input is lost when all \e count buffers are waiting to
+    be handed back to the driver; see getSysexBufferUnderruns().  The
+    defaults are 4 buffers of 1024 bytes.  The setting takes effect
+    when the next port is opened and is ignored by the other APIs.
+  */
+  void setBufferSize( unsigned int size, unsigned int count );
+
+  //! Return the number of times the API was left without a buffer for sysex input (Windows MM only).
+  /*!
+    A non-zero value means that sysex input may have been lost and
+    that more or larger buffers should be set with setBufferSize().
+    The other APIs return zero.
+  */
+  unsigned int getSysexBufferUnderruns( void );
+
+  //! Set the scheduling options of the input thread created by the API.
+  /*!
+    The options apply to the ALSA input thread and the JACK delivery
+    thread, at once if the thread is running and whenever it is
+    started, and the memory of the input queue is locked on every
+    API.  The thread name is not set on macOS, where a thread can only
+    name itself.  Windows MM and
+    CoreMIDI deliver input on threads of the system, which are not
+    affected, and the thread of a shared RtMidiContext keeps its own
+    scheduling.  Every option that cannot be applied, for example
+    when the process lacks the permission for realtime scheduling
+    (RLIMIT_RTPRIO, CAP_SYS_NICE) or for locking memory
+    (RLIMIT_MEMLOCK), is reported as a warning naming the reason,
+    and the thread keeps running with the default for that option.
+  */
+  void setThreadOptions( const RtMidiThreadOptions &options );
+
+  //! Return the runtime statistics of the instance.
+  /*!
+    The counters are updated by the thread receiving the messages
+    without locking and may be read from any thread.
+  */
+  RtMidiStats getStats( void );
+
+  //! Set a function to be called with the statistics at most every \e interval seconds.
+  /*!
+    The function is called by the thread receiving the messages, when
+    a message arrives at least \e interval seconds after the previous
+    call, so it should return quickly and it is not called while the
+    port is idle.  Set it before opening a port; a NULL function
+    cancels the calls.
+  */
+  void setStatsCallback( RtMidiStatsCallback callback, void *userData = 0, double interval = 1.0 );
+
+  //! Forward the input to \e output, or replace the route to it.
+  /*!
+    Each message delivered by the input (see ignoreTypes()) that
+    passes \e route is sent to \e output by the thread receiving it,
+    before it reaches the callback or the queue.  The message is
+    handed over in place, or from a three-byte copy when its channel
+    is remapped.  Sysex messages streamed to a sysex callback are not
+    forwarded.  The route must be removed before \e output is
+    destroyed.  Several inputs may be routed to the same output, which
+    can still be used by the application: while routes lead to it, its
+    sends are serialized by a mutex, taken by the input threads as
+    well as the application's.  With JACK, routes run in the delivery thread rather
+    than the process thread, even for messages passed to a realtime
+    callback, so they may lead to outputs of any API.
+
+    With ALSA, a transparent route between ports opened with
+    openPort() on both instances is made as a subscription of the
+    output's destination to the input's source.  The sequencer then
+    delivers the messages itself, without the filtering of
+    ignoreTypes(), until the route is removed.
+  */
+  void addRoute( RtMidiOut &output, const RtMidiRoute &route = RtMidiRoute() );
+
+  //! Remove the route to \e output, if any.
+  void removeRoute( RtMidiOut &output );
+
+  //! Add a subscriber polling the messages of the port, and return its number or -1 on error.
+  /*!
+    While subscribers are set, the input is broadcast: each message is
+    written once into the input queue, which every subscriber reads
+    from its own position, without locking and without copying it
+    again, so several threads can consume the same port without
+    opening it more than once.  A polled subscriber starts with the
+    next message received and reads it with poll(); \e overflow sets
+    what it loses when the queue wraps around before it catches up.
+    Messages are not delivered to getMessage() meanwhile, and a
+    subscriber cannot be added while a callback is set, nor a callback
+    set while subscribers are, but routes and the sysex and realtime
+    callbacks keep running ahead of the queue.  At most
+    RTMIDI_MAX_SUBSCRIBERS subscribers can be set, and a warning is
+    reported when none can be added.  Subscribers should be added and
+    removed by one thread at a time, and not while another thread is
+    in getMessage() or getMessages(), since both move the front of the
+    queue.
+  */
+  int subscribe( Overflow overflow = DROP_OLDEST );
+
+  //! Add a subscriber called with each message of the port, and return its number or -1 on error.
+  /*!
+    The function is called by the thread receiving the messages, after
+    the message is queued for the polled subscribers, with the bytes
+    in place in the queue; they are only valid for the duration of the
+    call.  The function must not call unsubscribe(), which waits for
+    it to return.  See subscribe( Overflow ).
+  */
+  int subscribe( RtMidiViewCallback callback, void *userData = 0 );
+
+  //! Remove a subscriber.
+  /*!
+    Once the function returns, the callback of the subscriber is no
+    longer running, and the number may be reused by subscribe(), so
+    the function must not be called from a subscriber's callback.
+    Messages reach getMessage() again when no subscriber is left,
+    after any that a subscriber dropping new messages had not read.
+  */
+  void unsubscribe( int subscriber );
+
+  //! Copy the next message of a polled subscriber into \e message and return its size, or 0 if none is waiting.
+  /*!
+    The function returns immediately.  The delta-time of the message
+    in seconds, from the message before it in the port, is written to
+    \e timeStamp and its absolute time (see getMessageTime()) to \e
+    absoluteTime, when they are not NULL.  A message longer than \e
+    capacity is not consumed and its size is returned, so it can be
+    read again with a larger buffer.  Each subscriber must be polled
+    by one thread at a time.
+  */
+  size_t poll( int subscriber, unsigned char *message, size_t capacity,
+               double *timeStamp = 0, unsigned long long *absoluteTime = 0 );
+
+  //! Return the number of messages a polled subscriber has skipped since it was added.
+  unsigned long long getSubscriberLosses( int subscriber );
+
   //! Set an error callback function to be invoked when an error has occured.
   /*!
     The callback function will be called whenever an error has occured. It is best
@@ -325,7 +748,8 @@ class RtMidiIn : public RtMidi
   virtual void setErrorCallback( RtMidiErrorCallback errorCallback = NULL, void *userData = 0 );
 
  protected:
-  void openMidiApi( RtMidi::Api api, const std::string clientName, unsigned int queueSizeLimit );
+  void openMidiApi( RtMidi::Api api, const std::string clientName, unsigned int queueSizeLimit,
+                    unsigned int sysexQueueSize, MidiContextApi *context = 0 );
 
 };
 
@@ -349,16 +773,42 @@ class RtMidiOut : public RtMidi
 {
  public:
 
-  //! Default constructor that allows an optional client name.
+  //! Default constructor that allows an optional client name and output buffer size.
   /*!
     An exception will be thrown if a MIDI system initialization error occurs.
 
     If no API argument is specified and multiple API support has been
     compiled, the default order of use is ALSA, JACK (Linux) and CORE,
-    JACK (OS-X).
+    JACK (OS-X), and the first API with at least one port is used.
+    The APIs are probed concurrently, without creating any ports, by
+    the first instance created in the process; later instances reuse
+    the result.
+
+    The buffer size is the capacity, in bytes, of the buffer holding
+    messages until the JACK process thread sends them.  Each message
+    takes its length plus a small header.  It is ignored by the other
+    APIs.
   */
   RtMidiOut( RtMidi::Api api=UNSPECIFIED,
-             const std::string clientName = std::string( "RtMidi Output Client") );
+             const std::string clientName = std::string( "RtMidi Output Client"),
+             unsigned int bufferSize = 16384 );
+
+  //! Constructor attaching the new instance to a shared client context.
+  /*!
+    The instance uses the API and the system client of \e context, so
+    its ports are created on that client.  The context may be
+    destroyed before the instances attached to it.  An exception will
+    be thrown if a MIDI system initialization error occurs.
+  */
+  RtMidiOut( RtMidiContext &context, unsigned int bufferSize = 16384 );
+
+  //! User callback function type definition for the completion of asynchronous sysex output.
+  /*!
+    \param message The bytes of the sysex message, valid during the call.
+    \param size The number of bytes.
+    \param userData The pointer passed to setAsyncSysex().
+  */
+  typedef void (*RtMidiSysexSentCallback)( const unsigned char *message, size_t size, void *userData );
 
   //! The destructor closes any open MIDI connections.
   ~RtMidiOut( void ) throw();
@@ -408,6 +858,121 @@ class RtMidiOut : public RtMidi
   */
   void sendMessage( std::vector<unsigned char> *message );
 
+  //! Immediately send a single message of \e size bytes out an open MIDI output port.
+  /*!
+      This is the same as sendMessage( std::vector<unsigned char> * )
+      for bytes held in any buffer, which are not copied into a
+      vector.
+  */
+  void sendMessage( const unsigned char *message, size_t size );
+
+  //! Send a single message out an open MIDI output port unless the output buffer is full.
+  /*!
+      This function never blocks and never drops a message: when the
+      message cannot be accepted right now it returns false and the
+      caller may retry it later.  With sendMessage() a message that
+      does not fit is discarded with a warning instead.  Only the JACK
+      API, and the Windows MM API for sysex messages sent
+      asynchronously (see setAsyncSysex()), buffer output; otherwise
+      this is the same as sendMessage() and always returns true.
+  */
+  bool trySendMessage( std::vector<unsigned char> *message );
+
+  //! Send a single message of \e size bytes out an open MIDI output port unless the output buffer is full.
+  bool trySendMessage( const unsigned char *message, size_t size );
+
+  //! Immediately send a batch of messages out an open MIDI output port.
+  /*!
+      The messages are packed as returned by RtMidiIn::getMessages():
+      the bytes of message \e i are data[offsets[i]] up to
+      data[offsets[i+1]], so \e offsets must hold count + 1 entries.
+      Where the API allows it, the whole batch is handed to the system
+      with a single call.  An exception is thrown if an error occurs
+      during output or an output connection was not previously
+      established.
+  */
+  void sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count );
+
+  //! Send a batch of messages out an open MIDI output port, each scheduled at a given time.
+  /*!
+      The messages are packed as for sendMessages().  Message \e i is
+      delivered timeStamps[i] seconds after the previous message of
+      the batch when \e deltaTime is true (the first message counting
+      from the time of the call), matching the delta-times returned by
+      RtMidiIn, or timeStamps[i] seconds after the time of the call
+      otherwise.  Messages are delivered in the order given.  The
+      scheduling is performed by the system (the sequencer queue with
+      ALSA, packet time stamps with CoreMIDI and frame offsets with
+      JACK).  APIs without scheduling support (Windows MM) issue a
+      warning and send the messages immediately.
+  */
+  void scheduleMessages( const double *timeStamps, const size_t *offsets, const unsigned char *data,
+                         unsigned int count, bool deltaTime = true );
+
+  //! Send sysex messages asynchronously, through a pool of \e bufferCount output buffers (Windows MM only).
+  /*!
+    By default the Windows MM API sends a sysex message and waits
+    until the driver is done with it.  With a non-zero \e bufferCount,
+    sendMessage() copies a sysex message into a free buffer of the
+    pool, queues it and returns at once; the buffer is reused once the
+    driver has sent it.  When all buffers are in use, sendMessage()
+    discards the message with a warning, while trySendMessage()
+    returns false.  An optional callback is invoked from the driver
+    thread as each message has been sent; it must not send MIDI
+    messages itself.  Closing the port cancels the messages not yet
+    sent.  The setting takes effect when the next port is opened and
+    is ignored by the other APIs, which do not wait for sysex output.
+  */
+  void setAsyncSysex( unsigned int bufferCount, RtMidiSysexSentCallback callback = 0, void *userData = 0 );
+
+  //! Reduce the bytes sent on bandwidth-bound links, such as 31.25 kbaud DIN ports (off by default).
+  /*!
+    With \e runningStatus, the status byte of a channel message is
+    left out when it repeats that of the previous channel message
+    sent on the port, across all the send functions; system common
+    and sysex messages cancel running status, while realtime messages
+    keep it.  Only the Windows MM API, whose drivers accept such
+    messages, supports it; the other APIs hand complete messages to
+    the system and ignore it with a warning.
+
+    With a non-zero \e coalesceTime, in seconds, a control change is
+    sent at once unless another one was sent less than \e coalesceTime
+    ago.  In that case it is held until the time is up, replacing any
+    value held for the same controller and channel, so only the latest
+    value of each is sent.  Held controllers are sent in the order they
+    were first held:
+    - when the time is up, by a thread of the instance;
+    - before any other message that is not a realtime one, so that
+      messages stay in order;
+    - by flushOutput() and closePort().
+
+    Scheduled batches (scheduleMessages()) are sent unchanged.  Calling
+    the function again changes the settings, after flushing the
+    controllers held.  Turning both off stops the thread, and messages
+    are then sent directly again, as if the function had never been
+    called.
+  */
+  void setOutputCompression( bool runningStatus, double coalesceTime = 0.0 );
+
+  //! Send the control changes held by setOutputCompression() now, and cancel running status.
+  void flushOutput( void );
+
+  //! Return the runtime statistics of the instance.
+  /*!
+    The messages and bytes are those passed to the send functions.
+    Drops count the messages among them that were discarded because
+    an output buffer was full, which may be noted after a delay.
+  */
+  RtMidiStats getStats( void );
+
+  //! Set a function to be called with the statistics at most every \e interval seconds.
+  /*!
+    The function is called by the thread sending the messages, from a
+    send function, at least \e interval seconds after the previous
+    call.  A NULL function cancels the calls.
+  */
+  void setStatsCallback( RtMidiStatsCallback callback, void *userData = 0, double interval = 1.0 );
+
   //! Set an error callback function to be invoked when an error has occured.
   /*!
     The callback function will be called whenever an error has occured. It is best
@@ -416,7 +981,55 @@ class RtMidiOut : public RtMidi
   virtual void setErrorCallback( RtMidiErrorCallback errorCallback = NULL, void *userData = 0 );
 
  protected:
-  void openMidiApi( RtMidi::Api api, const std::string clientName );
+  friend class RtMidiIn;
+
+  void openMidiApi( RtMidi::Api api, const std::string clientName, unsigned int bufferSize,
+                    MidiContextApi *context = 0 );
+};
+
+/**********************************************************************/
+/*! \class RtMidiContext
+    \brief A system MIDI client shared by several RtMidiIn and RtMidiOut instances.
+
+    By default each RtMidiIn and RtMidiOut instance opens its own
+    client of the MIDI system (and, with ALSA, its own input thread
+    and queue).  Instances constructed from an RtMidiContext instead
+    create their ports on the single client of the context: one ALSA
+    sequencer client read by one thread, one JACK client or one
+    CoreMIDI client.  The APIs without such clients (Windows MM and
+    the dummy API) accept a context but do not share anything.
+*/
+/**********************************************************************/
+
+class RtMidiContext
+{
+ public:
+
+  //! Default constructor that allows an optional api and client name.
+  /*!
+    The API is selected as for RtMidiIn.  An exception will be thrown
+    if the client cannot be opened.
+  */
+  RtMidiContext( RtMidi::Api api=RtMidi::UNSPECIFIED,
+                 const std::string clientName = std::string( "RtMidi Client" ) );
+
+  //! The client is closed once the context and the instances attached to it are destroyed.
+  ~RtMidiContext( void ) throw();
+
+  //! Returns the MIDI API specifier of the context.
+  RtMidi::Api getCurrentApi( void ) throw() { return api_; }
+
+ protected:
+  friend class RtMidiIn;
+  friend class RtMidiOut;
+
+  RtMidi::Api api_;
+  std::string clientName_;
+  MidiContextApi *rtapi_;
+
+ private:
+  RtMidiContext( const RtMidiContext & );
+  RtMidiContext &operator=( const RtMidiContext & );
 };
 
 
@@ -453,10 +1066,49 @@ class MidiApi
   //! A basic error reporting function for RtMidi classes.
   void error( RtMidiError::Type type, std::string errorString );
 
+  // The statistics counters of an input or output, see RtMidiStats.
+  // Each counter has a single writer, which updates it with a relaxed
+  // load and store rather than a locked instruction; any thread may
+  // read it.  Where two threads count the same messages, both use the
+  // shared functions instead, and the callback is called by one of
+  // them at a time with report().
+  struct MidiStats {
+    std::atomic<unsigned long long> messages;
+    std::atomic<unsigned long long> bytes;
+    std::atomic<unsigned long long> drops;
+    std::atomic<unsigned long long> overruns;
+    std::atomic<unsigned long long> sysexReassemblies;
+    std::atomic<unsigned int> queueHighWater;
+    std::atomic<unsigned long long> callbackTime[RtMidiStats::HISTOGRAM_SIZE];
+    std::atomic<unsigned long long> interArrival[RtMidiStats::HISTOGRAM_SIZE];
+    std::atomic<unsigned long long> lastTime;     // of the last message counted
+    RtMidiStatsCallback callback;
+    void *userData;
+    unsigned long long interval;     // between calls of the callback, in nanoseconds
+    std::atomic<unsigned long long> nextReport;
+
+    MidiStats( void );
+    static void add( std::atomic<unsigned long long> &counter, unsigned long long n = 1 )
+    { counter.store( counter.load( std::memory_order_relaxed ) + n, std::memory_order_relaxed ); }
+    static void addShared( std::atomic<unsigned long long> &counter, unsigned long long n = 1 )
+    { counter.fetch_add( n, std::memory_order_relaxed ); }
+    static unsigned int bin( unsigned long long nanoseconds );
+    void countMessage( size_t nBytes, unsigned long long time );
+    void countShared( size_t nBytes, unsigned long long time );
+    void countCallback( unsigned long long start );
+    void countCallbackShared( unsigned long long start );
+    bool due( unsigned long long time ) const
+    { return callback && time >= nextReport.load( std::memory_order_relaxed ); }
+    void report( unsigned long long time );
+    void get( RtMidiStats *stats ) const;
+    void setCallback( RtMidiStatsCallback callback, void *userData, double interval );
+  };
+
 protected:
   virtual void initialize( const std::string& clientName ) = 0;
 
   void *apiData_;
+  MidiContextApi *context_;
   bool connected_;
   std::string errorString_;
   RtMidiErrorCallback errorCallback_;
@@ -468,34 +1120,225 @@ class MidiInApi : public MidiApi
 {
  public:
 
-  MidiInApi( unsigned int queueSizeLimit );
+  MidiInApi( unsigned int queueSizeLimit, unsigned int sysexQueueSize );
   virtual ~MidiInApi( void );
   void setCallback( RtMidiIn::RtMidiCallback callback, void *userData );
+  void setTimedCallback( RtMidiIn::RtMidiTimedCallback callback, void *userData );
+  void setViewCallback( RtMidiIn::RtMidiViewCallback callback, void *userData );
   void cancelCallback( void );
+  virtual void setRealtimeCallback( RtMidiIn::RtMidiRealtimeCallback callback, void *userData );
+  void setSysexCallback( RtMidiIn::RtMidiSysexCallback callback, void *userData );
   virtual void ignoreTypes( bool midiSysex, bool midiTime, bool midiSense );
+  void setMessageFilter( const unsigned char *filter, unsigned short channels );
   double getMessage( std::vector<unsigned char> *message );
+  unsigned int getMessages( double *timeStamps, size_t *offsets, unsigned char *data, size_t dataSize, unsigned int maxCount );
+  unsigned long long getMessageTime( unsigned int *frameTime );
+  RtMidiIn::RtMidiWaitHandle getWaitHandle( void );
+  bool waitForMessage( double timeout );
+  void setBufferSize( unsigned int size, unsigned int count );
+  virtual unsigned int getSysexBufferUnderruns( void );
+  RtMidiStats getStats( void );
+  void setStatsCallback( RtMidiStatsCallback callback, void *userData, double interval );
+  void setThreadOptions( const RtMidiThreadOptions &options );
+  virtual void applyThreadOptions( void );
+  void addRoute( MidiOutApi *output, const RtMidiRoute &route );
+  void removeRoute( MidiOutApi *output );
+  void removeRoutes( void );
+  int subscribe( RtMidiIn::RtMidiViewCallback callback, void *userData, RtMidiIn::Overflow overflow );
+  void unsubscribe( int subscriber );
+  size_t poll( int subscriber, unsigned char *message, size_t capacity,
+               double *timeStamp, unsigned long long *absoluteTime );
+  unsigned long long getSubscriberLosses( int subscriber );
+
+  // A route of the input to an output.  Those made natively by the
+  // API have a handle, and are skipped by the input thread.
+  struct MidiRoute {
+    MidiOutApi *output;
+    RtMidiRoute route;
+    void *handle;
+  };
 
   // A MIDI structure used internally by the class to store incoming
   // messages.  Each message represents one and only one MIDI message.
   struct MidiMessage { 
     std::vector<unsigned char> bytes; 
     double timeStamp;
+    unsigned long long absoluteTime; // in nanoseconds, zero if unknown
+    unsigned int frameTime;          // JACK only
 
     // Default constructor.
   MidiMessage()
-  :bytes(0), timeStamp(0.0) {}
+  :bytes(0), timeStamp(0.0), absoluteTime(0), frameTime(0) {}
   };
 
-  struct MidiQueue {
-    unsigned int front;
-    unsigned int back;
+  // A fixed-size slot of the input queue.  Messages of up to three
+  // bytes are stored inline; the bytes of longer (sysex) messages are
+  // stored in the queue's sysex arena, starting at the given offset.
+  struct MidiQueueSlot {
+    double timeStamp;
+    unsigned long long absoluteTime;
+    unsigned int frameTime;
     unsigned int size;
-    unsigned int ringSize;
-    MidiMessage *ring;
+    union {
+      unsigned char bytes[4];
+      unsigned int offset;
+    };
+    unsigned int arenaStart;  // the arena head before the message was queued
+  };
+
+  // A subscriber of a broadcast input, with the position of the next
+  // message it reads in the queue.  The position of a callback is not
+  // used, as the producer calls it with each message.
+  struct MidiSubscriber {
+    RtMidiIn::RtMidiViewCallback callback;
+    void *userData;
+    std::atomic<unsigned long long> lost;      // written only by the subscriber
+    std::atomic<unsigned int> position;        // written only by the subscriber
+    char pad[RTMIDI_CACHE_LINE_SIZE - sizeof(RtMidiIn::RtMidiViewCallback) - sizeof(void *)
+             - sizeof(std::atomic<unsigned long long>) - sizeof(std::atomic<unsigned int>)];
+  };
+
+  // The state of the queue while its messages are broadcast to
+  // subscribers.  The masks have bit i set for subscriber i.  Before
+  // writing over a slot or the arena, the producer claims the index or
+  // arena position it writes up to, so a subscriber that is not
+  // holding the queue back can tell, after copying a message, whether
+  // it was overwritten meanwhile.
+  struct MidiBroadcast {
+    std::atomic<unsigned int> slotClaim;       // written only by the producer
+    std::atomic<unsigned int> arenaClaim;      // written only by the producer
+    std::atomic<unsigned int> active;          // the subscribers that are set
+    std::atomic<unsigned int> holding;         // the polled subscribers dropping new messages
+    std::atomic<unsigned int> callbacks;       // the subscribers with a callback
+    std::atomic<unsigned int> entered;         // written only by the producer, see unsubscribe()
+    std::atomic<unsigned int> left;
+    char pad[RTMIDI_CACHE_LINE_SIZE - 7 * sizeof(std::atomic<unsigned int>)];
+    MidiSubscriber subscribers[RTMIDI_MAX_SUBSCRIBERS];
+
+    // Default constructor.
+  MidiBroadcast()
+  :slotClaim(0), arenaClaim(0), active(0), holding(0), callbacks(0), entered(0), left(0) {}
+  };
+
+  // A wait-free, single-producer/single-consumer ring of MIDI
+  // messages.  The API input thread (or callback) is the only
+  // producer and the thread calling getMessage() the only consumer.
+  // The front and back indices run freely and are masked into the
+  // ring, which is rounded up to a power of two.  Each index lives on
+  // its own cache line so the two threads don't contend for it.
+  //
+  // Sysex bytes are written to a byte arena that is consumed in the
+  // same order as the ring, so it is managed as a second ring: the
+  // producer allocates contiguous blocks at arenaHead (skipping to the
+  // start of the arena when a block would not fit before the end) and
+  // the consumer releases them by advancing arenaTail.  Neither the
+  // ring nor the arena is ever reallocated while input is running.
+  //
+  // A sysex message received in chunks can be assembled in place: the
+  // producer appends each chunk to a pending block at arenaHead, which
+  // pushPending() then publishes without copying it.  No other message
+  // longer than three bytes may be pushed while one is pending.
+  //
+  // While subscribers are set, the queue is broadcast: the producer
+  // moves front and arenaTail itself, to the oldest message unread by
+  // a subscriber that holds the queue back, and the other subscribers
+  // may be overwritten; see holdFront().
+  struct MidiQueue {
+    char pad0[RTMIDI_CACHE_LINE_SIZE];
+    std::atomic<unsigned int> front;      // written only by the consumer
+    std::atomic<unsigned int> arenaTail;  // written only by the consumer
+    char pad1[RTMIDI_CACHE_LINE_SIZE - 2 * sizeof(std::atomic<unsigned int>)];
+    std::atomic<unsigned int> back;       // written only by the producer
+    unsigned int arenaHead;               // used only by the producer
+    unsigned int pendingStart;            // used only by the producer
+    unsigned int pendingSize;             // used only by the producer
+    unsigned int pendingValid;            // used only by the producer
+    char pad2[RTMIDI_CACHE_LINE_SIZE - sizeof(std::atomic<unsigned int>) - 4 * sizeof(unsigned int)];
+    unsigned int ringSize;                // the queue size limit
+    unsigned int ringMask;
+    MidiQueueSlot *ring;
+    unsigned int arenaSize;
+    unsigned int arenaMask;
+    unsigned char *arena;
+    MidiStats *stats;                         // counts the drops and the high-water mark
+    bool locked;                              // the storage is locked in memory
+    std::atomic<bool> waitable;               // the wait handle is open
+    RtMidiIn::RtMidiWaitHandle waitHandle;    // signalled while messages are queued
+    int waitSignal;                           // the file descriptor written to signal it (POSIX)
+    std::atomic<MidiBroadcast *> broadcast;   // created by the first subscriber
 
     // Default constructor.
   MidiQueue()
-  :front(0), back(0), size(0), ringSize(0) {}
+  :front(0), arenaTail(0), back(0), arenaHead(0), pendingStart(0), pendingSize(0), pendingValid(0),
+      ringSize(0), ringMask(0), ring(0), arenaSize(0), arenaMask(0), arena(0), stats(0),
+      locked(false), waitable(false), waitHandle(0), waitSignal(-1), broadcast(0) {}
+
+    ~MidiQueue( void );
+    void allocate( unsigned int queueSizeLimit, unsigned int sysexQueueSize );
+    bool push( const unsigned char *bytes, unsigned int size, double timeStamp,
+               unsigned long long absoluteTime = 0, unsigned int frameTime = 0 );
+    bool push( const MidiMessage& message )
+    { return push( message.bytes.data(), (unsigned int) message.bytes.size(), message.timeStamp,
+                   message.absoluteTime, message.frameTime ); }
+    void beginPending( void );
+    bool appendPending( const unsigned char *bytes, unsigned int size );
+    bool pushPending( double timeStamp, unsigned long long absoluteTime = 0, unsigned int frameTime = 0 );
+    const unsigned char *pending( void ) const  // the bytes of the pending message, if still valid
+    { return pendingValid ? arena + ( pendingStart & arenaMask ) : 0; }
+    bool pop( std::vector<unsigned char> *message, double *timeStamp,
+              unsigned long long *absoluteTime, unsigned int *frameTime );
+    unsigned int pop( double *timeStamps, size_t *offsets, unsigned char *data, size_t dataSize, unsigned int maxCount );
+    unsigned int size( void ) const;
+    bool drop( void );
+    void countSize( unsigned int size );
+    int lock( void );
+    bool openWaitHandle( void );
+    void signalPush( unsigned int _back );
+    void signalPop( unsigned int _front );
+    MidiBroadcast *subscribers( void ) const  // the broadcast state, if subscribers are set
+    { MidiBroadcast *b = broadcast.load( std::memory_order_acquire );
+      return b && b->active.load( std::memory_order_acquire ) ? b : 0; }
+    unsigned int holdFront( MidiBroadcast *b, unsigned int _back );
+    void dispatch( MidiBroadcast *b, const MidiQueueSlot &slot );
+    size_t poll( MidiSubscriber &subscriber, unsigned char *message, size_t capacity,
+                 double *timeStamp, unsigned long long *absoluteTime );
+  };
+
+  // The next message found by MidiParser::parse(): a whole message of
+  // up to three bytes, or a fragment of a sysex message.
+  struct MidiParsed {
+    const unsigned char *bytes;
+    unsigned int size;
+    bool sysex;
+    bool first;  // the sysex fragment starts the message
+    bool last;   // the sysex fragment ends it
+  };
+
+  // An incremental parser of a raw MIDI byte stream, shared by the
+  // APIs that receive bytes rather than events.  It follows running
+  // status, returns the realtime bytes met inside a sysex message on
+  // their own, and finds the messages of a buffer one after another;
+  // a message may also continue in the next buffer.  The length of a
+  // message is looked up by its status byte.  Short messages are
+  // assembled in the parser and sysex fragments point into the input,
+  // so nothing is copied or allocated.  A status byte other than a
+  // realtime one ends an unterminated sysex message, whose last
+  // fragment may then be empty.
+  struct MidiParser {
+    static const unsigned char lengths[256]; // by status byte; 0 for data bytes, 0xF0 and 0xF7
+    unsigned char message[3];                // the short message being assembled
+    unsigned char count;                     // bytes of it received
+    unsigned char size;                      // and expected
+    unsigned char runningStatus;             // 0 if none
+    bool inSysex;
+    bool firstFragment;                      // the next sysex fragment starts the message
+
+    // Default constructor.
+  MidiParser()
+  :count(0), size(0), runningStatus(0), inSysex(false), firstFragment(false) {}
+
+    void reset( void ) { count = 0; runningStatus = 0; inSysex = false; }
+    bool parse( const unsigned char *bytes, unsigned int nBytes, unsigned int *offset, MidiParsed *parsed );
   };
 
   // The RtMidiInData structure is used to pass private class data to
@@ -503,23 +1346,80 @@ class MidiInApi : public MidiApi
   struct RtMidiInData {
     MidiQueue queue;
     MidiMessage message;
-    unsigned char ignoreFlags;
+    unsigned char filter[256]; // nonzero for the status bytes that pass, see setMessageFilter()
     bool doInput;
     bool firstMessage;
     void *apiData;
-    bool usingCallback;
-    RtMidiIn::RtMidiCallback userCallback;
-    void *userData;
+    std::atomic<bool> usingCallback;
+    std::atomic<RtMidiIn::RtMidiCallback> userCallback;
+    std::atomic<void *> userData;
     bool continueSysex;
+    unsigned long long lastAbsoluteTime; // of the last message popped by getMessage()
+    unsigned int lastFrameTime;
+    std::atomic<RtMidiIn::RtMidiRealtimeCallback> realtimeCallback; // set along with usingCallback
+    std::atomic<RtMidiIn::RtMidiSysexCallback> sysexCallback; // stored after sysexUserData
+    std::atomic<void *> sysexUserData;
+    RtMidiIn::RtMidiTimedCallback timedCallback; // called through userCallback
+    void *timedUserData;
+    RtMidiIn::RtMidiViewCallback viewCallback;   // called through userCallback
+    void *viewUserData;
+    unsigned int bufferSize;  // of the sysex input buffers (Windows MM)
+    unsigned int bufferCount;
+    MidiStats stats;
+    RtMidiThreadOptions threadOptions;
+    std::atomic<std::vector<MidiRoute> *> routes; // replaced rather than modified, see updateRoutes()
+    std::atomic<unsigned int> routesEntered;      // written only by the input thread
+    std::atomic<unsigned int> routesLeft;
+    std::atomic<unsigned int> callbackEntered;    // written only by the input thread, see cancelCallback()
+    std::atomic<unsigned int> callbackLeft;
+    std::atomic<unsigned int> realtimeEntered;    // written only by the realtime thread (JACK)
+    std::atomic<unsigned int> realtimeLeft;
+    MidiParser parser;                   // of the APIs that call receive()
+    std::vector<unsigned char> sysex;    // the sysex message being assembled by receive()
+    double sysexTimeStamp;               // of its first fragment
+    unsigned long long sysexTime;
+    bool sysexSkipped;                   // filtered out when it started
+    bool sysexStreamed;                  // passed to the sysex callback
 
     // Default constructor.
   RtMidiInData()
-  : ignoreFlags(7), doInput(false), firstMessage(true),
+  : doInput(false), firstMessage(true),
       apiData(0), usingCallback(false), userCallback(0), userData(0),
-      continueSysex(false) {}
+      continueSysex(false), lastAbsoluteTime(0), lastFrameTime(0), realtimeCallback(0),
+      sysexCallback(0), sysexUserData(0), timedCallback(0), timedUserData(0),
+      viewCallback(0), viewUserData(0),
+      bufferSize(1024), bufferCount(4), routes(0), routesEntered(0), routesLeft(0),
+      callbackEntered(0), callbackLeft(0), realtimeEntered(0), realtimeLeft(0),
+      sysexTimeStamp(0.0), sysexTime(0), sysexSkipped(false), sysexStreamed(false) { queue.stats = &stats; }
+
+    // Called by the input thread around its use of the callback, and
+    // by the realtime thread around that of the realtime callback, so
+    // that cancelCallback() can wait for a call in progress.
+    void enterCallback( void )
+    { callbackEntered.store( callbackEntered.load( std::memory_order_relaxed ) + 1 ); }
+    void leaveCallback( void )
+    { callbackLeft.store( callbackEntered.load( std::memory_order_relaxed ) ); }
+    void enterRealtime( void )
+    { realtimeEntered.store( realtimeEntered.load( std::memory_order_relaxed ) + 1 ); }
+    void leaveRealtime( void )
+    { realtimeLeft.store( realtimeEntered.load( std::memory_order_relaxed ) ); }
+
+    // Called by the input thread with each complete message delivered.
+    void route( const unsigned char *bytes, size_t size )
+    { if ( routes.load( std::memory_order_relaxed ) ) forward( bytes, size ); }
+    void forward( const unsigned char *bytes, size_t size );
+
+    // Called by the input thread with raw bytes received at once.
+    void receive( const unsigned char *bytes, unsigned int size, double timeStamp, unsigned long long time );
+    void deliver( std::vector<unsigned char> *bytes, double timeStamp, unsigned long long time );
   };
 
  protected:
+  void scheduleThread( void *thread );  // a pthread_t *, on POSIX systems
+  virtual void *connectRoute( MidiOutApi *output );  // returns the handle of a native route, or 0
+  virtual void disconnectRoute( void *handle );
+  void updateRoutes( std::vector<MidiRoute> *routes );
+
   RtMidiInData inputData_;
 };
 
@@ -529,7 +1429,86 @@ class MidiOutApi : public MidiApi
 
   MidiOutApi( void );
   virtual ~MidiOutApi( void );
-  virtual void sendMessage( std::vector<unsigned char> *message ) = 0;
+  virtual void sendMessage( const unsigned char *message, size_t size ) = 0;
+  virtual bool trySendMessage( const unsigned char *message, size_t size );
+  void sendMessage( std::vector<unsigned char> *message )
+  { sendMessage( message->empty() ? 0 : &(*message)[0], message->size() ); }
+  bool trySendMessage( std::vector<unsigned char> *message )
+  { return trySendMessage( message->empty() ? 0 : &(*message)[0], message->size() ); }
+  virtual void sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count,
+                             const double *timeStamps, bool deltaTime );
+  void setAsyncSysex( unsigned int bufferCount, RtMidiOut::RtMidiSysexSentCallback callback, void *userData );
+  RtMidiStats getStats( void );
+  void setStatsCallback( RtMidiStatsCallback callback, void *userData, double interval );
+  void setOutputCompression( bool runningStatus, double coalesceTime );
+  void flushOutput( void );
+
+  // The entries of the send functions of RtMidiOut, which count the
+  // messages sent and go through the output compression once it is
+  // set.  While inputs are routed to the output, they are serialized
+  // with the routes by the send mutex, see attachRoute().
+  void send( const unsigned char *message, size_t size );
+  bool trySend( const unsigned char *message, size_t size );
+  void send( const size_t *offsets, const unsigned char *data, unsigned int count,
+             const double *timeStamps, bool deltaTime );
+
+  // The entry of the input routes, called by the input threads.
+  void sendRouted( const unsigned char *message, size_t size );
+  void attachRoute( void );
+  void detachRoute( void );
+
+ protected:
+  struct MidiEncoder;
+  virtual bool allowsRunningStatus( void ) const { return false; } // the driver takes messages without a status byte
+  bool encode( const unsigned char *message, size_t size, bool tryOnly );
+  bool encodeLocked( const unsigned char *message, size_t size, bool tryOnly );
+  void flushHeld( void );
+  void runFlushThread( void );
+  bool enterSend( void );
+  void leaveSend( void ) { sendsLeft_.fetch_add( 1 ); }
+  bool sendDirect( const unsigned char *message, size_t size, bool tryOnly );
+  void sendDirect( const size_t *offsets, const unsigned char *data, unsigned int count,
+                   const double *timeStamps, bool deltaTime );
+  void countSent( size_t nBytes, unsigned long long time );
+
+  MidiStats stats_;
+  unsigned int asyncSysexCount_;
+  RtMidiOut::RtMidiSysexSentCallback sysexSentCallback_;
+  void *sysexSentUserData_;
+  std::atomic<MidiEncoder *> encoder_; // created with the first setOutputCompression() and kept
+  std::atomic<bool> compressing_;      // the sends go through encoder_, see setOutputCompression()
+  std::mutex sendMutex_;               // taken by the sends while routes are attached
+  std::atomic<unsigned int> routeCount_;   // the routes of the inputs forwarded by their threads
+  std::atomic<unsigned int> sendsEntered_; // the sends started without the mutex, see attachRoute()
+  std::atomic<unsigned int> sendsLeft_;
+};
+
+// **************************************************************** //
+//
+// MidiContextApi class declaration.
+//
+// A MidiContextApi subclass holds the API-specific client of an
+// RtMidiContext.  It is reference counted: the context and every
+// MidiInApi or MidiOutApi attached to it hold a reference, and the
+// client is closed when the last one is released.
+//
+// **************************************************************** //
+
+class MidiContextApi
+{
+ public:
+
+  MidiContextApi( void ) : apiData_( 0 ), refCount_( 1 ) {}
+  virtual ~MidiContextApi( void ) {}
+  virtual RtMidi::Api getCurrentApi( void ) = 0;
+
+  void *getApiData( void ) { return apiData_; }
+  void retain( void ) { ++refCount_; }
+  void release( void ) { if ( --refCount_ == 0 ) delete this; }
+
+ protected:
+  void *apiData_;
+  std::atomic<unsigned int> refCount_;
 };
 
 // **************************************************************** //
@@ -544,21 +1523,52 @@ inline void RtMidiIn :: openVirtualPort( const std::string portName ) { rtapi_->
 inline void RtMidiIn :: closePort( void ) { rtapi_->closePort(); }
 inline bool RtMidiIn :: isPortOpen() const { return rtapi_->isPortOpen(); }
 inline void RtMidiIn :: setCallback( RtMidiCallback callback, void *userData ) { ((MidiInApi *)rtapi_)->setCallback( callback, userData ); }
+inline void RtMidiIn :: setTimedCallback( RtMidiTimedCallback callback, void *userData ) { ((MidiInApi *)rtapi_)->setTimedCallback( callback, userData ); }
+inline void RtMidiIn :: setViewCallback( RtMidiViewCallback callback, void *userData ) { ((MidiInApi *)rtapi_)->setViewCallback( callback, userData ); }
 inline void RtMidiIn :: cancelCallback( void ) { ((MidiInApi *)rtapi_)->cancelCallback(); }
+inline void RtMidiIn :: setRealtimeCallback( RtMidiRealtimeCallback callback, void *userData ) { ((MidiInApi *)rtapi_)->setRealtimeCallback( callback, userData ); }
+inline void RtMidiIn :: setSysexCallback( RtMidiSysexCallback callback, void *userData ) { ((MidiInApi *)rtapi_)->setSysexCallback( callback, userData ); }
 inline unsigned int RtMidiIn :: getPortCount( void ) { return rtapi_->getPortCount(); }
 inline std::string RtMidiIn :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
 inline void RtMidiIn :: ignoreTypes( bool midiSysex, bool midiTime, bool midiSense ) { ((MidiInApi *)rtapi_)->ignoreTypes( midiSysex, midiTime, midiSense ); }
+inline void RtMidiIn :: setMessageFilter( const unsigned char *filter, unsigned short channels ) { ((MidiInApi *)rtapi_)->setMessageFilter( filter, channels ); }
 inline double RtMidiIn :: getMessage( std::vector<unsigned char> *message ) { return ((MidiInApi *)rtapi_)->getMessage( message ); }
+inline unsigned int RtMidiIn :: getMessages( double *timeStamps, size_t *offsets, unsigned char *data, size_t dataSize, unsigned int maxCount ) { return ((MidiInApi *)rtapi_)->getMessages( timeStamps, offsets, data, dataSize, maxCount ); }
+inline unsigned long long RtMidiIn :: getMessageTime( unsigned int *frameTime ) { return ((MidiInApi *)rtapi_)->getMessageTime( frameTime ); }
+inline RtMidiIn::RtMidiWaitHandle RtMidiIn :: getWaitHandle( void ) { return ((MidiInApi *)rtapi_)->getWaitHandle(); }
+inline bool RtMidiIn :: waitForMessage( double timeout ) { return ((MidiInApi *)rtapi_)->waitForMessage( timeout ); }
+inline void RtMidiIn :: setBufferSize( unsigned int size, unsigned int count ) { ((MidiInApi *)rtapi_)->setBufferSize( size, count ); }
+inline unsigned int RtMidiIn :: getSysexBufferUnderruns( void ) { return ((MidiInApi *)rtapi_)->getSysexBufferUnderruns(); }
+inline void RtMidiIn :: setThreadOptions( const RtMidiThreadOptions &options ) { ((MidiInApi *)rtapi_)->setThreadOptions( options ); }
+inline RtMidiStats RtMidiIn :: getStats( void ) { return ((MidiInApi *)rtapi_)->getStats(); }
+inline void RtMidiIn :: setStatsCallback( RtMidiStatsCallback callback, void *userData, double interval ) { ((MidiInApi *)rtapi_)->setStatsCallback( callback, userData, interval ); }
+inline void RtMidiIn :: addRoute( RtMidiOut &output, const RtMidiRoute &route ) { ((MidiInApi *)rtapi_)->addRoute( (MidiOutApi *)output.rtapi_, route ); }
+inline void RtMidiIn :: removeRoute( RtMidiOut &output ) { ((MidiInApi *)rtapi_)->removeRoute( (MidiOutApi *)output.rtapi_ ); }
+inline int RtMidiIn :: subscribe( Overflow overflow ) { return ((MidiInApi *)rtapi_)->subscribe( 0, 0, overflow ); }
+inline int RtMidiIn :: subscribe( RtMidiViewCallback callback, void *userData ) { return ((MidiInApi *)rtapi_)->subscribe( callback, userData, DROP_OLDEST ); }
+inline void RtMidiIn :: unsubscribe( int subscriber ) { ((MidiInApi *)rtapi_)->unsubscribe( subscriber ); }
+inline size_t RtMidiIn :: poll( int subscriber, unsigned char *message, size_t capacity, double *timeStamp, unsigned long long *absoluteTime ) { return ((MidiInApi *)rtapi_)->poll( subscriber, message, capacity, timeStamp, absoluteTime ); }
+inline unsigned long long RtMidiIn :: getSubscriberLosses( int subscriber ) { return ((MidiInApi *)rtapi_)->getSubscriberLosses( subscriber ); }
 inline void RtMidiIn :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 inline RtMidi::Api RtMidiOut :: getCurrentApi( void ) throw() { return rtapi_->getCurrentApi(); }
 inline void RtMidiOut :: openPort( unsigned int portNumber, const std::string portName ) { rtapi_->openPort( portNumber, portName ); }
 inline void RtMidiOut :: openVirtualPort( const std::string portName ) { rtapi_->openVirtualPort( portName ); }
-inline void RtMidiOut :: closePort( void ) { rtapi_->closePort(); }
+inline void RtMidiOut :: closePort( void ) { ((MidiOutApi *)rtapi_)->flushOutput(); rtapi_->closePort(); }
 inline bool RtMidiOut :: isPortOpen() const { return rtapi_->isPortOpen(); }
 inline unsigned int RtMidiOut :: getPortCount( void ) { return rtapi_->getPortCount(); }
 inline std::string RtMidiOut :: getPortName( unsigned int portNumber ) { return rtapi_->getPortName( portNumber ); }
-inline void RtMidiOut :: sendMessage( std::vector<unsigned char> *message ) { ((MidiOutApi *)rtapi_)->sendMessage( message ); }
+inline void RtMidiOut :: sendMessage( std::vector<unsigned char> *message ) { sendMessage( message->empty() ? 0 : &(*message)[0], message->size() ); }
+inline bool RtMidiOut :: trySendMessage( std::vector<unsigned char> *message ) { return trySendMessage( message->empty() ? 0 : &(*message)[0], message->size() ); }
+inline void RtMidiOut :: sendMessage( const unsigned char *message, size_t size ) { ((MidiOutApi *)rtapi_)->send( message, size ); }
+inline bool RtMidiOut :: trySendMessage( const unsigned char *message, size_t size ) { return ((MidiOutApi *)rtapi_)->trySend( message, size ); }
+inline void RtMidiOut :: sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count ) { scheduleMessages( 0, offsets, data, count, false ); }
+inline void RtMidiOut :: scheduleMessages( const double *timeStamps, const size_t *offsets, const unsigned char *data, unsigned int count, bool deltaTime ) { ((MidiOutApi *)rtapi_)->send( offsets, data, count, timeStamps, deltaTime ); }
+inline void RtMidiOut :: setAsyncSysex( unsigned int bufferCount, RtMidiSysexSentCallback callback, void *userData ) { ((MidiOutApi *)rtapi_)->setAsyncSysex( bufferCount, callback, userData ); }
+inline void RtMidiOut :: setOutputCompression( bool runningStatus, double coalesceTime ) { ((MidiOutApi *)rtapi_)->setOutputCompression( runningStatus, coalesceTime ); }
+inline void RtMidiOut :: flushOutput( void ) { ((MidiOutApi *)rtapi_)->flushOutput(); }
+inline RtMidiStats RtMidiOut :: getStats( void ) { return ((MidiOutApi *)rtapi_)->getStats(); }
+inline void RtMidiOut :: setStatsCallback( RtMidiStatsCallback callback, void *userData, double interval ) { ((MidiOutApi *)rtapi_)->setStatsCallback( callback, userData, interval ); }
 inline void RtMidiOut :: setErrorCallback( RtMidiErrorCallback errorCallback, void *userData ) { rtapi_->setErrorCallback(errorCallback, userData); }
 
 #endif
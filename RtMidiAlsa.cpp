@@ -39,6 +39,8 @@
 #include "RtMidi.h"
 #include "RtMidiAlsa.h"
 
+#include <algorithm>
+#include <map>
 #include <sstream>
 
 //*********************************************************************//
@@ -66,6 +68,15 @@
 // ALSA header file.
 #include <alsa/asoundlib.h>
 
+// An entry of the port registry.
+struct AlsaPortEntry {
+  std::string name;
+  snd_seq_addr_t addr;
+  unsigned int caps;
+};
+
+struct AlsaContextData;
+
 // A structure to hold variables related to the ALSA API
 // implementation.
 struct AlsaMidiData {
@@ -76,62 +87,253 @@ struct AlsaMidiData {
   snd_midi_event_t *coder;
   unsigned int bufferSize;
   unsigned char *buffer;
+  std::vector<unsigned char> sysex; // input only, assembled for a callback
+  bool queueSysex; // input only, the sysex being received goes to the queue
   pthread_t thread;
   pthread_t dummy_thread_id;
   unsigned long long lastTime;
   int queue_id; // an input queue is needed to get timestamped events
+  unsigned long long queueBase; // process time of queue time zero, 0 until measured
   int trigger_fds[2];
+  int announcePort; // a private port subscribed to System:Announce
+  std::vector<AlsaPortEntry> ports; // see alsaUpdatePorts()
+  std::atomic<bool> portsValid;
+  AlsaContextData *context; // the RtMidiContext client in use, if any
+};
+
+// The sequencer client of an RtMidiContext, shared by the MidiInAlsa
+// and MidiOutAlsa instances attached to it.  A single thread reads the
+// input of all their ports and passes each event to the input owning
+// its destination port.
+struct AlsaContextData {
+  snd_seq_t *seq;
+  int queue_id; // started once, time stamps the input of every port
+  int announcePort;
+  pthread_t thread;
+  bool doInput;
+  int trigger_fds[2];
+  pthread_mutex_t outputMutex; // serializes output on the shared client
+  pthread_mutex_t mutex; // protects the members below
+  std::map<int, MidiInApi::RtMidiInData *> inputs; // by destination port
+  std::vector<AlsaMidiData *> clients; // every attached instance
+  MidiInApi::RtMidiInData *processing; // the input whose event the thread is processing, if any
+  pthread_cond_t processed;            // signalled when it is done
 };
 
 #define PORT_TYPE( pinfo, bits ) ((snd_seq_port_info_get_capability(pinfo) & (bits)) == (bits))
 
 //*********************************************************************//
 //  API: LINUX ALSA
-//  Class Definitions: MidiInAlsa
+//  Port registry
 //*********************************************************************//
 
-static void *alsaMidiHandler( void *ptr )
+// Each client keeps a registry of the sequencer ports it can connect
+// to, so that listing and opening ports doesn't walk every client and
+// port in the system each time.  The registry is rebuilt only after
+// the System:Announce port, to which a private port of the client is
+// subscribed, reports that a client or port appeared, disappeared or
+// changed.
+
+// Create the private port and subscribe it to System:Announce.
+// Returns -1 on failure, in which case the registry is simply rebuilt
+// on every query.
+static int alsaOpenAnnouncePort( snd_seq_t *seq )
 {
-  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (ptr);
-  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  int port = snd_seq_create_simple_port( seq, "RtMidi Announce",
+                                         SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_NO_EXPORT,
+                                         SND_SEQ_PORT_TYPE_APPLICATION );
+  if ( port < 0 ) return -1;
+  if ( snd_seq_connect_from( seq, port, SND_SEQ_CLIENT_SYSTEM, SND_SEQ_PORT_SYSTEM_ANNOUNCE ) < 0 ) {
+    snd_seq_delete_port( seq, port );
+    return -1;
+  }
+  return port;
+}
 
-  long nBytes;
-  unsigned long long time, lastTime;
-  bool continueSysex = false;
-  bool doDecode = false;
-  MidiInApi::MidiMessage message;
-  int poll_fd_count;
-  struct pollfd *poll_fds;
+static bool alsaIsAnnouncement( const snd_seq_event_t *ev )
+{
+  switch ( ev->type ) {
+  case SND_SEQ_EVENT_CLIENT_START:
+  case SND_SEQ_EVENT_CLIENT_EXIT:
+  case SND_SEQ_EVENT_CLIENT_CHANGE:
+  case SND_SEQ_EVENT_PORT_START:
+  case SND_SEQ_EVENT_PORT_EXIT:
+  case SND_SEQ_EVENT_PORT_CHANGE:
+    return true;
+  default:
+    return false;
+  }
+}
 
+// Read any pending input of a client that has no input thread of its
+// own, invalidating the registry if ports have changed.
+static void alsaReadAnnouncements( AlsaMidiData *data )
+{
   snd_seq_event_t *ev;
-  int result;
-  apiData->bufferSize = 32;
-  result = snd_midi_event_new( 0, &apiData->coder );
-  if ( result < 0 ) {
-    data->doInput = false;
-    std::cerr << "\nMidiInAlsa::alsaMidiHandler: error initializing MIDI event parser!\n\n";
-    return 0;
+  while ( snd_seq_event_input_pending( data->seq, 1 ) > 0 ) {
+    int result = snd_seq_event_input( data->seq, &ev );
+    if ( result == -ENOSPC ) {
+      // Announcements may have been lost.
+      data->portsValid = false;
+      continue;
+    }
+    if ( result < 0 ) break;
+    if ( alsaIsAnnouncement( ev ) ) data->portsValid = false;
+    snd_seq_free_event( ev );
   }
-  unsigned char *buffer = (unsigned char *) malloc( apiData->bufferSize );
-  if ( buffer == NULL ) {
-    data->doInput = false;
-    snd_midi_event_free( apiData->coder );
-    apiData->coder = 0;
-    std::cerr << "\nMidiInAlsa::alsaMidiHandler: error initializing buffer memory!\n\n";
+}
+
+// Walk the MIDI ports with the given capabilities, appending them to
+// ports unless it is NULL, and return their number.
+static unsigned int alsaListPorts( snd_seq_t *seq, unsigned int type, std::vector<AlsaPortEntry> *ports )
+{
+  unsigned int count = 0;
+  snd_seq_client_info_t *cinfo;
+  snd_seq_port_info_t *pinfo;
+  snd_seq_client_info_alloca( &cinfo );
+  snd_seq_port_info_alloca( &pinfo );
+
+  snd_seq_client_info_set_client( cinfo, -1 );
+  while ( snd_seq_query_next_client( seq, cinfo ) >= 0 ) {
+    int client = snd_seq_client_info_get_client( cinfo );
+    if ( client == 0 ) continue;
+    // Reset query info
+    snd_seq_port_info_set_client( pinfo, client );
+    snd_seq_port_info_set_port( pinfo, -1 );
+    while ( snd_seq_query_next_port( seq, pinfo ) >= 0 ) {
+      unsigned int atyp = snd_seq_port_info_get_type( pinfo );
+      if ( ( ( atyp & SND_SEQ_PORT_TYPE_MIDI_GENERIC ) == 0 ) &&
+        ( ( atyp & SND_SEQ_PORT_TYPE_SYNTH ) == 0 ) ) continue;
+      unsigned int caps = snd_seq_port_info_get_capability( pinfo );
+      if ( ( caps & type ) != type ) continue;
+      ++count;
+      if ( !ports ) continue;
+
+      AlsaPortEntry entry;
+      entry.addr.client = client;
+      entry.addr.port = snd_seq_port_info_get_port( pinfo );
+      entry.caps = caps;
+      std::ostringstream os;
+      os << snd_seq_client_info_get_name( cinfo );
+      os << " ";                   // These lines added to make sure devices are listed
+      os << client;                // with full portnames added to ensure individual device names
+      os << ":";
+      os << (int) entry.addr.port;
+      entry.name = os.str();
+      ports->push_back( entry );
+    }
+  }
+
+  return count;
+}
+
+// Bring the registry up to date with the ports having the given
+// capabilities.  Pending announcements are read here unless an input
+// thread (of the client or of its context) is doing so.
+static void alsaUpdatePorts( AlsaMidiData *data, unsigned int type, bool readAnnouncements )
+{
+  if ( readAnnouncements && !data->context ) alsaReadAnnouncements( data );
+  if ( data->portsValid ) return;
+
+  // Mark the registry valid before walking the ports, so that an
+  // announcement arriving meanwhile invalidates it again.
+  data->portsValid = ( data->announcePort >= 0 );
+  data->ports.clear();
+  alsaListPorts( data->seq, type, &data->ports );
+}
+
+// Count ports through a temporary client that creates no ports, queue
+// or thread, to find out cheaply whether ALSA is worth using.
+static unsigned int alsaProbePortCount( unsigned int type )
+{
+  snd_seq_t *seq;
+  if ( snd_seq_open( &seq, "default", SND_SEQ_OPEN_OUTPUT, SND_SEQ_NONBLOCK ) < 0 )
     return 0;
+  unsigned int count = alsaListPorts( seq, type, NULL );
+  snd_seq_close( seq );
+  return count;
+}
+
+//*********************************************************************//
+//  API: LINUX ALSA
+//  Class Definitions: MidiContextAlsa
+//*********************************************************************//
+
+static void alsaProcessEvent( MidiInApi::RtMidiInData *data, snd_seq_event_t *ev );
+
+static void alsaContextInvalidatePorts( AlsaContextData *context )
+{
+  pthread_mutex_lock( &context->mutex );
+  for ( unsigned int i=0; i<context->clients.size(); i++ )
+    context->clients[i]->portsValid = false;
+  pthread_mutex_unlock( &context->mutex );
+}
+
+static void alsaContextAttach( AlsaContextData *context, AlsaMidiData *data )
+{
+  pthread_mutex_lock( &context->mutex );
+  context->clients.push_back( data );
+  pthread_mutex_unlock( &context->mutex );
+}
+
+static void alsaContextDetach( AlsaContextData *context, AlsaMidiData *data )
+{
+  pthread_mutex_lock( &context->mutex );
+  context->clients.erase( std::remove( context->clients.begin(), context->clients.end(), data ),
+                          context->clients.end() );
+  pthread_mutex_unlock( &context->mutex );
+}
+
+// Start or stop passing the events received on a port to an input.
+// Once stopped, the context thread no longer touches the input: an
+// event it is processing for the input is waited for, unless the
+// input is stopped from its own callback.
+static void alsaContextSetInput( AlsaContextData *context, int port,
+                                 MidiInApi::RtMidiInData *input, bool enable )
+{
+  pthread_mutex_lock( &context->mutex );
+  if ( enable ) {
+    context->inputs[port] = input;
+    input->doInput = true;
+  }
+  else {
+    context->inputs.erase( port );
+    input->doInput = false;
+    while ( context->processing == input && !pthread_equal( pthread_self(), context->thread ) )
+      pthread_cond_wait( &context->processed, &context->mutex );
   }
-  snd_midi_event_init( apiData->coder );
-  snd_midi_event_no_status( apiData->coder, 1 ); // suppress running status messages
+  pthread_mutex_unlock( &context->mutex );
+}
 
-  poll_fd_count = snd_seq_poll_descriptors_count( apiData->seq, POLLIN ) + 1;
+static void alsaLockOutput( AlsaMidiData *data )
+{
+  if ( data->context ) pthread_mutex_lock( &data->context->outputMutex );
+}
+
+static void alsaUnlockOutput( AlsaMidiData *data )
+{
+  if ( data->context ) pthread_mutex_unlock( &data->context->outputMutex );
+}
+
+static void *alsaContextHandler( void *ptr )
+{
+  AlsaContextData *context = static_cast<AlsaContextData *> (ptr);
+
+  int poll_fd_count;
+  struct pollfd *poll_fds;
+
+  snd_seq_event_t *ev;
+  int result;
+
+  poll_fd_count = snd_seq_poll_descriptors_count( context->seq, POLLIN ) + 1;
   poll_fds = (struct pollfd*)alloca( poll_fd_count * sizeof( struct pollfd ));
-  snd_seq_poll_descriptors( apiData->seq, poll_fds + 1, poll_fd_count - 1, POLLIN );
-  poll_fds[0].fd = apiData->trigger_fds[0];
+  snd_seq_poll_descriptors( context->seq, poll_fds + 1, poll_fd_count - 1, POLLIN );
+  poll_fds[0].fd = context->trigger_fds[0];
   poll_fds[0].events = POLLIN;
 
-  while ( data->doInput ) {
+  while ( context->doInput ) {
 
-    if ( snd_seq_event_input_pending( apiData->seq, 1 ) == 0 ) {
+    if ( snd_seq_event_input_pending( context->seq, 1 ) == 0 ) {
       // No data pending
       if ( poll( poll_fds, poll_fd_count, -1) >= 0 ) {
         if ( poll_fds[0].revents & POLLIN ) {
@@ -144,157 +346,549 @@ static void *alsaMidiHandler( void *ptr )
     }
 
     // If here, there should be data.
-    result = snd_seq_event_input( apiData->seq, &ev );
+    result = snd_seq_event_input( context->seq, &ev );
     if ( result == -ENOSPC ) {
-      std::cerr << "\nMidiInAlsa::alsaMidiHandler: MIDI input buffer overrun!\n\n";
+      alsaContextInvalidatePorts( context ); // port announcements may have been lost
+      pthread_mutex_lock( &context->mutex );
+      std::map<int, MidiInApi::RtMidiInData *>::iterator it;
+      for ( it = context->inputs.begin(); it != context->inputs.end(); ++it )
+        MidiApi::MidiStats::add( it->second->stats.overruns );
+      pthread_mutex_unlock( &context->mutex );
+      std::cerr << "\nMidiContextAlsa::alsaContextHandler: MIDI input buffer overrun!\n\n";
       continue;
     }
     else if ( result <= 0 ) {
-      std::cerr << "\nMidiInAlsa::alsaMidiHandler: unknown MIDI input error!\n";
+      std::cerr << "\nMidiContextAlsa::alsaContextHandler: unknown MIDI input error!\n";
       perror("System reports");
       continue;
     }
 
-    // This is a bit weird, but we now have to decode an ALSA MIDI
-    // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
-    if ( !continueSysex ) message.bytes.clear();
+    if ( alsaIsAnnouncement( ev ) ) {
+      // From System:Announce, every registry must be rebuilt.
+      alsaContextInvalidatePorts( context );
+    }
+    else {
+      // The input is pinned rather than locked while the event is
+      // processed, so that its callbacks may open and close ports of
+      // the context.
+      pthread_mutex_lock( &context->mutex );
+      std::map<int, MidiInApi::RtMidiInData *>::iterator it = context->inputs.find( ev->dest.port );
+      MidiInApi::RtMidiInData *input = 0;
+      if ( it != context->inputs.end() && it->second->doInput ) input = it->second;
+      context->processing = input;
+      pthread_mutex_unlock( &context->mutex );
+
+      if ( input ) {
+        input->enterCallback();
+        alsaProcessEvent( input, ev );
+        input->leaveCallback();
+
+        pthread_mutex_lock( &context->mutex );
+        context->processing = 0;
+        pthread_cond_broadcast( &context->processed );
+        pthread_mutex_unlock( &context->mutex );
+      }
+    }
+    snd_seq_free_event( ev );
+  }
 
-    doDecode = false;
-    switch ( ev->type ) {
+  return 0;
+}
 
-    case SND_SEQ_EVENT_PORT_SUBSCRIBED:
-#if defined(__RTMIDI_DEBUG__)
-      std::cout << "MidiInAlsa::alsaMidiHandler: port connection made!\n";
+// Release everything but the thread, which must have been stopped.
+static void alsaContextClose( AlsaContextData *context )
+{
+  if ( context->trigger_fds[0] >= 0 ) close( context->trigger_fds[0] );
+  if ( context->trigger_fds[1] >= 0 ) close( context->trigger_fds[1] );
+  if ( context->queue_id >= 0 ) snd_seq_free_queue( context->seq, context->queue_id );
+  if ( context->announcePort >= 0 ) snd_seq_delete_port( context->seq, context->announcePort );
+  snd_seq_close( context->seq );
+  pthread_mutex_destroy( &context->outputMutex );
+  pthread_cond_destroy( &context->processed );
+  pthread_mutex_destroy( &context->mutex );
+  delete context;
+}
+
+MidiContextAlsa :: MidiContextAlsa( const std::string clientName ) : MidiContextApi()
+{
+  // Set up the ALSA sequencer client.
+  snd_seq_t *seq;
+  int result = snd_seq_open( &seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK );
+  if ( result < 0 ) {
+    std::string errorText = "MidiContextAlsa: error creating ALSA sequencer client object.";
+    throw( RtMidiError( errorText, RtMidiError::DRIVER_ERROR ) );
+  }
+
+  // Set client name.
+  snd_seq_set_client_name( seq, clientName.c_str() );
+
+  AlsaContextData *context = new AlsaContextData;
+  context->seq = seq;
+  context->queue_id = -1;
+  context->announcePort = alsaOpenAnnouncePort( seq );
+  context->doInput = true;
+  context->trigger_fds[0] = -1;
+  context->trigger_fds[1] = -1;
+  pthread_mutex_init( &context->outputMutex, NULL );
+  pthread_mutex_init( &context->mutex, NULL );
+  pthread_cond_init( &context->processed, NULL );
+  context->processing = 0;
+
+  if ( pipe(context->trigger_fds) == -1 ) {
+    context->trigger_fds[0] = -1;
+    context->trigger_fds[1] = -1;
+    alsaContextClose( context );
+    std::string errorText = "MidiContextAlsa: error creating pipe objects.";
+    throw( RtMidiError( errorText, RtMidiError::DRIVER_ERROR ) );
+  }
+
+  // Create and start the input queue
+#ifndef AVOID_TIMESTAMPING
+  context->queue_id = snd_seq_alloc_named_queue(seq, "RtMidi Queue");
+  // Set arbitrary tempo (mm=100) and resolution (240)
+  snd_seq_queue_tempo_t *qtempo;
+  snd_seq_queue_tempo_alloca(&qtempo);
+  snd_seq_queue_tempo_set_tempo(qtempo, 600000);
+  snd_seq_queue_tempo_set_ppq(qtempo, 240);
+  snd_seq_set_queue_tempo(seq, context->queue_id, qtempo);
+  snd_seq_start_queue( seq, context->queue_id, NULL );
+  snd_seq_drain_output(seq);
 #endif
-      break;
 
-    case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
-#if defined(__RTMIDI_DEBUG__)
-      std::cerr << "MidiInAlsa::alsaMidiHandler: port connection has closed!\n";
-      std::cout << "sender = " << (int) ev->data.connect.sender.client << ":"
-                << (int) ev->data.connect.sender.port
-                << ", dest = " << (int) ev->data.connect.dest.client << ":"
-                << (int) ev->data.connect.dest.port
-                << std::endl;
+  // Start the MIDI input thread of all the ports.
+  pthread_attr_t attr;
+  pthread_attr_init(&attr);
+  pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_JOINABLE);
+  pthread_attr_setschedpolicy(&attr, SCHED_OTHER);
+
+  int err = pthread_create(&context->thread, &attr, alsaContextHandler, context);
+  pthread_attr_destroy(&attr);
+  if ( err ) {
+    alsaContextClose( context );
+    std::string errorText = "MidiContextAlsa: error starting MIDI input thread!";
+    throw( RtMidiError( errorText, RtMidiError::THREAD_ERROR ) );
+  }
+
+  apiData_ = (void *) context;
+}
+
+MidiContextAlsa :: ~MidiContextAlsa()
+{
+  // Shutdown the input thread.
+  AlsaContextData *context = static_cast<AlsaContextData *> (apiData_);
+  context->doInput = false;
+  int res = write( context->trigger_fds[1], &context->doInput, sizeof(context->doInput) );
+  (void) res;
+  pthread_join( context->thread, NULL );
+
+  alsaContextClose( context );
+}
+
+//*********************************************************************//
+//  API: LINUX ALSA
+//  Class Definitions: MidiInAlsa
+//*********************************************************************//
+
+// Convert the real time of an event on the input queue to the clock
+// of RtMidi::getCurrentTime().  The offset between the two is
+// measured once, with the first event after the queue was started.
+static unsigned long long alsaAbsoluteTime( AlsaMidiData *apiData, const snd_seq_event_t *ev )
+{
+#ifndef AVOID_TIMESTAMPING
+  if ( apiData->queueBase == 0 ) {
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_alloca( &status );
+    unsigned long long now = RtMidi::getCurrentTime();
+    if ( snd_seq_get_queue_status( apiData->seq, apiData->queue_id, status ) < 0 ) return now;
+    const snd_seq_real_time_t *rtime = snd_seq_queue_status_get_real_time( status );
+    apiData->queueBase = now - ( rtime->tv_sec * 1000000000ULL + rtime->tv_nsec );
+  }
+  return apiData->queueBase + ev->time.time.tv_sec * 1000000000ULL + ev->time.time.tv_nsec;
+#else
+  (void) apiData;
+  (void) ev;
+  return RtMidi::getCurrentTime();
 #endif
-      break;
+}
 
-    case SND_SEQ_EVENT_QFRAME: // MIDI time code
-      if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
-      break;
+// Write the bytes of a channel, system common or realtime event
+// straight from its fields, and return their number.  Other events
+// return zero and are left to the coder.
+static long alsaEventBytes( const snd_seq_event_t *ev, unsigned char *bytes )
+{
+  switch ( ev->type ) {
+  case SND_SEQ_EVENT_NOTEON:
+  case SND_SEQ_EVENT_NOTEOFF:
+  case SND_SEQ_EVENT_KEYPRESS:
+    bytes[0] = ( ev->type == SND_SEQ_EVENT_NOTEON ? 0x90 : ev->type == SND_SEQ_EVENT_NOTEOFF ? 0x80 : 0xA0 )
+      | ( ev->data.note.channel & 0x0F );
+    bytes[1] = ev->data.note.note & 0x7F;
+    bytes[2] = ev->data.note.velocity & 0x7F;
+    return 3;
+  case SND_SEQ_EVENT_CONTROLLER:
+    bytes[0] = 0xB0 | ( ev->data.control.channel & 0x0F );
+    bytes[1] = ev->data.control.param & 0x7F;
+    bytes[2] = ev->data.control.value & 0x7F;
+    return 3;
+  case SND_SEQ_EVENT_PGMCHANGE:
+  case SND_SEQ_EVENT_CHANPRESS:
+    bytes[0] = ( ev->type == SND_SEQ_EVENT_PGMCHANGE ? 0xC0 : 0xD0 ) | ( ev->data.control.channel & 0x0F );
+    bytes[1] = ev->data.control.value & 0x7F;
+    return 2;
+  case SND_SEQ_EVENT_PITCHBEND: {
+    int value = ev->data.control.value + 8192;
+    bytes[0] = 0xE0 | ( ev->data.control.channel & 0x0F );
+    bytes[1] = value & 0x7F;
+    bytes[2] = ( value >> 7 ) & 0x7F;
+    return 3;
+  }
+  case SND_SEQ_EVENT_SONGPOS:
+    bytes[0] = 0xF2;
+    bytes[1] = ev->data.control.value & 0x7F;
+    bytes[2] = ( ev->data.control.value >> 7 ) & 0x7F;
+    return 3;
+  case SND_SEQ_EVENT_QFRAME:
+  case SND_SEQ_EVENT_SONGSEL:
+    bytes[0] = ev->type == SND_SEQ_EVENT_QFRAME ? 0xF1 : 0xF3;
+    bytes[1] = ev->data.control.value & 0x7F;
+    return 2;
+  case SND_SEQ_EVENT_TUNE_REQUEST: bytes[0] = 0xF6; return 1;
+  case SND_SEQ_EVENT_CLOCK:        bytes[0] = 0xF8; return 1;
+  case SND_SEQ_EVENT_TICK:         bytes[0] = 0xF9; return 1;
+  case SND_SEQ_EVENT_START:        bytes[0] = 0xFA; return 1;
+  case SND_SEQ_EVENT_CONTINUE:     bytes[0] = 0xFB; return 1;
+  case SND_SEQ_EVENT_STOP:         bytes[0] = 0xFC; return 1;
+  case SND_SEQ_EVENT_SENSING:      bytes[0] = 0xFE; return 1;
+  case SND_SEQ_EVENT_RESET:        bytes[0] = 0xFF; return 1;
+  default:
+    return 0;
+  }
+}
 
-    case SND_SEQ_EVENT_TICK: // 0xF9 ... MIDI timing tick
-      if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
-      break;
+// The mirror image of alsaEventBytes(): fill the event of a complete
+// channel, system common or realtime message from its bytes, and
+// return false for messages left to the coder.
+static bool alsaBytesEvent( const unsigned char *bytes, size_t size, snd_seq_event_t *ev )
+{
+  if ( size == 0 || size > 3 ) return false;
+  for ( size_t i=1; i<size; ++i )
+    if ( bytes[i] & 0x80 ) return false;
+
+  unsigned char status = bytes[0];
+  unsigned char channel = status & 0x0F;
+  switch ( status & 0xF0 ) {
+  case 0x80: if ( size != 3 ) return false; snd_seq_ev_set_noteoff( ev, channel, bytes[1], bytes[2] ); return true;
+  case 0x90: if ( size != 3 ) return false; snd_seq_ev_set_noteon( ev, channel, bytes[1], bytes[2] ); return true;
+  case 0xA0: if ( size != 3 ) return false; snd_seq_ev_set_keypress( ev, channel, bytes[1], bytes[2] ); return true;
+  case 0xB0: if ( size != 3 ) return false; snd_seq_ev_set_controller( ev, channel, bytes[1], bytes[2] ); return true;
+  case 0xC0: if ( size != 2 ) return false; snd_seq_ev_set_pgmchange( ev, channel, bytes[1] ); return true;
+  case 0xD0: if ( size != 2 ) return false; snd_seq_ev_set_chanpress( ev, channel, bytes[1] ); return true;
+  case 0xE0:
+    if ( size != 3 ) return false;
+    snd_seq_ev_set_pitchbend( ev, channel, ( bytes[1] | ( bytes[2] << 7 ) ) - 8192 );
+    return true;
+  case 0xF0:
+    break;
+  default:
+    return false;  // running status
+  }
 
-    case SND_SEQ_EVENT_CLOCK: // 0xF8 ... MIDI timing (clock) tick
-      if ( !( data->ignoreFlags & 0x02 ) ) doDecode = true;
-      break;
+  if ( status >= 0xF6 && size != 1 ) return false;
+  switch ( status ) {
+  case 0xF1: case 0xF3:
+    if ( size != 2 ) return false;
+    ev->type = status == 0xF1 ? SND_SEQ_EVENT_QFRAME : SND_SEQ_EVENT_SONGSEL;
+    ev->data.control.value = bytes[1];
+    break;
+  case 0xF2:
+    if ( size != 3 ) return false;
+    ev->type = SND_SEQ_EVENT_SONGPOS;
+    ev->data.control.value = bytes[1] | ( bytes[2] << 7 );
+    break;
+  case 0xF6: ev->type = SND_SEQ_EVENT_TUNE_REQUEST; break;
+  case 0xF8: ev->type = SND_SEQ_EVENT_CLOCK; break;
+  case 0xF9: ev->type = SND_SEQ_EVENT_TICK; break;
+  case 0xFA: ev->type = SND_SEQ_EVENT_START; break;
+  case 0xFB: ev->type = SND_SEQ_EVENT_CONTINUE; break;
+  case 0xFC: ev->type = SND_SEQ_EVENT_STOP; break;
+  case 0xFE: ev->type = SND_SEQ_EVENT_SENSING; break;
+  case 0xFF: ev->type = SND_SEQ_EVENT_RESET; break;
+  default:
+    return false;  // sysex and undefined status bytes
+  }
+  snd_seq_ev_set_fixed( ev );
+  return true;
+}
 
-    case SND_SEQ_EVENT_SENSING: // Active sensing
-      if ( !( data->ignoreFlags & 0x04 ) ) doDecode = true;
-      break;
+// Calculate the time stamp of a message from the ALSA sequencer event
+// time data (thanks to Pedro Lopez-Cabanillas!).  The absolute time is
+// stored in the message of the input data.
+static double alsaDeltaTime( MidiInApi::RtMidiInData *data, const snd_seq_event_t *ev )
+{
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  double timeStamp = 0.0;
+
+  // Method 1: Use the system time.
+  //(void)gettimeofday(&tv, (struct timezone *)NULL);
+  //time = (tv.tv_sec * 1000000) + tv.tv_usec;
+
+  // Method 2: Use the ALSA sequencer event time data.
+  unsigned long long time = ( ev->time.time.tv_sec * 1000000 ) + ( ev->time.time.tv_nsec/1000 );
+  if ( data->firstMessage == true )
+    data->firstMessage = false;
+  else
+    timeStamp = ( time - apiData->lastTime ) * 0.000001;
+  apiData->lastTime = time;
+  data->message.absoluteTime = alsaAbsoluteTime( apiData, ev );
+  return timeStamp;
+}
 
-		case SND_SEQ_EVENT_SYSEX:
-      if ( (data->ignoreFlags & 0x01) ) break;
-      if ( ev->data.ext.len > apiData->bufferSize ) {
-        apiData->bufferSize = ev->data.ext.len;
-        free( buffer );
-        buffer = (unsigned char *) malloc( apiData->bufferSize );
-        if ( buffer == NULL ) {
-          data->doInput = false;
-          std::cerr << "\nMidiInAlsa::alsaMidiHandler: error resizing buffer memory!\n\n";
-          break;
-        }
+// The ALSA sequencer has a maximum buffer size for MIDI sysex events
+// of 256 bytes.  If a device sends sysex messages larger than this,
+// they are segmented into 256 byte chunks, which we concatenate into
+// a single sysex message.  Sysex events carry the raw message bytes,
+// so they bypass the event decoder.  When queueing, each chunk is
+// written straight into the sysex storage of the queue and the
+// message is published there once complete; for a callback, chunks
+// are appended to a vector whose storage is kept between messages.
+static void alsaProcessSysex( MidiInApi::RtMidiInData *data, snd_seq_event_t *ev )
+{
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  const unsigned char *bytes = (const unsigned char *) ev->data.ext.ptr;
+  unsigned int nBytes = ev->data.ext.len;
+  if ( nBytes == 0 ) return;
+
+  bool first = !data->continueSysex;
+  data->continueSysex = ( bytes[nBytes - 1] != 0xF7 );
+  MidiApi::MidiStats::add( data->stats.bytes, nBytes );
+
+  RtMidiIn::RtMidiSysexCallback sysexCallback = data->sysexCallback.load( std::memory_order_acquire );
+  if ( sysexCallback ) {
+    // Streamed as it arrives, never assembled.
+    double timeStamp = alsaDeltaTime( data, ev );
+    if ( !data->continueSysex ) data->stats.countMessage( 0, data->message.absoluteTime );
+    sysexCallback( timeStamp, bytes, nBytes, first, !data->continueSysex,
+                   data->sysexUserData.load( std::memory_order_relaxed ) );
+    return;
+  }
+
+  if ( first ) {
+    apiData->queueSysex = !data->usingCallback;
+    if ( apiData->queueSysex ) {
+      if ( !data->continueSysex ) {
+        // The whole message is in this event.
+        double timeStamp = alsaDeltaTime( data, ev );
+        data->stats.countMessage( 0, data->message.absoluteTime );
+        data->route( bytes, nBytes );
+        if ( !data->queue.push( bytes, nBytes, timeStamp, data->message.absoluteTime ) )
+          std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+        return;
       }
+      data->queue.beginPending();
+    }
+    else
+      apiData->sysex.clear();
+  }
 
-    default:
-      doDecode = true;
-    }
-
-    if ( doDecode ) {
-
-      nBytes = snd_midi_event_decode( apiData->coder, buffer, apiData->bufferSize, ev );
-      if ( nBytes > 0 ) {
-        // The ALSA sequencer has a maximum buffer size for MIDI sysex
-        // events of 256 bytes.  If a device sends sysex messages larger
-        // than this, they are segmented into 256 byte chunks.  So,
-        // we'll watch for this and concatenate sysex chunks into a
-        // single sysex message if necessary.
-        if ( !continueSysex )
-          message.bytes.assign( buffer, &buffer[nBytes] );
-        else
-          message.bytes.insert( message.bytes.end(), buffer, &buffer[nBytes] );
-
-        continueSysex = ( ( ev->type == SND_SEQ_EVENT_SYSEX ) && ( message.bytes.back() != 0xF7 ) );
-        if ( !continueSysex ) {
-
-          // Calculate the time stamp:
-          message.timeStamp = 0.0;
-
-          // Method 1: Use the system time.
-          //(void)gettimeofday(&tv, (struct timezone *)NULL);
-          //time = (tv.tv_sec * 1000000) + tv.tv_usec;
-
-          // Method 2: Use the ALSA sequencer event time data.
-          // (thanks to Pedro Lopez-Cabanillas!).
-          time = ( ev->time.time.tv_sec * 1000000 ) + ( ev->time.time.tv_nsec/1000 );
-          lastTime = time;
-          time -= apiData->lastTime;
-          apiData->lastTime = lastTime;
-          if ( data->firstMessage == true )
-            data->firstMessage = false;
-          else
-            message.timeStamp = time * 0.000001;
-        }
-        else {
+  if ( apiData->queueSysex ) {
+    data->queue.appendPending( bytes, nBytes );
+    if ( data->continueSysex ) return;
+    double timeStamp = alsaDeltaTime( data, ev );
+    data->stats.countMessage( 0, data->message.absoluteTime );
+    MidiApi::MidiStats::add( data->stats.sysexReassemblies );
+    const unsigned char *pending = data->queue.pending();
+    if ( pending ) data->route( pending, data->queue.pendingSize );
+    if ( !data->queue.pushPending( timeStamp, data->message.absoluteTime ) )
+      std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+    return;
+  }
+
+  apiData->sysex.insert( apiData->sysex.end(), bytes, bytes + nBytes );
+  if ( data->continueSysex ) return;
+
+  double timeStamp = alsaDeltaTime( data, ev );
+  data->stats.countMessage( 0, data->message.absoluteTime );
+  if ( !first ) MidiApi::MidiStats::add( data->stats.sysexReassemblies );
+  data->route( apiData->sysex.data(), apiData->sysex.size() );
+  if ( data->usingCallback ) {
+    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
+    unsigned long long start = RtMidi::getCurrentTime();
+    callback( timeStamp, &apiData->sysex, data->userData );
+    data->stats.countCallback( start );
+  }
+  else {
+    // The callback was cancelled meanwhile.
+    if ( !data->queue.push( apiData->sysex.data(), (unsigned int) apiData->sysex.size(), timeStamp,
+                            data->message.absoluteTime ) )
+      std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+  }
+}
+
+// Decode an event received on the port of an input and deliver the
+// message to the callback or the queue.
+static void alsaProcessEvent( MidiInApi::RtMidiInData *data, snd_seq_event_t *ev )
+{
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+  MidiInApi::MidiMessage &message = data->message;
+
+  long nBytes;
+  bool doDecode = false;
+
+  // This is a bit weird, but we now have to decode an ALSA MIDI
+  // event (back) into MIDI bytes.  We'll ignore non-MIDI types.
+  switch ( ev->type ) {
+
+  case SND_SEQ_EVENT_PORT_SUBSCRIBED:
+#if defined(__RTMIDI_DEBUG__)
+    std::cout << "MidiInAlsa::alsaMidiHandler: port connection made!\n";
+#endif
+    break;
+
+  case SND_SEQ_EVENT_PORT_UNSUBSCRIBED:
+#if defined(__RTMIDI_DEBUG__)
+    std::cerr << "MidiInAlsa::alsaMidiHandler: port connection has closed!\n";
+    std::cout << "sender = " << (int) ev->data.connect.sender.client << ":"
+              << (int) ev->data.connect.sender.port
+              << ", dest = " << (int) ev->data.connect.dest.client << ":"
+              << (int) ev->data.connect.dest.port
+              << std::endl;
+#endif
+    break;
+
+  case SND_SEQ_EVENT_CLIENT_START:
+  case SND_SEQ_EVENT_CLIENT_EXIT:
+  case SND_SEQ_EVENT_CLIENT_CHANGE:
+  case SND_SEQ_EVENT_PORT_START:
+  case SND_SEQ_EVENT_PORT_EXIT:
+  case SND_SEQ_EVENT_PORT_CHANGE:
+    // From System:Announce, the port registry must be rebuilt.
+    apiData->portsValid = false;
+    break;
+
+  case SND_SEQ_EVENT_SYSEX:
+    if ( !data->filter[0xF0] )
+      data->continueSysex = false;
+    else
+      alsaProcessSysex( data, ev );
+    return;
+
+  default:
+    doDecode = true;
+  }
+
+  if ( !doDecode ) return;
+
+  // Other events decode to at most three bytes, which may arrive in
+  // the middle of a sysex message and are delivered on their own.
+  // The common ones are built from the event fields, bypassing the
+  // coder and its state machine, and filtered before anything else.
+  unsigned char bytes[3];
+  const unsigned char *source = bytes;
+  nBytes = alsaEventBytes( ev, bytes );
+  if ( nBytes > 0 && !data->filter[bytes[0]] ) return;
+  if ( nBytes == 0 ) {
+    nBytes = snd_midi_event_decode( apiData->coder, apiData->buffer, apiData->bufferSize, ev );
+    if ( nBytes <= 0 ) {
 #if defined(__RTMIDI_DEBUG__)
-          std::cerr << "\nMidiInAlsa::alsaMidiHandler: event parsing error or not a MIDI event!\n\n";
+      std::cerr << "\nMidiInAlsa::alsaMidiHandler: event parsing error or not a MIDI event!\n\n";
 #endif
+      return;
+    }
+    source = apiData->buffer;
+    if ( !data->filter[source[0]] ) return;
+  }
+  message.timeStamp = alsaDeltaTime( data, ev );
+  data->stats.countMessage( nBytes, message.absoluteTime );
+  data->route( source, nBytes );
+
+  if ( data->usingCallback ) {
+    message.bytes.assign( source, source + nBytes );
+    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
+    unsigned long long start = RtMidi::getCurrentTime();
+    callback( message.timeStamp, &message.bytes, data->userData );
+    data->stats.countCallback( start );
+  }
+  else {
+    // As long as we haven't reached our queue size limit, push the
+    // message, straight into its slot.
+    if ( !data->queue.push( source, (unsigned int) nBytes, message.timeStamp, message.absoluteTime ) )
+      std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+  }
+}
+
+static void *alsaMidiHandler( void *ptr )
+{
+  MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (ptr);
+  AlsaMidiData *apiData = static_cast<AlsaMidiData *> (data->apiData);
+
+  int poll_fd_count;
+  struct pollfd *poll_fds;
+
+  snd_seq_event_t *ev;
+  int result;
+
+  poll_fd_count = snd_seq_poll_descriptors_count( apiData->seq, POLLIN ) + 1;
+  poll_fds = (struct pollfd*)alloca( poll_fd_count * sizeof( struct pollfd ));
+  snd_seq_poll_descriptors( apiData->seq, poll_fds + 1, poll_fd_count - 1, POLLIN );
+  poll_fds[0].fd = apiData->trigger_fds[0];
+  poll_fds[0].events = POLLIN;
+
+  while ( data->doInput ) {
+
+    if ( snd_seq_event_input_pending( apiData->seq, 1 ) == 0 ) {
+      // No data pending
+      if ( poll( poll_fds, poll_fd_count, -1) >= 0 ) {
+        if ( poll_fds[0].revents & POLLIN ) {
+          bool dummy;
+          int res = read( poll_fds[0].fd, &dummy, sizeof(dummy) );
+          (void) res;
         }
       }
+      continue;
     }
 
-    snd_seq_free_event( ev );
-    if ( message.bytes.size() == 0 || continueSysex ) continue;
-
-    if ( data->usingCallback ) {
-      RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-      callback( message.timeStamp, &message.bytes, data->userData );
+    // If here, there should be data.
+    result = snd_seq_event_input( apiData->seq, &ev );
+    if ( result == -ENOSPC ) {
+      apiData->portsValid = false; // port announcements may have been lost
+      MidiApi::MidiStats::add( data->stats.overruns );
+      std::cerr << "\nMidiInAlsa::alsaMidiHandler: MIDI input buffer overrun!\n\n";
+      continue;
     }
-    else {
-      // As long as we haven't reached our queue size limit, push the message.
-      if ( data->queue.size < data->queue.ringSize ) {
-        data->queue.ring[data->queue.back++] = message;
-        if ( data->queue.back == data->queue.ringSize )
-          data->queue.back = 0;
-        data->queue.size++;
-      }
-      else
-        std::cerr << "\nMidiInAlsa: message queue limit reached!!\n\n";
+    else if ( result <= 0 ) {
+      std::cerr << "\nMidiInAlsa::alsaMidiHandler: unknown MIDI input error!\n";
+      perror("System reports");
+      continue;
     }
+
+    data->enterCallback();
+    alsaProcessEvent( data, ev );
+    data->leaveCallback();
+    snd_seq_free_event( ev );
   }
 
-  if ( buffer ) free( buffer );
-  snd_midi_event_free( apiData->coder );
-  apiData->coder = 0;
   apiData->thread = apiData->dummy_thread_id;
   return 0;
 }
 
-MidiInAlsa :: MidiInAlsa( const std::string clientName, unsigned int queueSizeLimit ) : MidiInApi( queueSizeLimit )
+MidiInAlsa :: MidiInAlsa( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize,
+                          MidiContextApi *context ) : MidiInApi( queueSizeLimit, sysexQueueSize )
 {
+  context_ = context;
+  if ( context_ ) context_->retain();
   initialize( clientName );
 }
 
 MidiInAlsa :: ~MidiInAlsa()
 {
-  // Close a connection if it exists.
+  // Remove the routes while the sequencer client is open, and close a
+  // connection if it exists.
+  removeRoutes();
   closePort();
 
   // Shutdown the input thread.
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  if ( inputData_.doInput ) {
+  if ( inputData_.doInput && !data->context ) {
     inputData_.doInput = false;
     int res = write( data->trigger_fds[1], &inputData_.doInput, sizeof(inputData_.doInput) );
     (void) res;
@@ -303,29 +897,45 @@ MidiInAlsa :: ~MidiInAlsa()
   }
 
   // Cleanup.
-  close ( data->trigger_fds[0] );
-  close ( data->trigger_fds[1] );
+  if ( data->trigger_fds[0] >= 0 ) close ( data->trigger_fds[0] );
+  if ( data->trigger_fds[1] >= 0 ) close ( data->trigger_fds[1] );
   if ( data->vport >= 0 ) snd_seq_delete_port( data->seq, data->vport );
+  if ( data->coder ) snd_midi_event_free( data->coder );
+  if ( data->buffer ) free( data->buffer );
+  if ( data->context ) {
+    // The client and its queue belong to the context.
+    alsaContextDetach( data->context, data );
+  }
+  else {
 #ifndef AVOID_TIMESTAMPING
-  snd_seq_free_queue( data->seq, data->queue_id );
+    snd_seq_free_queue( data->seq, data->queue_id );
 #endif
-  snd_seq_close( data->seq );
+    snd_seq_close( data->seq );
+  }
   delete data;
+  if ( context_ ) context_->release();
 }
 
 void MidiInAlsa :: initialize( const std::string& clientName )
 {
-  // Set up the ALSA sequencer client.
+  // Set up the ALSA sequencer client, unless that of a context is used.
   snd_seq_t *seq;
-  int result = snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
-  if ( result < 0 ) {
-    errorString_ = "MidiInAlsa::initialize: error creating ALSA sequencer client object.";
-    error( RtMidiError::DRIVER_ERROR, errorString_ );
-    return;
+  AlsaContextData *context = 0;
+  if ( context_ ) {
+    context = static_cast<AlsaContextData *> (context_->getApiData());
+    seq = context->seq;
   }
+  else {
+    int result = snd_seq_open(&seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK);
+    if ( result < 0 ) {
+      errorString_ = "MidiInAlsa::initialize: error creating ALSA sequencer client object.";
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return;
+    }
 
-  // Set client name.
-  snd_seq_set_client_name( seq, clientName.c_str() );
+    // Set client name.
+    snd_seq_set_client_name( seq, clientName.c_str() );
+  }
 
   // Save our api-specific connection information.
   AlsaMidiData *data = (AlsaMidiData *) new AlsaMidiData;
@@ -333,14 +943,47 @@ void MidiInAlsa :: initialize( const std::string& clientName )
   data->portNum = -1;
   data->vport = -1;
   data->subscription = 0;
+  data->coder = 0;
+  data->bufferSize = 32;
+  data->buffer = 0;
+  data->queueSysex = false;
   data->dummy_thread_id = pthread_self();
   data->thread = data->dummy_thread_id;
+  data->lastTime = 0;
+  data->queue_id = -1;
+  data->queueBase = 0;
   data->trigger_fds[0] = -1;
   data->trigger_fds[1] = -1;
+  data->announcePort = context ? context->announcePort : alsaOpenAnnouncePort( seq );
+  data->portsValid = false;
+  data->context = context;
   apiData_ = (void *) data;
   inputData_.apiData = (void *) data;
 
-   if ( pipe(data->trigger_fds) == -1 ) {
+  // The MIDI event parser and its buffer, used by the input thread.
+  if ( snd_midi_event_new( 0, &data->coder ) < 0 ) {
+    data->coder = 0;
+    errorString_ = "MidiInAlsa::initialize: error initializing MIDI event parser!";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return;
+  }
+  snd_midi_event_init( data->coder );
+  snd_midi_event_no_status( data->coder, 1 ); // suppress running status messages
+  data->buffer = (unsigned char *) malloc( data->bufferSize );
+  if ( data->buffer == NULL ) {
+    errorString_ = "MidiInAlsa::initialize: error initializing buffer memory!";
+    error( RtMidiError::MEMORY_ERROR, errorString_ );
+    return;
+  }
+
+  if ( context ) {
+    // The input thread and queue are those of the context.
+    data->queue_id = context->queue_id;
+    alsaContextAttach( context, data );
+    return;
+  }
+
+  if ( pipe(data->trigger_fds) == -1 ) {
     errorString_ = "MidiInAlsa::initialize: error creating pipe objects.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -359,65 +1002,25 @@ void MidiInAlsa :: initialize( const std::string& clientName )
 #endif
 }
 
-// This function is used to count or get the pinfo structure for a given port number.
-unsigned int portInfo( snd_seq_t *seq, snd_seq_port_info_t *pinfo, unsigned int type, int portNumber )
+unsigned int MidiInAlsa :: probePortCount()
 {
-  snd_seq_client_info_t *cinfo;
-  int client;
-  int count = 0;
-  snd_seq_client_info_alloca( &cinfo );
-
-  snd_seq_client_info_set_client( cinfo, -1 );
-  while ( snd_seq_query_next_client( seq, cinfo ) >= 0 ) {
-    client = snd_seq_client_info_get_client( cinfo );
-    if ( client == 0 ) continue;
-    // Reset query info
-    snd_seq_port_info_set_client( pinfo, client );
-    snd_seq_port_info_set_port( pinfo, -1 );
-    while ( snd_seq_query_next_port( seq, pinfo ) >= 0 ) {
-      unsigned int atyp = snd_seq_port_info_get_type( pinfo );
-      if ( ( ( atyp & SND_SEQ_PORT_TYPE_MIDI_GENERIC ) == 0 ) &&
-        ( ( atyp & SND_SEQ_PORT_TYPE_SYNTH ) == 0 ) ) continue;
-      unsigned int caps = snd_seq_port_info_get_capability( pinfo );
-      if ( ( caps & type ) != type ) continue;
-      if ( count == portNumber ) return 1;
-      ++count;
-    }
-  }
-
-  // If a negative portNumber was used, return the port count.
-  if ( portNumber < 0 ) return count;
-  return 0;
+  return alsaProbePortCount( SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ );
 }
 
 unsigned int MidiInAlsa :: getPortCount()
 {
-  snd_seq_port_info_t *pinfo;
-  snd_seq_port_info_alloca( &pinfo );
-
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  return portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, -1 );
+  alsaUpdatePorts( data, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, !inputData_.doInput );
+  return data->ports.size();
 }
 
 std::string MidiInAlsa :: getPortName( unsigned int portNumber )
 {
-  snd_seq_client_info_t *cinfo;
-  snd_seq_port_info_t *pinfo;
-  snd_seq_client_info_alloca( &cinfo );
-  snd_seq_port_info_alloca( &pinfo );
-
   std::string stringName;
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  if ( portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, (int) portNumber ) ) {
-    int cnum = snd_seq_port_info_get_client( pinfo );
-    snd_seq_get_any_client_info( data->seq, cnum, cinfo );
-    std::ostringstream os;
-    os << snd_seq_client_info_get_name( cinfo );
-    os << " ";                                    // These lines added to make sure devices are listed
-    os << snd_seq_port_info_get_client( pinfo );  // with full portnames added to ensure individual device names
-    os << ":";
-    os << snd_seq_port_info_get_port( pinfo );
-    stringName = os.str();
+  alsaUpdatePorts( data, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, !inputData_.doInput );
+  if ( portNumber < data->ports.size() ) {
+    stringName = data->ports[portNumber].name;
     return stringName;
   }
 
@@ -442,10 +1045,8 @@ void MidiInAlsa :: openPort( unsigned int portNumber, const std::string portName
     return;
   }
 
-  snd_seq_port_info_t *src_pinfo;
-  snd_seq_port_info_alloca( &src_pinfo );
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  if ( portInfo( data->seq, src_pinfo, SND_SEQ_PORT_CAP_READ|SND_SEQ_PORT_CAP_SUBS_READ, (int) portNumber ) == 0 ) {
+  if ( portNumber >= nSrc ) {
     std::ostringstream ost;
     ost << "MidiInAlsa::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
     errorString_ = ost.str();
@@ -454,8 +1055,7 @@ void MidiInAlsa :: openPort( unsigned int portNumber, const std::string portName
   }
 
   snd_seq_addr_t sender, receiver;
-  sender.client = snd_seq_port_info_get_client( src_pinfo );
-  sender.port = snd_seq_port_info_get_port( src_pinfo );
+  sender = data->ports[portNumber].addr;
   receiver.client = snd_seq_client_id( data->seq );
 
   snd_seq_port_info_t *pinfo;
@@ -506,9 +1106,14 @@ void MidiInAlsa :: openPort( unsigned int portNumber, const std::string portName
     }
   }
 
-  if ( inputData_.doInput == false ) {
+  if ( data->context ) {
+    // The thread of the context reads the port.
+    alsaContextSetInput( data->context, data->vport, &inputData_, true );
+  }
+  else if ( inputData_.doInput == false ) {
     // Start the input queue
 #ifndef AVOID_TIMESTAMPING
+    data->queueBase = 0;
     snd_seq_start_queue( data->seq, data->queue_id, NULL );
     snd_seq_drain_output( data->seq );
 #endif
@@ -530,6 +1135,7 @@ void MidiInAlsa :: openPort( unsigned int portNumber, const std::string portName
       error( RtMidiError::THREAD_ERROR, errorString_ );
       return;
     }
+    scheduleThread( &data->thread );
   }
 
   connected_ = true;
@@ -564,13 +1170,18 @@ void MidiInAlsa :: openVirtualPort( std::string portName )
     data->vport = snd_seq_port_info_get_port(pinfo);
   }
 
-  if ( inputData_.doInput == false ) {
+  if ( data->context ) {
+    // The thread of the context reads the port.
+    alsaContextSetInput( data->context, data->vport, &inputData_, true );
+  }
+  else if ( inputData_.doInput == false ) {
     // Wait for old thread to stop, if still running
     if ( !pthread_equal(data->thread, data->dummy_thread_id) )
       pthread_join( data->thread, NULL );
 
     // Start the input queue
 #ifndef AVOID_TIMESTAMPING
+    data->queueBase = 0;
     snd_seq_start_queue( data->seq, data->queue_id, NULL );
     snd_seq_drain_output( data->seq );
 #endif
@@ -594,9 +1205,48 @@ void MidiInAlsa :: openVirtualPort( std::string portName )
       error( RtMidiError::THREAD_ERROR, errorString_ );
       return;
     }
+    scheduleThread( &data->thread );
   }
 }
 
+void MidiInAlsa :: applyThreadOptions( void )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( inputData_.doInput && !pthread_equal( data->thread, data->dummy_thread_id ) )
+    scheduleThread( &data->thread );
+}
+
+// A route between the source of the input and the destination of an
+// ALSA output is made by subscribing one to the other, after which
+// the sequencer delivers the events itself.
+void *MidiInAlsa :: connectRoute( MidiOutApi *output )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  if ( output->getCurrentApi() != RtMidi::LINUX_ALSA || !data->subscription ) return 0;
+  AlsaMidiData *outData = static_cast<AlsaMidiData *> (static_cast<MidiOutAlsa *> (output)->apiData_);
+  if ( !outData->subscription ) return 0;
+
+  snd_seq_port_subscribe_t *subscription;
+  if ( snd_seq_port_subscribe_malloc( &subscription ) < 0 ) return 0;
+  snd_seq_port_subscribe_set_sender( subscription, snd_seq_port_subscribe_get_sender( data->subscription ) );
+  snd_seq_port_subscribe_set_dest( subscription, snd_seq_port_subscribe_get_dest( outData->subscription ) );
+  if ( snd_seq_subscribe_port( data->seq, subscription ) ) {
+    snd_seq_port_subscribe_free( subscription );
+    errorString_ = "MidiInAlsa::addRoute: error making the port connection, the messages are forwarded by the input thread.";
+    error( RtMidiError::DEBUG_WARNING, errorString_ );
+    return 0;
+  }
+  return subscription;
+}
+
+void MidiInAlsa :: disconnectRoute( void *handle )
+{
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+  snd_seq_port_subscribe_t *subscription = (snd_seq_port_subscribe_t *) handle;
+  snd_seq_unsubscribe_port( data->seq, subscription );
+  snd_seq_port_subscribe_free( subscription );
+}
+
 void MidiInAlsa :: closePort( void )
 {
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
@@ -607,16 +1257,22 @@ void MidiInAlsa :: closePort( void )
       snd_seq_port_subscribe_free( data->subscription );
       data->subscription = 0;
     }
-    // Stop the input queue
+    // Stop the input queue (that of a context keeps running)
 #ifndef AVOID_TIMESTAMPING
-    snd_seq_stop_queue( data->seq, data->queue_id, NULL );
-    snd_seq_drain_output( data->seq );
+    if ( !data->context ) {
+      snd_seq_stop_queue( data->seq, data->queue_id, NULL );
+      snd_seq_drain_output( data->seq );
+    }
 #endif
     connected_ = false;
   }
 
   // Stop thread to avoid triggering the callback, while the port is intended to be closed
-  if ( inputData_.doInput ) {
+  if ( data->context ) {
+    if ( data->vport >= 0 )
+      alsaContextSetInput( data->context, data->vport, &inputData_, false );
+  }
+  else if ( inputData_.doInput ) {
     inputData_.doInput = false;
     int res = write( data->trigger_fds[1], &inputData_.doInput, sizeof(inputData_.doInput) );
     (void) res;
@@ -630,8 +1286,10 @@ void MidiInAlsa :: closePort( void )
 //  Class Definitions: MidiOutAlsa
 //*********************************************************************//
 
-MidiOutAlsa :: MidiOutAlsa( const std::string clientName ) : MidiOutApi()
+MidiOutAlsa :: MidiOutAlsa( const std::string clientName, MidiContextApi *context ) : MidiOutApi()
 {
+  context_ = context;
+  if ( context_ ) context_->retain();
   initialize( clientName );
 }
 
@@ -645,23 +1303,35 @@ MidiOutAlsa :: ~MidiOutAlsa()
   if ( data->vport >= 0 ) snd_seq_delete_port( data->seq, data->vport );
   if ( data->coder ) snd_midi_event_free( data->coder );
   if ( data->buffer ) free( data->buffer );
-  snd_seq_close( data->seq );
+  if ( data->queue_id >= 0 ) snd_seq_free_queue( data->seq, data->queue_id );
+  if ( data->context )
+    alsaContextDetach( data->context, data );
+  else
+    snd_seq_close( data->seq );
   delete data;
+  if ( context_ ) context_->release();
 }
 
 void MidiOutAlsa :: initialize( const std::string& clientName )
 {
-  // Set up the ALSA sequencer client.
+  // Set up the ALSA sequencer client, unless that of a context is used.
   snd_seq_t *seq;
-  int result1 = snd_seq_open( &seq, "default", SND_SEQ_OPEN_OUTPUT, SND_SEQ_NONBLOCK );
-  if ( result1 < 0 ) {
-    errorString_ = "MidiOutAlsa::initialize: error creating ALSA sequencer client object.";
-    error( RtMidiError::DRIVER_ERROR, errorString_ );
-    return;
-	}
+  AlsaContextData *context = 0;
+  if ( context_ ) {
+    context = static_cast<AlsaContextData *> (context_->getApiData());
+    seq = context->seq;
+  }
+  else {
+    int result1 = snd_seq_open( &seq, "default", SND_SEQ_OPEN_DUPLEX, SND_SEQ_NONBLOCK ); // input for System:Announce
+    if ( result1 < 0 ) {
+      errorString_ = "MidiOutAlsa::initialize: error creating ALSA sequencer client object.";
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return;
+    }
 
-  // Set client name.
-  snd_seq_set_client_name( seq, clientName.c_str() );
+    // Set client name.
+    snd_seq_set_client_name( seq, clientName.c_str() );
+  }
 
   // Save our api-specific connection information.
   AlsaMidiData *data = (AlsaMidiData *) new AlsaMidiData;
@@ -671,6 +1341,11 @@ void MidiOutAlsa :: initialize( const std::string& clientName )
   data->bufferSize = 32;
   data->coder = 0;
   data->buffer = 0;
+  data->queue_id = -1; // an output queue is only allocated for scheduled messages
+  data->subscription = 0;
+  data->announcePort = context ? context->announcePort : alsaOpenAnnouncePort( seq );
+  data->portsValid = false;
+  data->context = context;
   int result = snd_midi_event_new( data->bufferSize, &data->coder );
   if ( result < 0 ) {
     delete data;
@@ -687,36 +1362,28 @@ void MidiOutAlsa :: initialize( const std::string& clientName )
   }
   snd_midi_event_init( data->coder );
   apiData_ = (void *) data;
+  if ( context ) alsaContextAttach( context, data );
 }
 
-unsigned int MidiOutAlsa :: getPortCount()
+unsigned int MidiOutAlsa :: probePortCount()
 {
-	snd_seq_port_info_t *pinfo;
-	snd_seq_port_info_alloca( &pinfo );
+  return alsaProbePortCount( SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE );
+}
 
+unsigned int MidiOutAlsa :: getPortCount()
+{
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  return portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, -1 );
+  alsaUpdatePorts( data, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, true );
+  return data->ports.size();
 }
 
 std::string MidiOutAlsa :: getPortName( unsigned int portNumber )
 {
-  snd_seq_client_info_t *cinfo;
-  snd_seq_port_info_t *pinfo;
-  snd_seq_client_info_alloca( &cinfo );
-  snd_seq_port_info_alloca( &pinfo );
-
   std::string stringName;
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  if ( portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, (int) portNumber ) ) {
-    int cnum = snd_seq_port_info_get_client(pinfo);
-    snd_seq_get_any_client_info( data->seq, cnum, cinfo );
-    std::ostringstream os;
-    os << snd_seq_client_info_get_name(cinfo);
-    os << " ";                                    // These lines added to make sure devices are listed
-    os << snd_seq_port_info_get_client( pinfo );  // with full portnames added to ensure individual device names
-    os << ":";
-    os << snd_seq_port_info_get_port(pinfo);
-    stringName = os.str();
+  alsaUpdatePorts( data, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, true );
+  if ( portNumber < data->ports.size() ) {
+    stringName = data->ports[portNumber].name;
     return stringName;
   }
 
@@ -741,10 +1408,8 @@ void MidiOutAlsa :: openPort( unsigned int portNumber, const std::string portNam
     return;
   }
 
-	snd_seq_port_info_t *pinfo;
-	snd_seq_port_info_alloca( &pinfo );
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  if ( portInfo( data->seq, pinfo, SND_SEQ_PORT_CAP_WRITE|SND_SEQ_PORT_CAP_SUBS_WRITE, (int) portNumber ) == 0 ) {
+  if ( portNumber >= nSrc ) {
     std::ostringstream ost;
     ost << "MidiOutAlsa::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
     errorString_ = ost.str();
@@ -753,8 +1418,7 @@ void MidiOutAlsa :: openPort( unsigned int portNumber, const std::string portNam
   }
 
   snd_seq_addr_t sender, receiver;
-  receiver.client = snd_seq_port_info_get_client( pinfo );
-  receiver.port = snd_seq_port_info_get_port( pinfo );
+  receiver = data->ports[portNumber].addr;
   sender.client = snd_seq_client_id( data->seq );
 
   if ( data->vport < 0 ) {
@@ -783,6 +1447,7 @@ void MidiOutAlsa :: openPort( unsigned int portNumber, const std::string portNam
   snd_seq_port_subscribe_set_time_real(data->subscription, 1);
   if ( snd_seq_subscribe_port(data->seq, data->subscription) ) {
     snd_seq_port_subscribe_free( data->subscription );
+    data->subscription = 0;
     errorString_ = "MidiOutAlsa::openPort: ALSA error making port connection.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -797,6 +1462,7 @@ void MidiOutAlsa :: closePort( void )
     AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
     snd_seq_unsubscribe_port( data->seq, data->subscription );
     snd_seq_port_subscribe_free( data->subscription );
+    data->subscription = 0;
     connected_ = false;
   }
 }
@@ -816,49 +1482,153 @@ void MidiOutAlsa :: openVirtualPort( std::string portName )
   }
 }
 
-void MidiOutAlsa :: sendMessage( std::vector<unsigned char> *message )
+void MidiOutAlsa :: sendMessage( const unsigned char *message, size_t size )
 {
   int result;
   AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
-  unsigned int nBytes = message->size();
-  if ( nBytes > data->bufferSize ) {
-    data->bufferSize = nBytes;
-    result = snd_midi_event_resize_buffer ( data->coder, nBytes);
-    if ( result != 0 ) {
-      errorString_ = "MidiOutAlsa::sendMessage: ALSA error resizing MIDI event buffer.";
-      error( RtMidiError::DRIVER_ERROR, errorString_ );
-      return;
-    }
-    free (data->buffer);
-    data->buffer = (unsigned char *) malloc( data->bufferSize );
-    if ( data->buffer == NULL ) {
-    errorString_ = "MidiOutAlsa::initialize: error allocating buffer memory!\n\n";
-    error( RtMidiError::MEMORY_ERROR, errorString_ );
-    return;
-    }
-  }
+  unsigned int nBytes = size;
 
   snd_seq_event_t ev;
   snd_seq_ev_clear(&ev);
   snd_seq_ev_set_source(&ev, data->vport);
   snd_seq_ev_set_subs(&ev);
   snd_seq_ev_set_direct(&ev);
-  for ( unsigned int i=0; i<nBytes; ++i ) data->buffer[i] = message->at(i);
-  result = snd_midi_event_encode( data->coder, data->buffer, (long)nBytes, &ev );
-  if ( result < (int)nBytes ) {
-    errorString_ = "MidiOutAlsa::sendMessage: event parsing error!";
-    error( RtMidiError::WARNING, errorString_ );
-    return;
+
+  // Channel and short system messages fill the event directly; the
+  // coder is only needed for sysex and unusual messages.
+  if ( !alsaBytesEvent( message, nBytes, &ev ) ) {
+    if ( nBytes > data->bufferSize ) {
+      data->bufferSize = nBytes;
+      result = snd_midi_event_resize_buffer ( data->coder, nBytes);
+      if ( result != 0 ) {
+        errorString_ = "MidiOutAlsa::sendMessage: ALSA error resizing MIDI event buffer.";
+        error( RtMidiError::DRIVER_ERROR, errorString_ );
+        return;
+      }
+      free (data->buffer);
+      data->buffer = (unsigned char *) malloc( data->bufferSize );
+      if ( data->buffer == NULL ) {
+      errorString_ = "MidiOutAlsa::initialize: error allocating buffer memory!\n\n";
+      error( RtMidiError::MEMORY_ERROR, errorString_ );
+      return;
+      }
+    }
+
+    result = snd_midi_event_encode( data->coder, message, (long)nBytes, &ev );
+    if ( result < (int)nBytes ) {
+      errorString_ = "MidiOutAlsa::sendMessage: event parsing error!";
+      error( RtMidiError::WARNING, errorString_ );
+      return;
+    }
   }
 
   // Send the event.
+  alsaLockOutput( data );
   result = snd_seq_event_output(data->seq, &ev);
+  if ( result >= 0 ) snd_seq_drain_output(data->seq);
+  alsaUnlockOutput( data );
   if ( result < 0 ) {
+    MidiStats::add( stats_.drops );
     errorString_ = "MidiOutAlsa::sendMessage: error sending MIDI message to port.";
     error( RtMidiError::WARNING, errorString_ );
     return;
   }
+}
+
+void MidiOutAlsa :: sendMessages( const size_t *offsets, const unsigned char *message, unsigned int count,
+                                  const double *timeStamps, bool deltaTime )
+{
+  int result;
+  AlsaMidiData *data = static_cast<AlsaMidiData *> (apiData_);
+
+  // Grow the encoder once for the longest message of the batch.
+  unsigned int maxBytes = 0;
+  for ( unsigned int i=0; i<count; ++i ) {
+    unsigned int nBytes = (unsigned int) ( offsets[i+1] - offsets[i] );
+    if ( nBytes > maxBytes ) maxBytes = nBytes;
+  }
+  if ( maxBytes > data->bufferSize ) {
+    data->bufferSize = maxBytes;
+    result = snd_midi_event_resize_buffer ( data->coder, maxBytes );
+    if ( result != 0 ) {
+      errorString_ = "MidiOutAlsa::sendMessages: ALSA error resizing MIDI event buffer.";
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return;
+    }
+    free (data->buffer);
+    data->buffer = (unsigned char *) malloc( data->bufferSize );
+    if ( data->buffer == NULL ) {
+      errorString_ = "MidiOutAlsa::sendMessages: error allocating buffer memory!\n\n";
+      error( RtMidiError::MEMORY_ERROR, errorString_ );
+      return;
+    }
+  }
+
+  // Scheduled messages are queued on a real-time queue of our own,
+  // relative to its current time, and dispatched by the sequencer.
+  double queueTime = 0.0;
+  alsaLockOutput( data );
+  if ( timeStamps ) {
+    if ( data->queue_id < 0 ) {
+      data->queue_id = snd_seq_alloc_named_queue( data->seq, "RtMidi Output Queue" );
+      if ( data->queue_id < 0 ) {
+        alsaUnlockOutput( data );
+        errorString_ = "MidiOutAlsa::sendMessages: error allocating ALSA sequencer queue.";
+        error( RtMidiError::DRIVER_ERROR, errorString_ );
+        return;
+      }
+      snd_seq_start_queue( data->seq, data->queue_id, NULL );
+      snd_seq_drain_output( data->seq );
+    }
+
+    snd_seq_queue_status_t *status;
+    snd_seq_queue_status_alloca( &status );
+    if ( snd_seq_get_queue_status( data->seq, data->queue_id, status ) == 0 ) {
+      const snd_seq_real_time_t *now = snd_seq_queue_status_get_real_time( status );
+      queueTime = now->tv_sec + now->tv_nsec * 0.000000001;
+    }
+  }
+
+  snd_seq_event_t ev;
+  double time = 0.0;
+  for ( unsigned int i=0; i<count; ++i ) {
+    unsigned int nBytes = (unsigned int) ( offsets[i+1] - offsets[i] );
+    snd_seq_ev_clear(&ev);
+    snd_seq_ev_set_source(&ev, data->vport);
+    snd_seq_ev_set_subs(&ev);
+    if ( timeStamps ) {
+      time = deltaTime ? time + timeStamps[i] : timeStamps[i];
+      double eventTime = queueTime + ( time > 0.0 ? time : 0.0 );
+      snd_seq_real_time_t rtime;
+      rtime.tv_sec = (unsigned int) eventTime;
+      rtime.tv_nsec = (unsigned int) ( ( eventTime - rtime.tv_sec ) * 1000000000.0 );
+      snd_seq_ev_schedule_real( &ev, data->queue_id, 0, &rtime );
+    }
+    else
+      snd_seq_ev_set_direct(&ev);
+
+    if ( alsaBytesEvent( message + offsets[i], nBytes, &ev ) )
+      result = nBytes;
+    else
+      result = snd_midi_event_encode( data->coder, message + offsets[i], (long)nBytes, &ev );
+    if ( result < (int)nBytes ) {
+      errorString_ = "MidiOutAlsa::sendMessages: event parsing error!";
+      error( RtMidiError::WARNING, errorString_ );
+      continue;
+    }
+
+    // Events accumulate in the output buffer, which is only flushed
+    // when full or once the whole batch has been encoded.
+    result = snd_seq_event_output(data->seq, &ev);
+    if ( result < 0 ) {
+      MidiStats::add( stats_.drops, count - i );
+      errorString_ = "MidiOutAlsa::sendMessages: error sending MIDI message to port.";
+      error( RtMidiError::WARNING, errorString_ );
+      break;
+    }
+  }
   snd_seq_drain_output(data->seq);
+  alsaUnlockOutput( data );
 }
 
 #endif // __LINUX_ALSA__
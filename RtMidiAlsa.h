@@ -52,36 +52,54 @@
 
 #if defined(__LINUX_ALSA__)
 
+class MidiContextAlsa: public MidiContextApi
+{
+ public:
+  MidiContextAlsa( const std::string clientName );
+  ~MidiContextAlsa( void );
+  RtMidi::Api getCurrentApi( void ) { return RtMidi::LINUX_ALSA; };
+};
+
 class MidiInAlsa: public MidiInApi
 {
  public:
-  MidiInAlsa( const std::string clientName, unsigned int queueSizeLimit );
+  MidiInAlsa( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize,
+              MidiContextApi *context = 0 );
   ~MidiInAlsa( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::LINUX_ALSA; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
+  void applyThreadOptions( void );
 
  protected:
   void initialize( const std::string& clientName );
+  void *connectRoute( MidiOutApi *output );
+  void disconnectRoute( void *handle );
 };
 
 class MidiOutAlsa: public MidiOutApi
 {
  public:
-  MidiOutAlsa( const std::string clientName );
+  MidiOutAlsa( const std::string clientName, MidiContextApi *context = 0 );
   ~MidiOutAlsa( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::LINUX_ALSA; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
-  void sendMessage( std::vector<unsigned char> *message );
+  void sendMessage( const unsigned char *message, size_t size );
+  void sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count,
+                     const double *timeStamps, bool deltaTime );
 
  protected:
+  friend class MidiInAlsa; // for routes made natively
+
   void initialize( const std::string& clientName );
 };
 
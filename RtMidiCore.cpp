@@ -44,6 +44,7 @@
   #if TARGET_OS_IPHONE
     #define AudioGetCurrentHostTime CAHostTimeBase::GetCurrentTime
     #define AudioConvertHostTimeToNanos CAHostTimeBase::ConvertToNanos
+    #define AudioConvertNanosToHostTime CAHostTimeBase::ConvertFromNanos
   #endif
 #endif
 
@@ -62,13 +63,63 @@
 // implementation.
 struct CoreMidiData {
   MIDIClientRef client;
+  bool sharedClient; // the client belongs to an RtMidiContext
   MIDIPortRef port;
   MIDIEndpointRef endpoint;
   MIDIEndpointRef destinationId;
   unsigned long long lastTime;
+  long long clockOffset; // from host time nanoseconds to the clock of RtMidi::getCurrentTime()
   MIDISysexSendRequest sysexreq;
+
+  // The output packet list, kept from one call to the next; see
+  // MidiOutCore::addPacket().
+  std::vector<Byte> packetBuffer;
+  MIDIPacket *packet;  // the last packet added, or the first one of an empty list
+};
+
+// Start a new, empty output packet list of at least \e size bytes.
+// The buffer only ever grows.
+static void coreResetPackets( CoreMidiData *data, ByteCount size )
+{
+  if ( data->packetBuffer.size() < size ) data->packetBuffer.resize( size );
+  data->packet = MIDIPacketListInit( (MIDIPacketList *) &data->packetBuffer[0] );
+}
+
+// The client of an RtMidiContext, on which the MidiInCore and
+// MidiOutCore instances attached to it create their ports.
+struct CoreContextData {
+  MIDIClientRef client;
 };
 
+//*********************************************************************//
+//  API: OS-X
+//  Class Definitions: MidiContextCore
+//*********************************************************************//
+
+MidiContextCore :: MidiContextCore( const std::string clientName ) : MidiContextApi()
+{
+  MIDIClientRef client;
+  CFStringRef name = CFStringCreateWithCString( NULL, clientName.c_str(), kCFStringEncodingASCII );
+  OSStatus result = MIDIClientCreate( name, NULL, NULL, &client );
+  CFRelease( name );
+  if ( result != noErr ) {
+    std::ostringstream ost;
+    ost << "MidiContextCore: error creating OS-X MIDI client object (" << result << ").";
+    throw( RtMidiError( ost.str(), RtMidiError::DRIVER_ERROR ) );
+  }
+
+  CoreContextData *context = new CoreContextData;
+  context->client = client;
+  apiData_ = (void *) context;
+}
+
+MidiContextCore :: ~MidiContextCore()
+{
+  CoreContextData *context = static_cast<CoreContextData *> (apiData_);
+  MIDIClientDispose( context->client );
+  delete context;
+}
+
 //*********************************************************************//
 //  API: OS-X
 //  Class Definitions: MidiInCore
@@ -79,153 +130,46 @@ static void midiInputCallback( const MIDIPacketList *list, void *procRef, void *
   MidiInApi::RtMidiInData *data = static_cast<MidiInApi::RtMidiInData *> (procRef);
   CoreMidiData *apiData = static_cast<CoreMidiData *> (data->apiData);
 
-  unsigned char status;
-  unsigned short nBytes, iByte, size;
   unsigned long long time;
-
-  bool& continueSysex = data->continueSysex;
-  MidiInApi::MidiMessage& message = data->message;
+  double timeStamp;
 
   const MIDIPacket *packet = &list->packet[0];
   for ( unsigned int i=0; i<list->numPackets; ++i ) {
 
-    // My interpretation of the CoreMIDI documentation: all message
-    // types, except sysex, are complete within a packet and there may
-    // be several of them in a single packet.  Sysex messages can be
-    // broken across multiple packets and PacketLists but are bundled
-    // alone within each packet (these packets do not contain other
-    // message types).  If sysex messages are split across multiple
-    // MIDIPacketLists, they must be handled by multiple calls to this
-    // function.
-
-    nBytes = packet->length;
-    if ( nBytes == 0 ) continue;
+    // A packet may hold several messages, and a sysex message may be
+    // broken across packets and packet lists, so the bytes go through
+    // the parser of the input data, which keeps its state from one
+    // packet to the next.  Each message gets the time of its packet.
+    if ( packet->length == 0 ) continue;
 
     // Calculate time stamp.
+    MIDITimeStamp hostTime = packet->timeStamp;
+    if ( hostTime == 0 ) { // this happens when receiving asynchronous sysex messages
+      hostTime = AudioGetCurrentHostTime();
+    }
 
-    if ( data->firstMessage ) {
-      message.timeStamp = 0.0;
+    timeStamp = 0.0;
+    if ( data->firstMessage )
       data->firstMessage = false;
-    }
     else {
-      time = packet->timeStamp;
-      if ( time == 0 ) { // this happens when receiving asynchronous sysex messages
-        time = AudioGetCurrentHostTime();
-      }
-      time -= apiData->lastTime;
+      time = hostTime - apiData->lastTime;
       time = AudioConvertHostTimeToNanos( time );
-      if ( !continueSysex )
-        message.timeStamp = time * 0.000000001;
-    }
-    apiData->lastTime = packet->timeStamp;
-    if ( apiData->lastTime == 0 ) { // this happens when receiving asynchronous sysex messages
-      apiData->lastTime = AudioGetCurrentHostTime();
+      timeStamp = time * 0.000000001;
     }
+    apiData->lastTime = hostTime;
     //std::cout << "TimeStamp = " << packet->timeStamp << std::endl;
 
-    iByte = 0;
-    if ( continueSysex ) {
-      // We have a continuing, segmented sysex message.
-      if ( !( data->ignoreFlags & 0x01 ) ) {
-        // If we're not ignoring sysex messages, copy the entire packet.
-        for ( unsigned int j=0; j<nBytes; ++j )
-          message.bytes.push_back( packet->data[j] );
-      }
-      continueSysex = packet->data[nBytes-1] != 0xF7;
-
-      if ( !( data->ignoreFlags & 0x01 ) && !continueSysex ) {
-        // If not a continuing sysex message, invoke the user callback function or queue the message.
-        if ( data->usingCallback ) {
-          RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-          callback( message.timeStamp, &message.bytes, data->userData );
-        }
-        else {
-          // As long as we haven't reached our queue size limit, push the message.
-          if ( data->queue.size < data->queue.ringSize ) {
-            data->queue.ring[data->queue.back++] = message;
-            if ( data->queue.back == data->queue.ringSize )
-              data->queue.back = 0;
-            data->queue.size++;
-          }
-          else
-            std::cerr << "\nMidiInCore: message queue limit reached!!\n\n";
-        }
-        message.bytes.clear();
-      }
-    }
-    else {
-      while ( iByte < nBytes ) {
-        size = 0;
-        // We are expecting that the next byte in the packet is a status byte.
-        status = packet->data[iByte];
-        if ( !(status & 0x80) ) break;
-        // Determine the number of bytes in the MIDI message.
-        if ( status < 0xC0 ) size = 3;
-        else if ( status < 0xE0 ) size = 2;
-        else if ( status < 0xF0 ) size = 3;
-        else if ( status == 0xF0 ) {
-          // A MIDI sysex
-          if ( data->ignoreFlags & 0x01 ) {
-            size = 0;
-            iByte = nBytes;
-          }
-          else size = nBytes - iByte;
-          continueSysex = packet->data[nBytes-1] != 0xF7;
-        }
-        else if ( status == 0xF1 ) {
-            // A MIDI time code message
-           if ( data->ignoreFlags & 0x02 ) {
-            size = 0;
-            iByte += 2;
-           }
-           else size = 2;
-        }
-        else if ( status == 0xF2 ) size = 3;
-        else if ( status == 0xF3 ) size = 2;
-        else if ( status == 0xF8 && ( data->ignoreFlags & 0x02 ) ) {
-          // A MIDI timing tick message and we're ignoring it.
-          size = 0;
-          iByte += 1;
-        }
-        else if ( status == 0xFE && ( data->ignoreFlags & 0x04 ) ) {
-          // A MIDI active sensing message and we're ignoring it.
-          size = 0;
-          iByte += 1;
-        }
-        else size = 1;
-
-        // Copy the MIDI data to our vector.
-        if ( size ) {
-          message.bytes.assign( &packet->data[iByte], &packet->data[iByte+size] );
-          if ( !continueSysex ) {
-            // If not a continuing sysex message, invoke the user callback function or queue the message.
-            if ( data->usingCallback ) {
-              RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-              callback( message.timeStamp, &message.bytes, data->userData );
-            }
-            else {
-              // As long as we haven't reached our queue size limit, push the message.
-              if ( data->queue.size < data->queue.ringSize ) {
-                data->queue.ring[data->queue.back++] = message;
-                if ( data->queue.back == data->queue.ringSize )
-                  data->queue.back = 0;
-                data->queue.size++;
-              }
-              else
-                std::cerr << "\nMidiInCore: message queue limit reached!!\n\n";
-            }
-            message.bytes.clear();
-          }
-          iByte += size;
-        }
-      }
-    }
+    data->receive( packet->data, packet->length, timeStamp,
+                   AudioConvertHostTimeToNanos( hostTime ) + apiData->clockOffset );
     packet = MIDIPacketNext(packet);
   }
 }
 
-MidiInCore :: MidiInCore( const std::string clientName, unsigned int queueSizeLimit ) : MidiInApi( queueSizeLimit )
+MidiInCore :: MidiInCore( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize,
+                          MidiContextApi *context ) : MidiInApi( queueSizeLimit, sysexQueueSize )
 {
+  context_ = context;
+  if ( context_ ) context_->retain();
   initialize( clientName );
 }
 
@@ -236,29 +180,36 @@ MidiInCore :: ~MidiInCore( void )
 
   // Cleanup.
   CoreMidiData *data = static_cast<CoreMidiData *> (apiData_);
-  MIDIClientDispose( data->client );
+  if ( !data->sharedClient ) MIDIClientDispose( data->client );
   if ( data->endpoint ) MIDIEndpointDispose( data->endpoint );
   delete data;
+  if ( context_ ) context_->release();
 }
 
 void MidiInCore :: initialize( const std::string& clientName )
 {
-  // Set up our client.
+  // Set up our client, unless that of a context is used.
   MIDIClientRef client;
   CFStringRef name = CFStringCreateWithCString( NULL, clientName.c_str(), kCFStringEncodingASCII );
-  OSStatus result = MIDIClientCreate(name, NULL, NULL, &client );
-  if ( result != noErr ) {
-    std::ostringstream ost;
-    ost << "MidiInCore::initialize: error creating OS-X MIDI client object (" << result << ").";
-    errorString_ = ost.str();
-    error( RtMidiError::DRIVER_ERROR, errorString_ );
-    return;
+  if ( context_ )
+    client = static_cast<CoreContextData *> (context_->getApiData())->client;
+  else {
+    OSStatus result = MIDIClientCreate(name, NULL, NULL, &client );
+    if ( result != noErr ) {
+      std::ostringstream ost;
+      ost << "MidiInCore::initialize: error creating OS-X MIDI client object (" << result << ").";
+      errorString_ = ost.str();
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return;
+    }
   }
 
   // Save our api-specific connection information.
   CoreMidiData *data = (CoreMidiData *) new CoreMidiData;
   data->client = client;
+  data->sharedClient = ( context_ != 0 );
   data->endpoint = 0;
+  data->clockOffset = (long long) ( RtMidi::getCurrentTime() - AudioConvertHostTimeToNanos( AudioGetCurrentHostTime() ) );
   apiData_ = (void *) data;
   inputData_.apiData = (void *) data;
   CFRelease(name);
@@ -294,7 +245,7 @@ void MidiInCore :: openPort( unsigned int portNumber, const std::string portName
                                          CFStringCreateWithCString( NULL, portName.c_str(), kCFStringEncodingASCII ),
                                          midiInputCallback, (void *)&inputData_, &port );
   if ( result != noErr ) {
-    MIDIClientDispose( data->client );
+    if ( !data->sharedClient ) MIDIClientDispose( data->client );
     errorString_ = "MidiInCore::openPort: error creating OS-X MIDI input port.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -304,7 +255,7 @@ void MidiInCore :: openPort( unsigned int portNumber, const std::string portName
   MIDIEndpointRef endpoint = MIDIGetSource( portNumber );
   if ( endpoint == 0 ) {
     MIDIPortDispose( port );
-    MIDIClientDispose( data->client );
+    if ( !data->sharedClient ) MIDIClientDispose( data->client );
     errorString_ = "MidiInCore::openPort: error getting MIDI input source reference.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -314,7 +265,7 @@ void MidiInCore :: openPort( unsigned int portNumber, const std::string portName
   result = MIDIPortConnectSource( port, endpoint, NULL );
   if ( result != noErr ) {
     MIDIPortDispose( port );
-    MIDIClientDispose( data->client );
+    if ( !data->sharedClient ) MIDIClientDispose( data->client );
     errorString_ = "MidiInCore::openPort: error connecting OS-X MIDI input port.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -357,9 +308,17 @@ void MidiInCore :: closePort( void )
     MIDIPortDispose( data->port );
   }
 
+  // A message left incomplete is dropped.
+  inputData_.parser.reset();
   connected_ = false;
 }
 
+unsigned int MidiInCore :: probePortCount()
+{
+  // No client is needed to count endpoints.
+  return MIDIGetNumberOfSources();
+}
+
 unsigned int MidiInCore :: getPortCount()
 {
   CFRunLoopRunInMode( kCFRunLoopDefaultMode, 0, false );
@@ -521,8 +480,10 @@ std::string MidiInCore :: getPortName( unsigned int portNumber )
 //  Class Definitions: MidiOutCore
 //*********************************************************************//
 
-MidiOutCore :: MidiOutCore( const std::string clientName ) : MidiOutApi()
+MidiOutCore :: MidiOutCore( const std::string clientName, MidiContextApi *context ) : MidiOutApi()
 {
+  context_ = context;
+  if ( context_ ) context_->retain();
   initialize( clientName );
 }
 
@@ -533,33 +494,46 @@ MidiOutCore :: ~MidiOutCore( void )
 
   // Cleanup.
   CoreMidiData *data = static_cast<CoreMidiData *> (apiData_);
-  MIDIClientDispose( data->client );
+  if ( !data->sharedClient ) MIDIClientDispose( data->client );
   if ( data->endpoint ) MIDIEndpointDispose( data->endpoint );
   delete data;
+  if ( context_ ) context_->release();
 }
 
 void MidiOutCore :: initialize( const std::string& clientName )
 {
-  // Set up our client.
+  // Set up our client, unless that of a context is used.
   MIDIClientRef client;
   CFStringRef name = CFStringCreateWithCString( NULL, clientName.c_str(), kCFStringEncodingASCII );
-  OSStatus result = MIDIClientCreate(name, NULL, NULL, &client );
-  if ( result != noErr ) {
-    std::ostringstream ost;
-    ost << "MidiInCore::initialize: error creating OS-X MIDI client object (" << result << ").";
-    errorString_ = ost.str();
-    error( RtMidiError::DRIVER_ERROR, errorString_ );
-    return;
+  if ( context_ )
+    client = static_cast<CoreContextData *> (context_->getApiData())->client;
+  else {
+    OSStatus result = MIDIClientCreate(name, NULL, NULL, &client );
+    if ( result != noErr ) {
+      std::ostringstream ost;
+      ost << "MidiInCore::initialize: error creating OS-X MIDI client object (" << result << ").";
+      errorString_ = ost.str();
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return;
+    }
   }
 
   // Save our api-specific connection information.
   CoreMidiData *data = (CoreMidiData *) new CoreMidiData;
   data->client = client;
+  data->sharedClient = ( context_ != 0 );
   data->endpoint = 0;
+  coreResetPackets( data, 1024 );
   apiData_ = (void *) data;
   CFRelease( name );
 }
 
+unsigned int MidiOutCore :: probePortCount()
+{
+  // No client is needed to count endpoints.
+  return MIDIGetNumberOfDestinations();
+}
+
 unsigned int MidiOutCore :: getPortCount()
 {
   CFRunLoopRunInMode( kCFRunLoopDefaultMode, 0, false );
@@ -620,7 +594,7 @@ void MidiOutCore :: openPort( unsigned int portNumber, const std::string portNam
                                           CFStringCreateWithCString( NULL, portName.c_str(), kCFStringEncodingASCII ),
                                           &port );
   if ( result != noErr ) {
-    MIDIClientDispose( data->client );
+    if ( !data->sharedClient ) MIDIClientDispose( data->client );
     errorString_ = "MidiOutCore::openPort: error creating OS-X MIDI output port.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -630,7 +604,7 @@ void MidiOutCore :: openPort( unsigned int portNumber, const std::string portNam
   MIDIEndpointRef destination = MIDIGetDestination( portNumber );
   if ( destination == 0 ) {
     MIDIPortDispose( port );
-    MIDIClientDispose( data->client );
+    if ( !data->sharedClient ) MIDIClientDispose( data->client );
     errorString_ = "MidiOutCore::openPort: error getting MIDI output destination reference.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
@@ -682,63 +656,118 @@ void MidiOutCore :: openVirtualPort( std::string portName )
   data->endpoint = endpoint;
 }
 
-void MidiOutCore :: sendMessage( std::vector<unsigned char> *message )
+// Append a message to the output packet list.  CoreMIDI merges it
+// into the previous packet when both have the same time stamp, and
+// sysex messages are split in packets of at most 65535 bytes.  A list
+// that fills up is sent at once, and an empty one grows to fit.
+void MidiOutCore :: addPacket( unsigned long long timeStamp, const unsigned char *bytes, size_t nBytes )
 {
-  // We use the MIDISendSysex() function to asynchronously send sysex
-  // messages.  Otherwise, we use a single CoreMidi MIDIPacket.
-  unsigned int nBytes = message->size();
-  if ( nBytes == 0 ) {
-    errorString_ = "MidiOutCore::sendMessage: no data in message argument!";      
-    error( RtMidiError::WARNING, errorString_ );
-    return;
+  CoreMidiData *data = static_cast<CoreMidiData *> (apiData_);
+  ByteCount remainingBytes = nBytes;
+  while ( remainingBytes ) {
+    ByteCount bytesForPacket = remainingBytes > 65535 ? 65535 : remainingBytes; // 65535 = maximum size of a MIDIPacket
+    MIDIPacketList *packetList = (MIDIPacketList *) &data->packetBuffer[0];
+    MIDIPacket *packet = MIDIPacketListAdd( packetList, data->packetBuffer.size(), data->packet, timeStamp,
+                                            bytesForPacket, bytes + nBytes - remainingBytes );
+    if ( packet == NULL ) {
+      if ( packetList->numPackets > 0 )
+        flushPackets();
+      else
+        coreResetPackets( data, sizeof(MIDIPacketList) + bytesForPacket );
+      continue;
+    }
+
+    data->packet = packet;
+    remainingBytes -= bytesForPacket;
   }
+}
 
-  MIDITimeStamp timeStamp = AudioGetCurrentHostTime();
+// Send the output packet list and start a new one.
+void MidiOutCore :: flushPackets( void )
+{
   CoreMidiData *data = static_cast<CoreMidiData *> (apiData_);
+  MIDIPacketList *packetList = (MIDIPacketList *) &data->packetBuffer[0];
   OSStatus result;
 
-  if ( message->at(0) != 0xF0 && nBytes > 3 ) {
-    errorString_ = "MidiOutCore::sendMessage: message format problem ... not sysex but > 3 bytes?";
-    error( RtMidiError::WARNING, errorString_ );
-    return;
+  if ( packetList->numPackets > 0 ) {
+    // Send to any destinations that may have connected to us.
+    if ( data->endpoint ) {
+      result = MIDIReceived( data->endpoint, packetList );
+      if ( result != noErr ) {
+        errorString_ = "MidiOutCore::sendMessage: error sending MIDI to virtual destinations.";
+        error( RtMidiError::WARNING, errorString_ );
+      }
+    }
+
+    // And send to an explicit destination port if we're connected.
+    if ( connected_ ) {
+      result = MIDISend( data->port, data->destinationId, packetList );
+      if ( result != noErr ) {
+        errorString_ = "MidiOutCore::sendMessage: error sending MIDI message to port.";
+        error( RtMidiError::WARNING, errorString_ );
+      }
+    }
   }
 
-  Byte buffer[nBytes+(sizeof(MIDIPacketList))];
-  ByteCount listSize = sizeof(buffer);
-  MIDIPacketList *packetList = (MIDIPacketList*)buffer;
-  MIDIPacket *packet = MIDIPacketListInit( packetList );
+  coreResetPackets( data, 0 );
+}
 
-  ByteCount remainingBytes = nBytes;
-  while (remainingBytes && packet) {
-    ByteCount bytesForPacket = remainingBytes > 65535 ? 65535 : remainingBytes; // 65535 = maximum size of a MIDIPacket
-    const Byte* dataStartPtr = (const Byte *) &message->at( nBytes - remainingBytes );
-    packet = MIDIPacketListAdd( packetList, listSize, packet, timeStamp, bytesForPacket, dataStartPtr);
-    remainingBytes -= bytesForPacket; 
+void MidiOutCore :: sendMessage( const unsigned char *message, size_t size )
+{
+  // The message goes out in the packet list kept between calls.
+  unsigned int nBytes = size;
+  if ( nBytes == 0 ) {
+    errorString_ = "MidiOutCore::sendMessage: no data in message argument!";      
+    error( RtMidiError::WARNING, errorString_ );
+    return;
   }
 
-  if ( !packet ) {
-    errorString_ = "MidiOutCore::sendMessage: could not allocate packet list";      
-    error( RtMidiError::DRIVER_ERROR, errorString_ );
+  if ( message[0] != 0xF0 && nBytes > 3 ) {
+    errorString_ = "MidiOutCore::sendMessage: message format problem ... not sysex but > 3 bytes?";
+    error( RtMidiError::WARNING, errorString_ );
     return;
   }
 
-  // Send to any destinations that may have connected to us.
-  if ( data->endpoint ) {
-    result = MIDIReceived( data->endpoint, packetList );
-    if ( result != noErr ) {
-      errorString_ = "MidiOutCore::sendMessage: error sending MIDI to virtual destinations.";
+  // A zero time stamp makes CoreMIDI deliver the message at once, so
+  // the host time need not be read.
+  addPacket( 0, message, nBytes );
+  flushPackets();
+}
+
+void MidiOutCore :: sendMessages( const size_t *offsets, const unsigned char *message, unsigned int count,
+                                  const double *timeStamps, bool deltaTime )
+{
+  // The batch is collected in the packet list, each packet carrying
+  // the host time at which CoreMIDI should deliver it, and sent when
+  // the list is full and at the end.  Messages without time stamps
+  // are sent at once (time stamp zero) and share packets.
+  MIDITimeStamp now = timeStamps ? AudioGetCurrentHostTime() : 0;
+  MIDITimeStamp timeStamp = now;
+  double time = 0.0, lastTime = 0.0;
+  for ( unsigned int i=0; i<count; ++i ) {
+    ByteCount nBytes = offsets[i+1] - offsets[i];
+    const Byte *bytes = (const Byte *) ( message + offsets[i] );
+    if ( nBytes == 0 ) continue;
+    if ( bytes[0] != 0xF0 && nBytes > 3 ) {
+      errorString_ = "MidiOutCore::sendMessages: message format problem ... not sysex but > 3 bytes?";
       error( RtMidiError::WARNING, errorString_ );
+      continue;
     }
-  }
 
-  // And send to an explicit destination port if we're connected.
-  if ( connected_ ) {
-    result = MIDISend( data->port, data->destinationId, packetList );
-    if ( result != noErr ) {
-      errorString_ = "MidiOutCore::sendMessage: error sending MIDI message to port.";
-      error( RtMidiError::WARNING, errorString_ );
+    // The host time is only converted when the time changes.
+    if ( timeStamps ) {
+      time = deltaTime ? time + timeStamps[i] : timeStamps[i];
+      if ( time != lastTime ) {
+        timeStamp = now;
+        if ( time > 0.0 ) timeStamp += AudioConvertNanosToHostTime( (UInt64) ( time * 1000000000.0 ) );
+        lastTime = time;
+      }
     }
+
+    addPacket( timeStamp, bytes, nBytes );
   }
+
+  flushPackets();
 }
 
 #endif  // __MACOSX_CORE__
@@ -54,16 +54,26 @@
 
 #if defined(__MACOSX_CORE__)
 
+class MidiContextCore: public MidiContextApi
+{
+ public:
+  MidiContextCore( const std::string clientName );
+  ~MidiContextCore( void );
+  RtMidi::Api getCurrentApi( void ) { return RtMidi::MACOSX_CORE; };
+};
+
 class MidiInCore: public MidiInApi
 {
  public:
-  MidiInCore( const std::string clientName, unsigned int queueSizeLimit );
+  MidiInCore( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize,
+              MidiContextApi *context = 0 );
   ~MidiInCore( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::MACOSX_CORE; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
 
  protected:
@@ -73,18 +83,23 @@ class MidiInCore: public MidiInApi
 class MidiOutCore: public MidiOutApi
 {
  public:
-  MidiOutCore( const std::string clientName );
+  MidiOutCore( const std::string clientName, MidiContextApi *context = 0 );
   ~MidiOutCore( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::MACOSX_CORE; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
-  void sendMessage( std::vector<unsigned char> *message );
+  void sendMessage( const unsigned char *message, size_t size );
+  void sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count,
+                     const double *timeStamps, bool deltaTime );
 
  protected:
   void initialize( const std::string& clientName );
+  void addPacket( unsigned long long timeStamp, const unsigned char *bytes, size_t nBytes );
+  void flushPackets( void );
 };
 
 #endif
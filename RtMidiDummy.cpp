@@ -0,0 +1,564 @@
+/**********************************************************************/
+/*! \class RtMidi
+    \brief An abstract base class for realtime MIDI input/output.
+
+    This class implements some common functionality for the realtime
+    MIDI input/output subclasses RtMidiIn and RtMidiOut.
+
+    RtMidi WWW site: http://music.mcgill.ca/~gary/rtmidi/
+
+    RtMidi: realtime MIDI i/o C++ classes
+    Copyright (c) 2003-2016 Gary P. Scavone
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation files
+    (the "Software"), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    Any person wishing to distribute modifications to the Software is
+    asked to send the modifications to the original developer so that
+    they can be incorporated into the canonical version.  This is,
+    however, not a binding provision of this license.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+/**********************************************************************/
+
+
+#include "RtMidi.h"
+#include "RtMidiDummy.h"
+#include <sstream>
+
+//*********************************************************************//
+//  API: RTMIDI_DUMMY
+//
+//  An in-process loopback.  Messages sent by an RtMidiOut to its
+//  virtual port are delivered to every RtMidiIn connected to that
+//  port, and those sent by an RtMidiOut connected to the virtual port
+//  of an RtMidiIn are delivered to that input.  No MIDI system is
+//  involved, so the API can be used to test an application anywhere,
+//  and to measure the cost of RtMidi's own queueing and dispatch.
+//
+//  *********************************************************************//
+
+#if defined(__RTMIDI_DUMMY__)
+
+#include <algorithm>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <system_error>
+#include <thread>
+
+#define DUMMY_RING_SIZE 4096    // Default number of messages of an input ring
+#define DUMMY_ARENA_SIZE 65536  // Default size of its sysex storage
+
+struct DummyInputData;
+
+// A virtual port, shared by the instance that opened it and those
+// connected to it.  Senders hold its mutex while they write to the
+// rings of its inputs, which therefore have one producer at a time.
+struct DummyPort {
+  std::string name;
+  std::mutex mutex;
+  std::vector<DummyInputData *> inputs;
+};
+
+// The virtual ports open in the process: those of outputs, listed to
+// the inputs, and those of inputs, listed to the outputs.
+static std::mutex dummyPortsMutex;
+static std::vector< std::shared_ptr<DummyPort> > dummyOutputPorts;
+static std::vector< std::shared_ptr<DummyPort> > dummyInputPorts;
+
+// Input only: senders write each message, with the time at which it
+// was sent, to the ring and wake the delivery thread, which
+// dispatches it to the user callback or the input queue.
+struct DummyInputData {
+  MidiInApi::MidiQueue ring;
+  std::shared_ptr<DummyPort> port; // the port connected to, if any
+  bool isVirtual;
+  std::thread deliveryThread;
+  std::mutex deliveryMutex;
+  std::condition_variable deliveryReady;
+  bool deliveryRunning;
+  std::atomic<bool> sleeping;      // the delivery thread waits, or is about to
+  std::atomic<unsigned int> overruns;
+  unsigned long long lastTime;     // in nanoseconds
+  MidiInApi :: RtMidiInData *rtMidiIn;
+};
+
+struct DummyOutputData {
+  std::shared_ptr<DummyPort> port; // the port sent to, if any
+  bool isVirtual;
+};
+
+static std::string dummyPortName( const std::string &clientName, const std::string &portName )
+{
+  return clientName + ":" + portName;
+}
+
+// Register a new virtual port.
+static std::shared_ptr<DummyPort> dummyAddPort( std::vector< std::shared_ptr<DummyPort> > &ports,
+                                                const std::string &name )
+{
+  std::shared_ptr<DummyPort> port( new DummyPort );
+  port->name = name;
+  std::lock_guard<std::mutex> lock( dummyPortsMutex );
+  ports.push_back( port );
+  return port;
+}
+
+static void dummyRemovePort( std::vector< std::shared_ptr<DummyPort> > &ports,
+                             const std::shared_ptr<DummyPort> &port )
+{
+  std::lock_guard<std::mutex> lock( dummyPortsMutex );
+  ports.erase( std::remove( ports.begin(), ports.end(), port ), ports.end() );
+}
+
+// Return the registered port of the given number, or none.
+static std::shared_ptr<DummyPort> dummyGetPort( std::vector< std::shared_ptr<DummyPort> > &ports,
+                                                unsigned int portNumber, std::string *name = 0 )
+{
+  std::lock_guard<std::mutex> lock( dummyPortsMutex );
+  if ( portNumber >= ports.size() ) return std::shared_ptr<DummyPort>();
+  if ( name ) *name = ports[portNumber]->name;
+  return ports[portNumber];
+}
+
+static unsigned int dummyCountPorts( const std::vector< std::shared_ptr<DummyPort> > &ports )
+{
+  std::lock_guard<std::mutex> lock( dummyPortsMutex );
+  return (unsigned int) ports.size();
+}
+
+//*********************************************************************//
+//  API: RTMIDI_DUMMY
+//  Class Definitions: MidiInDummy
+//*********************************************************************//
+
+// Called by a sender, with the mutex of the port held.  Like a full
+// device queue, a full ring holds the sender back until the delivery
+// thread has made room, unless the message can never fit or the
+// sender is the delivery thread itself (from a callback).
+//
+// The delivery thread is woken only if it is waiting: it announces
+// that in sleeping before it checks the ring a last time, and the
+// fences order that against the push, so a message can't be left
+// behind.
+static void dummyWrite( DummyInputData *data, const unsigned char *message, unsigned int size,
+                        unsigned long long time )
+{
+  // The messages filtered out by the input never reach its ring.
+  if ( !data->rtMidiIn->filter[message[0]] ) return;
+
+  while ( !data->ring.push( message, size, 0.0, time ) ) {
+    if ( !data->deliveryRunning || ( size > 3 && size > data->ring.arenaSize ) ||
+         std::this_thread::get_id() == data->deliveryThread.get_id() ) {
+      data->overruns.fetch_add( 1, std::memory_order_relaxed );
+      break;
+    }
+    std::this_thread::yield();
+  }
+
+  std::atomic_thread_fence( std::memory_order_seq_cst );
+  if ( data->sleeping.load( std::memory_order_relaxed ) ) {
+    std::lock_guard<std::mutex> lock( data->deliveryMutex );
+    data->sleeping.store( false, std::memory_order_relaxed );
+    data->deliveryReady.notify_one();
+  }
+}
+
+// Dispatch the message just read from the ring into rtMidiIn->message.
+static void dummyDeliver( DummyInputData *data, unsigned long long time )
+{
+  MidiInApi :: RtMidiInData *rtData = data->rtMidiIn;
+  MidiInApi::MidiMessage& message = rtData->message;
+  unsigned int nBytes = (unsigned int) message.bytes.size();
+  if ( nBytes == 0 ) return;
+
+  // Data bytes continue a sysex message sent in parts.
+  unsigned char status = message.bytes[0];
+  bool sysex = ( status == 0xF0 || !( status & 0x80 ) );
+
+  // Compute the delta time.
+  double timeStamp = 0.0;
+  if ( rtData->firstMessage == true )
+    rtData->firstMessage = false;
+  else
+    timeStamp = ( time - data->lastTime ) * 0.000000001;
+  data->lastTime = time;
+  rtData->stats.countMessage( nBytes, time );
+  rtData->route( message.bytes.data(), nBytes );
+
+  RtMidiIn::RtMidiSysexCallback sysexCallback = rtData->sysexCallback.load( std::memory_order_acquire );
+  RtMidiIn::RtMidiRealtimeCallback realtimeCallback = rtData->realtimeCallback;
+  if ( sysexCallback && sysex ) {
+    // Each message is a fragment of its own.
+    sysexCallback( timeStamp, message.bytes.data(), nBytes,
+                   status == 0xF0, message.bytes[nBytes-1] == 0xF7,
+                   rtData->sysexUserData.load( std::memory_order_relaxed ) );
+  }
+  else if ( realtimeCallback ) {
+    message.absoluteTime = time;
+    message.frameTime = 0;
+    unsigned long long start = RtMidi::getCurrentTime();
+    realtimeCallback( timeStamp, message.bytes.data(), nBytes, rtData->userData );
+    rtData->stats.countCallback( start );
+  }
+  else if ( rtData->usingCallback ) {
+    message.timeStamp = timeStamp;
+    message.absoluteTime = time;
+    message.frameTime = 0;
+    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) rtData->userCallback;
+    unsigned long long start = RtMidi::getCurrentTime();
+    callback( message.timeStamp, &message.bytes, rtData->userData );
+    rtData->stats.countCallback( start );
+  }
+  else {
+    // As long as we haven't reached our queue size limit, push the message.
+    if ( !rtData->queue.push( message.bytes.data(), nBytes, timeStamp, time ) )
+      std::cerr << "\nMidiInDummy: message queue limit reached!!\n\n";
+  }
+}
+
+static void dummyDeliveryThread( DummyInputData *data )
+{
+  MidiInApi :: RtMidiInData *rtData = data->rtMidiIn;
+  double timeStamp;
+  unsigned long long time;
+  unsigned int frameTime;
+
+  std::unique_lock<std::mutex> lock( data->deliveryMutex );
+  while ( data->deliveryRunning ) {
+    lock.unlock();
+
+    // Reuse the persistent message vector to avoid reallocating it.
+    while ( data->ring.pop( &rtData->message.bytes, &timeStamp, &time, &frameTime ) ) {
+      rtData->enterCallback();
+      dummyDeliver( data, time );
+      rtData->leaveCallback();
+    }
+
+    unsigned int overruns = data->overruns.exchange( 0, std::memory_order_relaxed );
+    MidiApi::MidiStats::add( rtData->stats.overruns, overruns );
+    if ( overruns )
+      std::cerr << "\nMidiInDummy: input ring overrun, " << overruns << " message(s) lost!!\n\n";
+
+    lock.lock();
+    data->sleeping.store( true, std::memory_order_relaxed );
+    std::atomic_thread_fence( std::memory_order_seq_cst );
+    if ( data->ring.size() == 0 ) {
+      while ( data->sleeping.load( std::memory_order_relaxed ) && data->deliveryRunning )
+        data->deliveryReady.wait( lock );
+    }
+    data->sleeping.store( false, std::memory_order_relaxed );
+  }
+}
+
+MidiInDummy :: MidiInDummy( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize )
+  : MidiInApi( queueSizeLimit, sysexQueueSize )
+{
+  initialize( clientName );
+}
+
+void MidiInDummy :: initialize( const std::string& clientName )
+{
+  DummyInputData *data = new DummyInputData;
+  apiData_ = (void *) data;
+
+  data->rtMidiIn = &inputData_;
+  data->isVirtual = false;
+  data->sleeping = false;
+  data->overruns = 0;
+  data->lastTime = 0;
+  this->clientName = clientName;
+
+  // Sized to hold a full sysex queue's worth of input on top of the
+  // usual burst of short messages.
+  data->ring.allocate( DUMMY_RING_SIZE, DUMMY_ARENA_SIZE + inputData_.queue.arenaSize );
+  data->deliveryRunning = true;
+  try {
+    data->deliveryThread = std::thread( dummyDeliveryThread, data );
+  }
+  catch ( const std::system_error & ) {
+    data->deliveryRunning = false;
+    errorString_ = "MidiInDummy::initialize: error starting MIDI input delivery thread!";
+    error( RtMidiError::THREAD_ERROR, errorString_ );
+  }
+}
+
+MidiInDummy :: ~MidiInDummy()
+{
+  DummyInputData *data = static_cast<DummyInputData *> (apiData_);
+  closePort();
+
+  // Stop the delivery thread once no sender can reach the ring.
+  if ( data->deliveryRunning ) {
+    {
+      std::lock_guard<std::mutex> lock( data->deliveryMutex );
+      data->deliveryRunning = false;
+      data->deliveryReady.notify_one();
+    }
+    data->deliveryThread.join();
+  }
+  delete data;
+}
+
+void MidiInDummy :: applyThreadOptions( void )
+{
+  DummyInputData *data = static_cast<DummyInputData *> (apiData_);
+  if ( !data->deliveryRunning ) return;
+  std::thread::native_handle_type thread = data->deliveryThread.native_handle();
+  scheduleThread( &thread );
+}
+
+void MidiInDummy :: setRealtimeCallback( RtMidiIn::RtMidiRealtimeCallback callback, void *userData )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "MidiInDummy::setRealtimeCallback: a callback function is already set!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( !callback ) {
+    errorString_ = "MidiInDummy::setRealtimeCallback: callback function value is invalid!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  // The delivery thread picks the callback up with the next message.
+  inputData_.userData = userData;
+  inputData_.realtimeCallback = callback;
+  inputData_.usingCallback = true;
+}
+
+void MidiInDummy :: openPort( unsigned int portNumber, const std::string /*portName*/ )
+{
+  if ( connected_ ) {
+    errorString_ = "MidiInDummy::openPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  unsigned int nSrc = dummyCountPorts( dummyOutputPorts );
+  if ( nSrc < 1 ) {
+    errorString_ = "MidiInDummy::openPort: no MIDI input sources found!";
+    error( RtMidiError::NO_DEVICES_FOUND, errorString_ );
+    return;
+  }
+
+  std::shared_ptr<DummyPort> port = dummyGetPort( dummyOutputPorts, portNumber );
+  if ( !port ) {
+    std::ostringstream ost;
+    ost << "MidiInDummy::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::INVALID_PARAMETER, errorString_ );
+    return;
+  }
+
+  DummyInputData *data = static_cast<DummyInputData *> (apiData_);
+  {
+    std::lock_guard<std::mutex> lock( port->mutex );
+    port->inputs.push_back( data );
+  }
+  data->port = port;
+  data->isVirtual = false;
+  connected_ = true;
+}
+
+void MidiInDummy :: openVirtualPort( const std::string portName )
+{
+  if ( connected_ ) {
+    errorString_ = "MidiInDummy::openVirtualPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  DummyInputData *data = static_cast<DummyInputData *> (apiData_);
+  std::shared_ptr<DummyPort> port = dummyAddPort( dummyInputPorts, dummyPortName( clientName, portName ) );
+  {
+    std::lock_guard<std::mutex> lock( port->mutex );
+    port->inputs.push_back( data );
+  }
+  data->port = port;
+  data->isVirtual = true;
+  connected_ = true;
+}
+
+void MidiInDummy :: closePort( void )
+{
+  DummyInputData *data = static_cast<DummyInputData *> (apiData_);
+  if ( !data->port ) return;
+
+  // Messages already in the ring are still delivered.
+  if ( data->isVirtual ) dummyRemovePort( dummyInputPorts, data->port );
+  {
+    std::lock_guard<std::mutex> lock( data->port->mutex );
+    std::vector<DummyInputData *> &inputs = data->port->inputs;
+    inputs.erase( std::remove( inputs.begin(), inputs.end(), data ), inputs.end() );
+  }
+  data->port.reset();
+  data->isVirtual = false;
+  connected_ = false;
+}
+
+unsigned int MidiInDummy :: getPortCount()
+{
+  return dummyCountPorts( dummyOutputPorts );
+}
+
+unsigned int MidiInDummy :: probePortCount()
+{
+  return dummyCountPorts( dummyOutputPorts );
+}
+
+std::string MidiInDummy :: getPortName( unsigned int portNumber )
+{
+  std::string stringName;
+  if ( !dummyGetPort( dummyOutputPorts, portNumber, &stringName ) ) {
+    std::ostringstream ost;
+    ost << "MidiInDummy::getPortName: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::WARNING, errorString_ );
+  }
+  return stringName;
+}
+
+//*********************************************************************//
+//  API: RTMIDI_DUMMY
+//  Class Definitions: MidiOutDummy
+//*********************************************************************//
+
+MidiOutDummy :: MidiOutDummy( const std::string clientName ) : MidiOutApi()
+{
+  initialize( clientName );
+}
+
+void MidiOutDummy :: initialize( const std::string& clientName )
+{
+  DummyOutputData *data = new DummyOutputData;
+  apiData_ = (void *) data;
+
+  data->isVirtual = false;
+  this->clientName = clientName;
+}
+
+MidiOutDummy :: ~MidiOutDummy()
+{
+  DummyOutputData *data = static_cast<DummyOutputData *> (apiData_);
+  closePort();
+  delete data;
+}
+
+void MidiOutDummy :: openPort( unsigned int portNumber, const std::string /*portName*/ )
+{
+  if ( connected_ ) {
+    errorString_ = "MidiOutDummy::openPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  unsigned int nDest = dummyCountPorts( dummyInputPorts );
+  if ( nDest < 1 ) {
+    errorString_ = "MidiOutDummy::openPort: no MIDI output destinations found!";
+    error( RtMidiError::NO_DEVICES_FOUND, errorString_ );
+    return;
+  }
+
+  std::shared_ptr<DummyPort> port = dummyGetPort( dummyInputPorts, portNumber );
+  if ( !port ) {
+    std::ostringstream ost;
+    ost << "MidiOutDummy::openPort: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::INVALID_PARAMETER, errorString_ );
+    return;
+  }
+
+  DummyOutputData *data = static_cast<DummyOutputData *> (apiData_);
+  data->port = port;
+  data->isVirtual = false;
+  connected_ = true;
+}
+
+void MidiOutDummy :: openVirtualPort( const std::string portName )
+{
+  if ( connected_ ) {
+    errorString_ = "MidiOutDummy::openVirtualPort: a valid connection already exists!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  DummyOutputData *data = static_cast<DummyOutputData *> (apiData_);
+  data->port = dummyAddPort( dummyOutputPorts, dummyPortName( clientName, portName ) );
+  data->isVirtual = true;
+  connected_ = true;
+}
+
+void MidiOutDummy :: closePort( void )
+{
+  DummyOutputData *data = static_cast<DummyOutputData *> (apiData_);
+  if ( !data->port ) return;
+
+  // Inputs connected to a virtual port keep it, but receive nothing.
+  if ( data->isVirtual ) dummyRemovePort( dummyOutputPorts, data->port );
+  data->port.reset();
+  data->isVirtual = false;
+  connected_ = false;
+}
+
+unsigned int MidiOutDummy :: getPortCount()
+{
+  return dummyCountPorts( dummyInputPorts );
+}
+
+unsigned int MidiOutDummy :: probePortCount()
+{
+  return dummyCountPorts( dummyInputPorts );
+}
+
+std::string MidiOutDummy :: getPortName( unsigned int portNumber )
+{
+  std::string stringName;
+  if ( !dummyGetPort( dummyInputPorts, portNumber, &stringName ) ) {
+    std::ostringstream ost;
+    ost << "MidiOutDummy::getPortName: the 'portNumber' argument (" << portNumber << ") is invalid.";
+    errorString_ = ost.str();
+    error( RtMidiError::WARNING, errorString_ );
+  }
+  return stringName;
+}
+
+// The message is stamped with the time at which it is sent, and
+// written to the ring of each input on the port.
+void MidiOutDummy :: sendMessage( const unsigned char *message, size_t size )
+{
+  DummyOutputData *data = static_cast<DummyOutputData *> (apiData_);
+  if ( !data->port ) return;
+
+  unsigned int nBytes = static_cast<unsigned int>(size);
+  if ( nBytes == 0 ) {
+    errorString_ = "MidiOutDummy::sendMessage: message argument is empty!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  unsigned long long time = RtMidi::getCurrentTime();
+  std::lock_guard<std::mutex> lock( data->port->mutex );
+  std::vector<DummyInputData *> &inputs = data->port->inputs;
+  for ( size_t i=0; i<inputs.size(); ++i )
+    dummyWrite( inputs[i], message, nBytes, time );
+}
+
+#endif  // __RTMIDI_DUMMY__
@@ -0,0 +1,639 @@
+/**********************************************************************/
+/*! \class RtMidi
+    \brief An abstract base class for realtime MIDI input/output.
+
+    This class implements some common functionality for the realtime
+    MIDI input/output subclasses RtMidiIn and RtMidiOut.
+
+    RtMidi WWW site: http://music.mcgill.ca/~gary/rtmidi/
+
+    RtMidi: realtime MIDI i/o C++ classes
+    Copyright (c) 2003-2016 Gary P. Scavone
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation files
+    (the "Software"), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    Any person wishing to distribute modifications to the Software is
+    asked to send the modifications to the original developer so that
+    they can be incorporated into the canonical version.  This is,
+    however, not a binding provision of this license.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+/**********************************************************************/
+
+
+#include "RtMidi.h"
+#include "RtMidiFile.h"
+#include <chrono>
+#include <string.h>
+
+#if defined(_WIN32)
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
+
+// The tempo of the files recorded, in microseconds per beat (120 BPM).
+const unsigned long RECORDER_TEMPO = 500000;
+
+// The time the writer thread of a recorder sleeps between two passes.
+const unsigned int RECORDER_WRITER_PERIOD = 10; // milliseconds
+
+// The largest batch of events a player hands to the output at once.
+const unsigned int PLAYER_BATCH_SIZE = 1024;
+
+// The shortest time the thread of a player waits between two batches.
+const unsigned long long PLAYER_MIN_PERIOD = 1000000; // nanoseconds
+
+//*********************************************************************//
+//  RtMidiRecorder Definitions
+//*********************************************************************//
+
+RtMidiRecorder :: RtMidiRecorder( unsigned int chunkSize, unsigned int chunkCount )
+  : chunkSize_( chunkSize < 64 ? 64 : chunkSize ), chunkCount_( chunkCount < 2 ? 2 : chunkCount ),
+    chunks_( 0 ), written_( 0 ), flushed_( 0 ), running_( false ), position_( 0 ), file_( 0 ),
+    failed_( false ), trackSize_( 0 ), input_( 0 ), division_( 960 ), startTime_( 0 ), lastTick_( 0 ),
+    messages_( 0 ), drops_( 0 )
+{
+  chunks_ = new unsigned char[(size_t) chunkSize_ * chunkCount_];
+}
+
+RtMidiRecorder :: ~RtMidiRecorder( void ) throw()
+{
+  try {
+    close();
+  }
+  catch ( RtMidiError & ) {
+  }
+  delete [] chunks_;
+}
+
+void RtMidiRecorder :: open( const std::string &path, unsigned short division )
+{
+  if ( file_ ) {
+    std::string errorText = "RtMidiRecorder::open: a file is already open!";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_USE ) );
+  }
+
+  if ( division == 0 || division > 0x7FFF ) {
+    std::string errorText = "RtMidiRecorder::open: the division must be between 1 and 32767 ticks per beat.";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_PARAMETER ) );
+  }
+
+  file_ = fopen( path.c_str(), "wb" );
+  if ( !file_ ) {
+    std::string errorText = "RtMidiRecorder::open: error creating the file " + path + ".";
+    throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  }
+
+  // The header, and the track, whose size is written by close().
+  const unsigned char header[] = { 'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1,
+                                   (unsigned char) ( division >> 8 ), (unsigned char) division,
+                                   'M', 'T', 'r', 'k', 0, 0, 0, 0 };
+  failed_ = fwrite( header, 1, sizeof(header), file_ ) != sizeof(header);
+
+  division_ = division;
+  written_ = 0;
+  flushed_ = 0;
+  position_ = 0;
+  trackSize_ = 0;
+  startTime_ = 0;
+  lastTick_ = 0;
+  messages_ = 0;
+  drops_ = 0;
+
+  const unsigned char tempo[] = { 0x00, 0xFF, 0x51, 0x03, (unsigned char) ( RECORDER_TEMPO >> 16 ),
+                                  (unsigned char) ( RECORDER_TEMPO >> 8 ), (unsigned char) RECORDER_TEMPO };
+  put( tempo, sizeof(tempo) );
+
+  running_ = true;
+  writer_ = std::thread( &RtMidiRecorder::runWriter, this );
+}
+
+void RtMidiRecorder :: inputCallback( double /*timeStamp*/, unsigned long long absoluteTime,
+                                      std::vector<unsigned char> *message, void *userData )
+{
+  RtMidiRecorder *recorder = static_cast<RtMidiRecorder *> (userData);
+  if ( !message->empty() ) recorder->record( message->data(), message->size(), absoluteTime );
+}
+
+void RtMidiRecorder :: attach( RtMidiIn &input )
+{
+  if ( !file_ ) {
+    std::string errorText = "RtMidiRecorder::attach: no file is open!";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_USE ) );
+  }
+
+  input.setTimedCallback( &RtMidiRecorder::inputCallback, this );
+  input_ = &input;
+}
+
+// Messages are stored with their full status byte, so each one stands
+// on its own: sysex messages as 0xF0 events and the other system
+// messages as escaped events, which hold the bytes to send as they are.
+bool RtMidiRecorder :: record( const unsigned char *message, size_t size, unsigned long long absoluteTime )
+{
+  if ( !file_ || size == 0 || !( message[0] & 0x80 ) ) return false;
+
+  if ( absoluteTime == 0 ) absoluteTime = RtMidi::getCurrentTime();
+  if ( startTime_ == 0 ) startTime_ = absoluteTime;
+  unsigned long long tick = 0;
+  if ( absoluteTime > startTime_ )
+    tick = ( absoluteTime - startTime_ ) * division_ / ( RECORDER_TEMPO * 1000ULL );
+  if ( tick < lastTick_ ) tick = lastTick_;
+
+  // Each number takes at most four bytes.  A message that does not fit
+  // in the chunks left is dropped; messages are never split up.
+  unsigned long long free = ( chunkSize_ - position_ ) +
+    (unsigned long long) ( chunkCount_ - 1 - ( written_.load( std::memory_order_relaxed ) -
+                                               flushed_.load( std::memory_order_acquire ) ) ) * chunkSize_;
+  if ( size + 9 > free || size > 0x0FFFFFFF ) {
+    drops_.store( drops_.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+    return false;
+  }
+
+  unsigned long long delta = tick - lastTick_;
+  putNumber( delta > 0x0FFFFFFF ? 0x0FFFFFFF : (unsigned long) delta );
+  lastTick_ = tick;
+
+  unsigned char status = message[0];
+  if ( status < 0xF0 )
+    put( message, (unsigned int) size );
+  else if ( status == 0xF0 ) {
+    put( message, 1 );
+    putNumber( (unsigned long) size - 1 );
+    put( message + 1, (unsigned int) size - 1 );
+  }
+  else {
+    const unsigned char escape = 0xF7;
+    put( &escape, 1 );
+    putNumber( (unsigned long) size );
+    put( message, (unsigned int) size );
+  }
+
+  messages_.store( messages_.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+  return true;
+}
+
+// Append bytes to the chunks, handing each chunk filled to the writer.
+// The caller has checked that they fit.
+void RtMidiRecorder :: put( const unsigned char *bytes, unsigned int size )
+{
+  while ( size > 0 ) {
+    unsigned int chunk = written_.load( std::memory_order_relaxed ) % chunkCount_;
+    unsigned int n = chunkSize_ - position_;
+    if ( n > size ) n = size;
+    memcpy( chunks_ + (size_t) chunk * chunkSize_ + position_, bytes, n );
+    position_ += n;
+    bytes += n;
+    size -= n;
+    if ( position_ == chunkSize_ ) {
+      position_ = 0;
+      written_.store( written_.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+  }
+}
+
+// Append a variable-length number, of up to 28 bits.
+void RtMidiRecorder :: putNumber( unsigned long value )
+{
+  unsigned char bytes[4];
+  unsigned int n = 0;
+  bytes[3] = value & 0x7F;
+  while ( ( value >>= 7 ) && n < 3 ) bytes[2 - n++] = 0x80 | ( value & 0x7F );
+  put( &bytes[3 - n], n + 1 );
+}
+
+// Write the chunks filled since the last call, then \e lastSize bytes
+// of the next one, and return false if a write failed.
+bool RtMidiRecorder :: writeChunks( unsigned int count, unsigned int lastSize )
+{
+  unsigned int flushed = flushed_.load( std::memory_order_relaxed );
+  for ( unsigned int i=0; i<=count; ++i ) {
+    unsigned int size = i < count ? chunkSize_ : lastSize;
+    if ( size == 0 ) break;
+    const unsigned char *chunk = chunks_ + (size_t) ( ( flushed + i ) % chunkCount_ ) * chunkSize_;
+    if ( fwrite( chunk, 1, size, file_ ) != size ) return false;
+    trackSize_ += size;
+    if ( i < count ) flushed_.store( flushed + i + 1, std::memory_order_release );
+  }
+  return true;
+}
+
+void RtMidiRecorder :: runWriter( void )
+{
+  while ( running_.load( std::memory_order_acquire ) ) {
+    unsigned int count = written_.load( std::memory_order_acquire ) - flushed_.load( std::memory_order_relaxed );
+    if ( count > 0 && !writeChunks( count, 0 ) ) failed_ = true;
+    std::this_thread::sleep_for( std::chrono::milliseconds( RECORDER_WRITER_PERIOD ) );
+  }
+}
+
+void RtMidiRecorder :: close( void )
+{
+  if ( !file_ ) return;
+
+  // Once the callback is cancelled, which waits for a call in
+  // progress, nothing writes to the chunks any more.
+  if ( input_ ) {
+    input_->cancelCallback();
+    input_ = 0;
+  }
+
+  running_ = false;
+  writer_.join();
+
+  // What is left, the end of the track, and then its size.
+  unsigned int count = written_.load() - flushed_.load();
+  if ( !writeChunks( count, position_ ) ) failed_ = true;
+  const unsigned char end[] = { 0x00, 0xFF, 0x2F, 0x00 };
+  if ( fwrite( end, 1, sizeof(end), file_ ) != sizeof(end) ) failed_ = true;
+  trackSize_ += sizeof(end);
+
+  const unsigned char size[] = { (unsigned char) ( trackSize_ >> 24 ), (unsigned char) ( trackSize_ >> 16 ),
+                                 (unsigned char) ( trackSize_ >> 8 ), (unsigned char) trackSize_ };
+  if ( fseek( file_, 18, SEEK_SET ) != 0 || fwrite( size, 1, sizeof(size), file_ ) != sizeof(size) )
+    failed_ = true;
+  if ( fclose( file_ ) != 0 ) failed_ = true;
+  file_ = 0;
+
+  if ( failed_ ) {
+    std::string errorText = "RtMidiRecorder::close: error writing the file, which is incomplete.";
+    throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  }
+}
+
+//*********************************************************************//
+//  RtMidiPlayer Definitions
+//*********************************************************************//
+
+// Read a variable-length number of up to four bytes from \e p.
+static bool readNumber( const unsigned char *&p, const unsigned char *end, unsigned long *value )
+{
+  *value = 0;
+  for ( unsigned int i=0; i<4 && p < end; ++i ) {
+    unsigned char byte = *p++;
+    *value = ( *value << 7 ) | ( byte & 0x7F );
+    if ( !( byte & 0x80 ) ) return true;
+  }
+  return false;
+}
+
+static unsigned long readLong( const unsigned char *p )
+{
+  return ( (unsigned long) p[0] << 24 ) | ( (unsigned long) p[1] << 16 ) | ( p[2] << 8 ) | p[3];
+}
+
+RtMidiPlayer :: RtMidiPlayer( void )
+  : file_( 0 ), fileSize_( 0 ), handle_( 0 ), division_( 0 ), startTickTime_( 0.0 ), tickTime_( 0.0 ),
+    time_( 0.0 ), tick_( 0 ), duration_( 0.0 ), output_( 0 ), lookahead_( 0.0 ), playing_( false ),
+    stopping_( false )
+{
+}
+
+RtMidiPlayer :: ~RtMidiPlayer( void ) throw()
+{
+  close();
+}
+
+void RtMidiPlayer :: open( const std::string &path )
+{
+  if ( file_ ) {
+    std::string errorText = "RtMidiPlayer::open: a file is already open!";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_USE ) );
+  }
+
+  std::string errorText = "RtMidiPlayer::open: error mapping the file " + path + " into memory.";
+#if defined(_WIN32)
+  HANDLE file = CreateFileA( path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                             FILE_ATTRIBUTE_NORMAL, NULL );
+  if ( file == INVALID_HANDLE_VALUE ) throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  LARGE_INTEGER size;
+  HANDLE mapping = NULL;
+  if ( GetFileSizeEx( file, &size ) && size.QuadPart > 0 )
+    mapping = CreateFileMappingA( file, NULL, PAGE_READONLY, 0, 0, NULL );
+  CloseHandle( file );
+  if ( mapping == NULL ) throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  void *data = MapViewOfFile( mapping, FILE_MAP_READ, 0, 0, 0 );
+  if ( data == NULL ) {
+    CloseHandle( mapping );
+    throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  }
+  handle_ = (void *) mapping;
+  fileSize_ = (size_t) size.QuadPart;
+#else
+  int fd = ::open( path.c_str(), O_RDONLY );
+  if ( fd < 0 ) throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  struct stat info;
+  void *data = MAP_FAILED;
+  if ( fstat( fd, &info ) == 0 && info.st_size > 0 )
+    data = mmap( NULL, (size_t) info.st_size, PROT_READ, MAP_PRIVATE, fd, 0 );
+  ::close( fd );
+  if ( data == MAP_FAILED ) throw( RtMidiError( errorText, RtMidiError::SYSTEM_ERROR ) );
+  fileSize_ = (size_t) info.st_size;
+#endif
+  file_ = data;
+
+  // The header, then the tracks among the chunks that follow it.
+  const unsigned char *bytes = static_cast<const unsigned char *> (file_);
+  const unsigned char *end = bytes + fileSize_;
+  unsigned long headerSize = fileSize_ >= 14 ? readLong( bytes + 4 ) : 0;
+  if ( fileSize_ < 14 || memcmp( bytes, "MThd", 4 ) != 0 || headerSize < 6 || headerSize > fileSize_ - 8 ) {
+    close();
+    errorText = "RtMidiPlayer::open: " + path + " is not a Standard MIDI File.";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_PARAMETER ) );
+  }
+
+  unsigned int format = ( bytes[8] << 8 ) | bytes[9];
+  unsigned int trackCount = ( bytes[10] << 8 ) | bytes[11];
+  division_ = (unsigned short) ( ( bytes[12] << 8 ) | bytes[13] );
+  if ( format > 1 || division_ == 0 ) {
+    close();
+    errorText = "RtMidiPlayer::open: only Standard MIDI Files of format 0 and 1 are supported.";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_PARAMETER ) );
+  }
+
+  if ( division_ & 0x8000 ) {
+    // SMPTE frames per second and ticks per frame; 29 stands for 29.97.
+    int frames = 256 - ( division_ >> 8 );
+    if ( ( frames != 24 && frames != 25 && frames != 29 && frames != 30 ) || ( division_ & 0xFF ) == 0 ) {
+      close();
+      errorText = "RtMidiPlayer::open: " + path + " is not a Standard MIDI File.";
+      throw( RtMidiError( errorText, RtMidiError::INVALID_PARAMETER ) );
+    }
+    startTickTime_ = 1.0 / ( ( frames == 29 ? 29.97 : frames ) * ( division_ & 0xFF ) );
+  }
+  else
+    startTickTime_ = RECORDER_TEMPO * 0.000001 / division_;
+
+  start_.clear();
+  const unsigned char *chunk = bytes + 8 + headerSize;
+  while ( end - chunk >= 8 && start_.size() < trackCount ) {
+    unsigned long size = readLong( chunk + 4 );
+    const unsigned char *next = chunk + 8 + ( size < (unsigned long) ( end - chunk - 8 ) ? size : end - chunk - 8 );
+    if ( memcmp( chunk, "MTrk", 4 ) == 0 ) {
+      Track track;
+      track.position = chunk + 8;
+      track.end = next;
+      track.runningStatus = 0;
+      unsigned long delta = 0;
+      if ( !readNumber( track.position, track.end, &delta ) ) track.position = track.end;
+      track.tick = delta;
+      start_.push_back( track );
+    }
+    chunk = next;
+  }
+
+  // A first pass finds the duration.
+  rewind();
+  double time = 0.0;
+  while ( nextEvent( &time ) ) data_.clear();
+  duration_ = time_;
+}
+
+void RtMidiPlayer :: close( void )
+{
+  stop();
+  if ( !file_ ) return;
+
+#if defined(_WIN32)
+  UnmapViewOfFile( file_ );
+  CloseHandle( (HANDLE) handle_ );
+  handle_ = 0;
+#else
+  munmap( file_, fileSize_ );
+#endif
+  file_ = 0;
+  fileSize_ = 0;
+  start_.clear();
+  tracks_.clear();
+  duration_ = 0.0;
+}
+
+void RtMidiPlayer :: rewind( void )
+{
+  tracks_ = start_;
+  tickTime_ = startTickTime_;
+  time_ = 0.0;
+  tick_ = 0;
+}
+
+// Merge the tracks: take the event of the track that comes first, and
+// append the bytes of the message it holds to data_.  Meta events are
+// read for the tempo and skipped.  A track that is cut short or
+// malformed ends at the event in error.
+bool RtMidiPlayer :: nextEvent( double *time )
+{
+  for (;;) {
+    Track *track = 0;
+    for ( size_t i=0; i<tracks_.size(); ++i ) {
+      if ( tracks_[i].position < tracks_[i].end && ( !track || tracks_[i].tick < track->tick ) )
+        track = &tracks_[i];
+    }
+    if ( !track ) return false;
+
+    time_ += ( track->tick - tick_ ) * tickTime_;
+    tick_ = track->tick;
+
+    const unsigned char *p = track->position;
+    const unsigned char *end = track->end;
+    unsigned char status = *p;
+    if ( status & 0x80 ) ++p;
+    else status = track->runningStatus;
+
+    bool valid = true;
+    bool found = false;
+    unsigned long length = 0;
+    if ( status >= 0x80 && status < 0xF0 ) {
+      length = MidiInApi::MidiParser::lengths[status] - 1;
+      valid = (unsigned long) ( end - p ) >= length;
+      if ( valid ) {
+        data_.push_back( status );
+        data_.insert( data_.end(), p, p + length );
+        track->runningStatus = status;
+        found = true;
+      }
+    }
+    else if ( status == 0xF0 || status == 0xF7 ) {
+      // Sysex and escaped events, which cancel running status.
+      valid = readNumber( p, end, &length ) && (unsigned long) ( end - p ) >= length;
+      if ( valid ) {
+        if ( status == 0xF0 ) data_.push_back( 0xF0 );
+        data_.insert( data_.end(), p, p + length );
+        track->runningStatus = 0;
+        found = status == 0xF0 || length > 0;
+      }
+    }
+    else if ( status == 0xFF && p < end ) {
+      unsigned char type = *p++;
+      valid = readNumber( p, end, &length ) && (unsigned long) ( end - p ) >= length;
+      if ( valid && type == 0x51 && length == 3 && !( division_ & 0x8000 ) )
+        tickTime_ = ( ( p[0] << 16 ) | ( p[1] << 8 ) | p[2] ) * 0.000001 / division_;
+      if ( valid && type == 0x2F ) valid = false; // the end of the track
+      track->runningStatus = 0;
+    }
+    else valid = false;
+
+    if ( !valid ) {
+      track->position = end;
+      continue;
+    }
+
+    // Read the delta time of the next event.
+    p += length;
+    unsigned long delta = 0;
+    if ( p < end && !readNumber( p, end, &delta ) ) p = end;
+    track->position = p;
+    track->tick += delta;
+    if ( found ) {
+      *time = time_;
+      return true;
+    }
+  }
+}
+
+void RtMidiPlayer :: start( RtMidiOut &output, double lookahead )
+{
+  if ( !file_ ) {
+    std::string errorText = "RtMidiPlayer::start: no file is open!";
+    throw( RtMidiError( errorText, RtMidiError::INVALID_USE ) );
+  }
+
+  stop();
+  output_ = &output;
+  lookahead_ = lookahead > 0.0 ? lookahead : 0.0;
+  data_.reserve( 65536 );
+  offsets_.reserve( PLAYER_BATCH_SIZE + 1 );
+  times_.reserve( PLAYER_BATCH_SIZE );
+  stopping_ = false;
+  playing_ = true;
+  player_ = std::thread( &RtMidiPlayer::runPlayer, this );
+}
+
+void RtMidiPlayer :: stop( void )
+{
+  if ( !player_.joinable() ) return;
+
+  {
+    std::lock_guard<std::mutex> lock( mutex_ );
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  player_.join();
+}
+
+// Wait until the given time on the clock of RtMidi::getCurrentTime(),
+// and return false if stop() was called meanwhile.
+bool RtMidiPlayer :: wait( unsigned long long until )
+{
+  std::unique_lock<std::mutex> lock( mutex_ );
+  for (;;) {
+    if ( stopping_ ) return false;
+    unsigned long long now = RtMidi::getCurrentTime();
+    if ( now >= until ) return true;
+    wake_.wait_for( lock, std::chrono::nanoseconds( until - now ) );
+  }
+}
+
+// The events are read into data_ as the output will take them: the
+// message bytes of the batch one after the other, at offsets_, with
+// their time from the start in times_.
+void RtMidiPlayer :: runPlayer( void )
+{
+  RtMidi::Api api = output_->getCurrentApi();
+  bool scheduling = ( api == RtMidi::LINUX_ALSA || api == RtMidi::MACOSX_CORE || api == RtMidi::UNIX_JACK );
+  unsigned long long startTime = RtMidi::getCurrentTime();
+  unsigned long long period = (unsigned long long) ( lookahead_ * 500000000.0 );
+  if ( period < PLAYER_MIN_PERIOD ) period = PLAYER_MIN_PERIOD;
+  double scheduled = 0.0; // the time of the last event handed to the output
+
+  rewind();
+  data_.clear();
+  offsets_.assign( 1, 0 );
+  times_.clear();
+  double next = 0.0;
+  bool more = nextEvent( &next );
+  bool stopped = false;
+
+  while ( more ) {
+    if ( !scheduling ) {
+      // Send each message at its time.
+      if ( !wait( startTime + (unsigned long long) ( next * 1000000000.0 ) ) ) {
+        stopped = true;
+        break;
+      }
+      output_->sendMessage( data_.data(), data_.size() );
+      data_.clear();
+      more = nextEvent( &next );
+      continue;
+    }
+
+    double elapsed = ( RtMidi::getCurrentTime() - startTime ) * 0.000000001;
+    while ( more && next < elapsed + lookahead_ && times_.size() < PLAYER_BATCH_SIZE ) {
+      times_.push_back( next > elapsed ? next - elapsed : 0.0 );
+      offsets_.push_back( data_.size() );
+      scheduled = next;
+      more = nextEvent( &next );
+    }
+
+    unsigned int count = (unsigned int) times_.size();
+    if ( count > 0 ) {
+      output_->scheduleMessages( times_.data(), offsets_.data(), data_.data(), count, false );
+
+      // The bytes of the next event, already read, move to the front.
+      data_.erase( data_.begin(), data_.begin() + offsets_[count] );
+      offsets_.assign( 1, 0 );
+      times_.clear();
+      if ( count == PLAYER_BATCH_SIZE ) continue;
+    }
+
+    if ( !wait( RtMidi::getCurrentTime() + period ) ) {
+      stopped = true;
+      break;
+    }
+  }
+
+  unsigned long long endTime = startTime + (unsigned long long) ( scheduled * 1000000000.0 );
+  if ( stopped ) {
+    // All notes off, after the messages already scheduled.
+    const unsigned int channels = 16;
+    double elapsed = ( RtMidi::getCurrentTime() - startTime ) * 0.000000001;
+    data_.clear();
+    offsets_.assign( 1, 0 );
+    times_.clear();
+    for ( unsigned int i=0; i<channels; ++i ) {
+      const unsigned char message[3] = { (unsigned char) ( 0xB0 | i ), 123, 0 };
+      data_.insert( data_.end(), message, message + 3 );
+      offsets_.push_back( data_.size() );
+      times_.push_back( scheduled > elapsed ? scheduled - elapsed : 0.0 );
+    }
+    if ( scheduling )
+      output_->scheduleMessages( times_.data(), offsets_.data(), data_.data(), channels, false );
+    else
+      output_->sendMessages( offsets_.data(), data_.data(), channels );
+  }
+  else {
+    // Play on until the last messages scheduled have been sent.
+    wait( endTime );
+  }
+
+  playing_ = false;
+}
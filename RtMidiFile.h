@@ -0,0 +1,254 @@
+/**********************************************************************/
+/*! \class RtMidi
+    \brief An abstract base class for realtime MIDI input/output.
+
+    This class implements some common functionality for the realtime
+    MIDI input/output subclasses RtMidiIn and RtMidiOut.
+
+    RtMidi WWW site: http://music.mcgill.ca/~gary/rtmidi/
+
+    RtMidi: realtime MIDI i/o C++ classes
+    Copyright (c) 2003-2016 Gary P. Scavone
+
+    Permission is hereby granted, free of charge, to any person
+    obtaining a copy of this software and associated documentation files
+    (the "Software"), to deal in the Software without restriction,
+    including without limitation the rights to use, copy, modify, merge,
+    publish, distribute, sublicense, and/or sell copies of the Software,
+    and to permit persons to whom the Software is furnished to do so,
+    subject to the following conditions:
+
+    The above copyright notice and this permission notice shall be
+    included in all copies or substantial portions of the Software.
+
+    Any person wishing to distribute modifications to the Software is
+    asked to send the modifications to the original developer so that
+    they can be incorporated into the canonical version.  This is,
+    however, not a binding provision of this license.
+
+    THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+    EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+    MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+    IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR
+    ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION OF
+    CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+    WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+*/
+/**********************************************************************/
+
+/*!
+  \file RtMidiFile.h
+ */
+
+#ifndef RTMIDI_FILE_H
+#define RTMIDI_FILE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "RtMidi.h"
+
+/************************************************************************/
+/*! \class RtMidiRecorder
+    \brief A recorder of MIDI input to a Standard MIDI File.
+
+    The recorder writes a format 0 file, with a tempo of 120 beats per
+    minute and \e division ticks per beat.  Messages are encoded into
+    a fixed set of chunks allocated up front, and a thread of the
+    recorder writes the full chunks to the file, so recording takes no
+    allocation, no lock and no system call per message and its memory
+    is bounded however long the session.  When the writer falls behind
+    and every chunk is full, messages are dropped and counted.  Their
+    time is kept, so the timing of later messages is not affected.
+
+    Each message is placed by its absolute time (see
+    RtMidiIn::setTimedCallback()), or by the time it is recorded if
+    the API does not provide one.  Realtime and system common messages
+    are stored as escaped (0xF7) events.
+*/
+/************************************************************************/
+
+class RtMidiRecorder
+{
+ public:
+
+  //! The constructor, which allocates \e chunkCount chunks of \e chunkSize bytes.
+  RtMidiRecorder( unsigned int chunkSize = 65536, unsigned int chunkCount = 16 );
+
+  //! The destructor, which closes the file.
+  ~RtMidiRecorder( void ) throw();
+
+  //! Create the file at \e path, or truncate it, and start recording.
+  /*!
+    The time of the first message recorded is the start of the file.
+    An exception is thrown if the file cannot be created, or if one
+    is already open.
+  */
+  void open( const std::string &path, unsigned short division = 960 );
+
+  //! Record the messages of \e input until close(), through a timed callback set on it.
+  /*!
+    The input must not have a callback set already.  The callback is
+    cancelled by close().
+  */
+  void attach( RtMidiIn &input );
+
+  //! Record a message of \e size bytes, received at \e absoluteTime nanoseconds on the clock of RtMidi::getCurrentTime().
+  /*!
+    A zero \e absoluteTime stands for the time of the call.  This is
+    for messages received by a callback of the caller and must not be
+    called from several threads at once, nor along with attach() or
+    close(), so the caller's callback must be stopped before the
+    recorder is closed.  It returns false if the message was dropped.
+  */
+  bool record( const unsigned char *message, size_t size, unsigned long long absoluteTime = 0 );
+
+  //! Stop recording and close the file, after writing the messages recorded.
+  /*!
+    The callback set by attach() is cancelled first, once any call in
+    progress has returned, so close() must not be called from a
+    callback of the input.  An exception is thrown if the file could
+    not be written.
+  */
+  void close( void );
+
+  //! Returns true if a file is open.
+  bool isOpen( void ) const { return file_ != 0; }
+
+  //! Return the number of messages recorded since open().
+  unsigned long long getMessageCount( void ) const { return messages_.load( std::memory_order_relaxed ); }
+
+  //! Return the number of messages dropped since open() because every chunk was full.
+  unsigned long long getDrops( void ) const { return drops_.load( std::memory_order_relaxed ); }
+
+ protected:
+  static void inputCallback( double timeStamp, unsigned long long absoluteTime,
+                             std::vector<unsigned char> *message, void *userData );
+  void put( const unsigned char *bytes, unsigned int size );
+  void putNumber( unsigned long value );
+  void runWriter( void );
+  bool writeChunks( unsigned int count, unsigned int lastSize );
+
+  unsigned int chunkSize_;
+  unsigned int chunkCount_;
+  unsigned char *chunks_;
+  std::atomic<unsigned int> written_;   // chunks filled, written only by the recording thread
+  std::atomic<unsigned int> flushed_;   // chunks written to the file, written only by the writer
+  std::atomic<bool> running_;           // the writer goes on
+  unsigned int position_;               // in the chunk being filled
+  std::thread writer_;
+  FILE *file_;
+  bool failed_;                         // a write to the file failed
+  unsigned long trackSize_;
+  RtMidiIn *input_;
+  unsigned short division_;
+  unsigned long long startTime_;        // of the first message recorded, 0 before it
+  unsigned long long lastTick_;
+  std::atomic<unsigned long long> messages_;  // written only by the recording thread
+  std::atomic<unsigned long long> drops_;
+};
+
+/************************************************************************/
+/*! \class RtMidiPlayer
+    \brief A player of Standard MIDI Files to an RtMidiOut.
+
+    The file is mapped into memory and its tracks are merged as they
+    are played, so a file of any length is played without being loaded
+    or converted.  Files of format 0 and 1 are supported, with tempo
+    changes and SMPTE time divisions.
+
+    A thread of the player reads the events due within a lookahead
+    time and hands them to RtMidiOut::scheduleMessages(), which has
+    them sent on time by the system: the sequencer queue with ALSA,
+    packet time stamps with CoreMIDI and frame offsets with JACK.  The
+    other APIs cannot schedule messages, so the thread then sends each
+    one at its time.  The output must not be used by other threads
+    while playing.
+*/
+/************************************************************************/
+
+class RtMidiPlayer
+{
+ public:
+
+  //! The constructor.
+  RtMidiPlayer( void );
+
+  //! The destructor, which stops playing and closes the file.
+  ~RtMidiPlayer( void ) throw();
+
+  //! Map the Standard MIDI File at \e path into memory.
+  /*!
+    An exception is thrown if the file cannot be read or is not a
+    Standard MIDI File of format 0 or 1.
+  */
+  void open( const std::string &path );
+
+  //! Stop playing and close the file.
+  void close( void );
+
+  //! Returns true if a file is open.
+  bool isOpen( void ) const { return file_ != 0; }
+
+  //! Return the time of the last event of the file, in seconds.
+  double getDuration( void ) const { return duration_; }
+
+  //! Start playing the file from its beginning to \e output, scheduling the events \e lookahead seconds ahead.
+  /*!
+    The function returns at once.  A longer lookahead is less
+    sensitive to the scheduling of the thread but makes stop() take
+    effect later, since the messages already handed to the system are
+    still sent.
+  */
+  void start( RtMidiOut &output, double lookahead = 0.2 );
+
+  //! Stop playing, and turn off the notes of all channels once the messages already scheduled have been sent.
+  void stop( void );
+
+  //! Returns true while the file is being played.
+  bool isPlaying( void ) const { return playing_; }
+
+ protected:
+  // A track of the file, and the position of the player in it.  The
+  // delta time of the event at the position has been read already.
+  struct Track {
+    const unsigned char *position;
+    const unsigned char *end;
+    unsigned long long tick;         // of the event at the position
+    unsigned char runningStatus;
+  };
+
+  void rewind( void );
+  bool nextEvent( double *time );
+  bool wait( unsigned long long until );
+  void runPlayer( void );
+
+  void *file_;                       // the mapping of the file
+  size_t fileSize_;
+  void *handle_;                     // of the mapping (Windows)
+  std::vector<Track> tracks_;
+  std::vector<Track> start_;         // the tracks at the beginning of the file
+  unsigned short division_;
+  double startTickTime_;             // seconds per tick at the beginning
+  double tickTime_;                  // and at the current tempo
+  double time_;                      // of the last tick passed
+  unsigned long long tick_;
+  double duration_;
+  RtMidiOut *output_;
+  double lookahead_;
+  std::atomic<bool> playing_;
+  std::atomic<bool> stopping_;
+  std::mutex mutex_;                 // with wake_, ends the waits of the thread at stop()
+  std::condition_variable wake_;
+  std::thread player_;
+  std::vector<unsigned char> data_;  // the batch being scheduled
+  std::vector<size_t> offsets_;
+  std::vector<double> times_;
+};
+
+#endif
@@ -54,29 +54,203 @@
 #include <jack/jack.h>
 #include <jack/midiport.h>
 #include <jack/ringbuffer.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
 
-#define JACK_RINGBUFFER_SIZE 16384 // Default size for ringbuffer
+#define JACK_RINGBUFFER_SIZE 16384 // Default size for input ringbuffer
+
+struct JackContextData;
 
 struct JackMidiData {
   jack_client_t *client;
   jack_port_t *port;
-  jack_ringbuffer_t *buffSize;
-  jack_ringbuffer_t *buffMessage;
-  jack_time_t lastTime;
+  jack_ringbuffer_t *buffOut;  // output only
+  std::atomic<unsigned int> outputDrops;      // messages that didn't fit in buffOut
+  std::atomic<unsigned int> outputOverflows;  // messages larger than the port buffer
+  unsigned long long lastTime; // in nanoseconds
+  long long clockOffset; // from the JACK clock to that of RtMidi::getCurrentTime()
   MidiInApi :: RtMidiInData *rtMidiIn;
+
+  // Input only: the process thread copies incoming events to buffIn
+  // and wakes the delivery thread, which dispatches them to the user
+  // callback or the input queue.
+  jack_ringbuffer_t *buffIn;
+  pthread_t deliveryThread;
+  pthread_mutex_t deliveryMutex;
+  pthread_cond_t deliveryReady;
+  bool deliveryRunning;
+  bool wakePending;  // used only by the process thread
+  std::atomic<unsigned int> inputOverruns;
+
+  JackContextData *context; // the RtMidiContext client in use, if any
   };
 
+// The client of an RtMidiContext, shared by the MidiInJack and
+// MidiOutJack instances attached to it.  Its process callback runs
+// that of every instance.  The lists of instances are replaced rather
+// than modified, so the process thread takes no lock to read them.
+struct JackContextData {
+  jack_client_t *client;
+  std::atomic<std::vector<JackMidiData *> *> inputs;
+  std::atomic<std::vector<JackMidiData *> *> outputs;
+  std::atomic<unsigned int> cyclesStarted;
+  std::atomic<unsigned int> cyclesDone;
+  pthread_mutex_t mutex; // serializes updates of the lists
+};
+
+// The record written to buffIn ahead of each incoming message.
+struct JackInputHeader {
+  unsigned long long time;
+  unsigned int frame;
+  unsigned int size;
+  bool delivered;  // to a realtime callback, so the message is only routed
+};
+
+// The record written to buffOut ahead of each queued output
+// message: its length and the jack_get_time() at which it is due, or
+// zero to have it sent in the next period.
+struct JackMessageHeader {
+  int size;
+  jack_time_t time;
+};
+
+// Copy into the (possibly split) write space of a ringbuffer,
+// starting at the given offset.
+static void jackCopyToVector( jack_ringbuffer_data_t *vec, size_t offset, const char *src, size_t size )
+{
+  if ( offset < vec[0].len ) {
+    size_t n = vec[0].len - offset;
+    if ( n > size ) n = size;
+    memcpy( vec[0].buf + offset, src, n );
+    src += n;
+    size -= n;
+    offset = vec[0].len;
+  }
+  if ( size ) memcpy( vec[1].buf + offset - vec[0].len, src, size );
+}
+
+// Queue one message for the output process thread.  The header and
+// bytes are published together by a single write_advance, so the
+// process thread never sees a partial record.  Returns false, writing
+// nothing, if the message doesn't fit.
+static bool jackQueueMessage( jack_ringbuffer_t *ring, const unsigned char *bytes, size_t size, jack_time_t time )
+{
+  JackMessageHeader header;
+  header.size = (int) size;
+  header.time = time;
+
+  jack_ringbuffer_data_t vec[2];
+  jack_ringbuffer_get_write_vector( ring, vec );
+  if ( vec[0].len + vec[1].len < sizeof(header) + size ) return false;
+
+  jackCopyToVector( vec, 0, (const char *) &header, sizeof(header) );
+  jackCopyToVector( vec, sizeof(header), (const char *) bytes, size );
+  jack_ringbuffer_write_advance( ring, sizeof(header) + size );
+  return true;
+}
+
+//*********************************************************************//
+//  API: JACK
+//  Class Definitions: MidiContextJack
+//*********************************************************************//
+
+static int jackProcessIn( jack_nframes_t nframes, void *arg );
+static int jackProcessOut( jack_nframes_t nframes, void *arg );
+
+// Jack process callback of a context.
+static int jackProcessContext( jack_nframes_t nframes, void *arg )
+{
+  JackContextData *context = (JackContextData *) arg;
+  context->cyclesStarted.fetch_add( 1 );
+
+  std::vector<JackMidiData *> *inputs = context->inputs.load();
+  for ( unsigned int i=0; i<inputs->size(); i++ )
+    jackProcessIn( nframes, (*inputs)[i] );
+  std::vector<JackMidiData *> *outputs = context->outputs.load();
+  for ( unsigned int i=0; i<outputs->size(); i++ )
+    jackProcessOut( nframes, (*outputs)[i] );
+
+  context->cyclesDone.fetch_add( 1 );
+  return 0;
+}
+
+// Add an instance to, or remove it from, a list of the context.  The
+// previous list is freed once every period that may still be running
+// it has ended, after which a removed instance is no longer touched by
+// the process thread.
+static void jackContextUpdate( JackContextData *context, std::atomic<std::vector<JackMidiData *> *> &list,
+                               JackMidiData *data, bool add )
+{
+  pthread_mutex_lock( &context->mutex );
+  std::vector<JackMidiData *> *previous = list.load();
+  std::vector<JackMidiData *> *current = new std::vector<JackMidiData *>( *previous );
+  if ( add )
+    current->push_back( data );
+  else
+    current->erase( std::remove( current->begin(), current->end(), data ), current->end() );
+  list.store( current );
+
+  // A cycle that does not end within a second, because the server
+  // stopped or a realtime callback is waiting for this thread, may
+  // still be reading the previous list, which is then left allocated.
+  unsigned int started = context->cyclesStarted.load();
+  for ( int i=0; i<1000 && (int) ( context->cyclesDone.load() - started ) < 0; ++i )
+    usleep( 1000 );
+  if ( (int) ( context->cyclesDone.load() - started ) >= 0 )
+    delete previous;
+  pthread_mutex_unlock( &context->mutex );
+}
+
+MidiContextJack :: MidiContextJack( const std::string clientName ) : MidiContextApi()
+{
+  jack_client_t *client = jack_client_open( clientName.c_str(), JackNoStartServer, NULL );
+  if ( client == NULL ) {
+    std::string errorText = "MidiContextJack: JACK server not running?";
+    throw( RtMidiError( errorText, RtMidiError::DRIVER_ERROR ) );
+  }
+
+  JackContextData *context = new JackContextData;
+  context->client = client;
+  context->inputs = new std::vector<JackMidiData *>;
+  context->outputs = new std::vector<JackMidiData *>;
+  context->cyclesStarted = 0;
+  context->cyclesDone = 0;
+  pthread_mutex_init( &context->mutex, NULL );
+  apiData_ = (void *) context;
+
+  jack_set_process_callback( client, jackProcessContext, context );
+  jack_activate( client );
+}
+
+MidiContextJack :: ~MidiContextJack()
+{
+  JackContextData *context = static_cast<JackContextData *> (apiData_);
+  jack_client_close( context->client );
+  delete context->inputs.load();
+  delete context->outputs.load();
+  pthread_mutex_destroy( &context->mutex );
+  delete context;
+}
+
 //*********************************************************************//
 //  API: JACK
 //  Class Definitions: MidiInJack
 //*********************************************************************//
 
+// Jack process callback.  Nothing here allocates, locks or prints:
+// events are copied to the input ringbuffer for the delivery thread,
+// or handed straight to a realtime callback.  Routes may lock and
+// make system calls, so they are run by the delivery thread, which
+// also receives the events delivered here when a route is set.
 static int jackProcessIn( jack_nframes_t nframes, void *arg )
 {
   JackMidiData *jData = (JackMidiData *) arg;
   MidiInApi :: RtMidiInData *rtData = jData->rtMidiIn;
   jack_midi_event_t event;
-  jack_time_t time;
+  JackInputHeader header;
+  bool wake = jData->wakePending;
 
   // Is port created?
   if ( jData->port == NULL ) return 0;
@@ -84,48 +258,163 @@ static int jackProcessIn( jack_nframes_t nframes, void *arg )
 
   // We have midi events in buffer
   int evCount = jack_midi_get_event_count( buff );
-  for (int j = 0; j < evCount; j++) {
-    MidiInApi::MidiMessage message;
-    message.bytes.clear();
+  if ( evCount > 0 ) {
+
+    // Event times are reconstructed from the start of the period and
+    // their frame offset into it, so the clock is read once per period
+    // and the timing is sample-accurate.  They are kept on the clock of
+    // RtMidi::getCurrentTime().
+    jack_nframes_t cycleFrame = jack_last_frame_time( jData->client );
+    unsigned long long cycleTime = jack_frames_to_time( jData->client, cycleFrame ) * 1000ULL + jData->clockOffset;
+    double nsecsPerFrame = 1000000000.0 / jack_get_sample_rate( jData->client );
+    rtData->enterRealtime();
+    RtMidiIn::RtMidiRealtimeCallback realtimeCallback = rtData->realtimeCallback;
+
+    for (int j = 0; j < evCount; j++) {
+      jack_midi_event_get( &event, buff, j );
+
+      // Filtered messages are dropped before they are copied.
+      if ( event.size == 0 || !rtData->filter[event.buffer[0]] ) continue;
+
+      header.time = cycleTime + (unsigned long long) ( event.time * nsecsPerFrame );
+      header.frame = cycleFrame + event.time;
+      header.size = (unsigned int) event.size;
+      header.delivered = false;
+
+      // With a realtime callback, events are counted here rather than
+      // by the delivery thread.  Either thread may count while the
+      // callback is changed, so both use the shared counters, and the
+      // delivery thread is woken to call the statistics callback.
+      if ( realtimeCallback ) {
+        rtData->stats.countShared( event.size, header.time );
+        if ( rtData->stats.due( header.time ) ) wake = true;
+      }
 
-    jack_midi_event_get( &event, buff, j );
+      // Sysex start (0xF0) and continuation (data byte) events are
+      // left to the delivery thread when streamed to a sysex callback.
+      bool streamed = rtData->sysexCallback.load( std::memory_order_relaxed ) && event.size > 0 &&
+        ( event.buffer[0] == 0xF0 || !( event.buffer[0] & 0x80 ) );
+      if ( realtimeCallback && !streamed ) {
+        header.delivered = true;
+        // Compute the delta time.
+        double timeStamp = 0.0;
+        if ( rtData->firstMessage == true )
+          rtData->firstMessage = false;
+        else
+          timeStamp = ( header.time - jData->lastTime ) * 0.000000001;
+        jData->lastTime = header.time;
+
+        rtData->message.absoluteTime = header.time;
+        rtData->message.frameTime = header.frame;
+        unsigned long long start = RtMidi::getCurrentTime();
+        realtimeCallback( timeStamp, event.buffer, event.size, rtData->userData );
+        rtData->stats.countCallbackShared( start );
+        if ( !rtData->routes.load( std::memory_order_relaxed ) ) continue;
+      }
 
-    for ( unsigned int i = 0; i < event.size; i++ )
-      message.bytes.push_back( event.buffer[i] );
+      if ( jack_ringbuffer_write_space( jData->buffIn ) < sizeof(header) + event.size ) {
+        jData->inputOverruns.fetch_add( 1, std::memory_order_relaxed );
+        continue;
+      }
+      jack_ringbuffer_write( jData->buffIn, (const char *) &header, sizeof(header) );
+      jack_ringbuffer_write( jData->buffIn, (const char *) event.buffer, event.size );
+      wake = true;
+    }
+    rtData->leaveRealtime();
+  }
 
-    // Compute the delta time.
-    time = jack_get_time();
-    if ( rtData->firstMessage == true )
-      rtData->firstMessage = false;
-    else
-      message.timeStamp = ( time - jData->lastTime ) * 0.000001;
+  // The delivery thread holds its mutex except while it waits, so a
+  // failed trylock means it is busy; the wakeup is then retried next
+  // period in case it had already found the ringbuffer empty.
+  if ( wake ) {
+    if ( pthread_mutex_trylock( &jData->deliveryMutex ) == 0 ) {
+      pthread_cond_signal( &jData->deliveryReady );
+      pthread_mutex_unlock( &jData->deliveryMutex );
+      wake = false;
+    }
+  }
+  jData->wakePending = wake;
 
-    jData->lastTime = time;
+  return 0;
+}
 
-    if ( !rtData->continueSysex ) {
-      if ( rtData->usingCallback ) {
+static void *jackDeliveryThread( void *ptr )
+{
+  JackMidiData *jData = (JackMidiData *) ptr;
+  MidiInApi :: RtMidiInData *rtData = jData->rtMidiIn;
+  JackInputHeader header;
+  double timeStamp;
+
+  pthread_mutex_lock( &jData->deliveryMutex );
+  while ( jData->deliveryRunning ) {
+
+    // A header is written before its bytes, so wait for both.
+    while ( jack_ringbuffer_peek( jData->buffIn, (char *) &header, sizeof(header) ) == sizeof(header) &&
+            jack_ringbuffer_read_space( jData->buffIn ) >= sizeof(header) + header.size ) {
+      jack_ringbuffer_read_advance( jData->buffIn, sizeof(header) );
+
+      // Reuse the persistent message vector to avoid reallocating it.
+      MidiInApi::MidiMessage& message = rtData->message;
+      message.bytes.resize( header.size );
+      if ( header.size > 0 )
+        jack_ringbuffer_read( jData->buffIn, (char *) &message.bytes[0], header.size );
+      rtData->route( message.bytes.data(), header.size );
+      if ( header.delivered ) continue;
+
+      // Compute the delta time.
+      timeStamp = 0.0;
+      if ( rtData->firstMessage == true )
+        rtData->firstMessage = false;
+      else
+        timeStamp = ( header.time - jData->lastTime ) * 0.000000001;
+      jData->lastTime = header.time;
+
+      if ( rtData->continueSysex ) continue;
+      if ( !rtData->realtimeCallback ) rtData->stats.countShared( header.size, header.time );
+      rtData->enterCallback();
+      RtMidiIn::RtMidiSysexCallback sysexCallback = rtData->sysexCallback.load( std::memory_order_acquire );
+      if ( sysexCallback && header.size > 0 &&
+           ( message.bytes[0] == 0xF0 || !( message.bytes[0] & 0x80 ) ) ) {
+        // Each event is a fragment of its own.
+        sysexCallback( timeStamp, message.bytes.data(), header.size,
+                       message.bytes[0] == 0xF0, message.bytes[header.size-1] == 0xF7,
+                       rtData->sysexUserData.load( std::memory_order_relaxed ) );
+      }
+      else if ( rtData->usingCallback && !rtData->realtimeCallback ) {
+        message.timeStamp = timeStamp;
+        message.absoluteTime = header.time;
+        message.frameTime = header.frame;
         RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) rtData->userCallback;
+        unsigned long long start = RtMidi::getCurrentTime();
         callback( message.timeStamp, &message.bytes, rtData->userData );
+        rtData->stats.countCallbackShared( start );
       }
       else {
         // As long as we haven't reached our queue size limit, push the message.
-        if ( rtData->queue.size < rtData->queue.ringSize ) {
-          rtData->queue.ring[rtData->queue.back++] = message;
-          if ( rtData->queue.back == rtData->queue.ringSize )
-            rtData->queue.back = 0;
-          rtData->queue.size++;
-        }
-        else
+        if ( !rtData->queue.push( message.bytes.data(), header.size, timeStamp, header.time, header.frame ) )
           std::cerr << "\nMidiInJack: message queue limit reached!!\n\n";
       }
+      rtData->leaveCallback();
     }
+
+    unsigned int overruns = jData->inputOverruns.exchange( 0, std::memory_order_relaxed );
+    MidiApi::MidiStats::add( rtData->stats.drops, overruns );
+    if ( overruns )
+      std::cerr << "\nMidiInJack: input ringbuffer overrun, " << overruns << " message(s) lost!!\n\n";
+    rtData->stats.report( RtMidi::getCurrentTime() );
+
+    pthread_cond_wait( &jData->deliveryReady, &jData->deliveryMutex );
   }
+  pthread_mutex_unlock( &jData->deliveryMutex );
 
   return 0;
 }
 
-MidiInJack :: MidiInJack( const std::string clientName, unsigned int queueSizeLimit ) : MidiInApi( queueSizeLimit )
+MidiInJack :: MidiInJack( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize,
+                          MidiContextApi *context ) : MidiInApi( queueSizeLimit, sysexQueueSize )
 {
+  context_ = context;
+  if ( context_ ) context_->retain();
   initialize( clientName );
 }
 
@@ -137,8 +426,33 @@ void MidiInJack :: initialize( const std::string& clientName )
   data->rtMidiIn = &inputData_;
   data->port = NULL;
   data->client = NULL;
+  data->context = context_ ? static_cast<JackContextData *> (context_->getApiData()) : 0;
   this->clientName = clientName;
 
+  // Sized to hold a full sysex queue's worth of input on top of the
+  // usual burst of short messages.
+  data->buffIn = jack_ringbuffer_create( JACK_RINGBUFFER_SIZE + inputData_.queue.arenaSize );
+  jack_ringbuffer_mlock( data->buffIn );
+  data->wakePending = false;
+  data->inputOverruns = 0;
+  data->clockOffset = (long long) ( RtMidi::getCurrentTime() - jack_get_time() * 1000ULL );
+  pthread_mutex_init( &data->deliveryMutex, NULL );
+  pthread_cond_init( &data->deliveryReady, NULL );
+  data->deliveryRunning = true;
+  if ( pthread_create( &data->deliveryThread, NULL, jackDeliveryThread, data ) ) {
+    // The constructor throws, so the destructor won't free the data.
+    pthread_cond_destroy( &data->deliveryReady );
+    pthread_mutex_destroy( &data->deliveryMutex );
+    jack_ringbuffer_free( data->buffIn );
+    delete data;
+    apiData_ = 0;
+    if ( context_ ) context_->release();
+    context_ = 0;
+    errorString_ = "MidiInJack::initialize: error starting MIDI input delivery thread!";
+    error( RtMidiError::THREAD_ERROR, errorString_ );
+    return;
+  }
+
   connect();
 }
 
@@ -148,6 +462,13 @@ void MidiInJack :: connect()
   if ( data->client )
     return;
 
+  if ( data->context ) {
+    // Run by the process callback of the context's client.
+    data->client = data->context->client;
+    jackContextUpdate( data->context, data->context->inputs, data, true );
+    return;
+  }
+
   // Initialize JACK client
   if (( data->client = jack_client_open( clientName.c_str(), JackNoStartServer, NULL )) == 0) {
     errorString_ = "MidiInJack::initialize: JACK server not running?";
@@ -162,11 +483,55 @@ void MidiInJack :: connect()
 MidiInJack :: ~MidiInJack()
 {
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  if ( !data ) return;
   closePort();
 
-  if ( data->client )
+  if ( data->context )
+    jackContextUpdate( data->context, data->context->inputs, data, false );
+  else if ( data->client )
     jack_client_close( data->client );
+
+  // Stop the delivery thread once the process callback is gone.
+  if ( data->deliveryRunning ) {
+    pthread_mutex_lock( &data->deliveryMutex );
+    data->deliveryRunning = false;
+    pthread_cond_signal( &data->deliveryReady );
+    pthread_mutex_unlock( &data->deliveryMutex );
+    pthread_join( data->deliveryThread, NULL );
+  }
+  pthread_cond_destroy( &data->deliveryReady );
+  pthread_mutex_destroy( &data->deliveryMutex );
+  jack_ringbuffer_free( data->buffIn );
   delete data;
+  if ( context_ ) context_->release();
+}
+
+// The JACK process thread belongs to the server, so only the delivery
+// thread is ours to schedule.
+void MidiInJack :: applyThreadOptions( void )
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  if ( data->deliveryRunning ) scheduleThread( &data->deliveryThread );
+}
+
+void MidiInJack :: setRealtimeCallback( RtMidiIn::RtMidiRealtimeCallback callback, void *userData )
+{
+  if ( inputData_.usingCallback ) {
+    errorString_ = "MidiInJack::setRealtimeCallback: a callback function is already set!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  if ( !callback ) {
+    errorString_ = "MidiInJack::setRealtimeCallback: callback function value is invalid!";
+    error( RtMidiError::WARNING, errorString_ );
+    return;
+  }
+
+  // The process thread picks the callback up as soon as it is set.
+  inputData_.userData = userData;
+  inputData_.realtimeCallback = callback;
+  inputData_.usingCallback = true;
 }
 
 void MidiInJack :: openPort( unsigned int portNumber, const std::string portName )
@@ -206,6 +571,31 @@ void MidiInJack :: openVirtualPort( const std::string portName )
   }
 }
 
+// Count ports through a temporary client that is never activated
+// and registers no ports, to find out cheaply whether JACK is worth
+// using.  The server is not started if it isn't running.
+static unsigned int jackProbePortCount( unsigned long flags )
+{
+  jack_client_t *client = jack_client_open( "RtMidi Probe", JackNoStartServer, NULL );
+  if ( client == NULL ) return 0;
+
+  unsigned int count = 0;
+  const char **ports = jack_get_ports( client, NULL, JACK_DEFAULT_MIDI_TYPE, flags );
+  if ( ports ) {
+    while ( ports[count] != NULL )
+      count++;
+    jack_free( ports );
+  }
+
+  jack_client_close( client );
+  return count;
+}
+
+unsigned int MidiInJack :: probePortCount()
+{
+  return jackProbePortCount( JackPortIsOutput );
+}
+
 unsigned int MidiInJack :: getPortCount()
 {
   int count = 0;
@@ -275,7 +665,7 @@ static int jackProcessOut( jack_nframes_t nframes, void *arg )
 {
   JackMidiData *data = (JackMidiData *) arg;
   jack_midi_data_t *midiData;
-  int space;
+  JackMessageHeader header;
 
   // Is port created?
   if ( data->port == NULL ) return 0;
@@ -283,18 +673,45 @@ static int jackProcessOut( jack_nframes_t nframes, void *arg )
   void *buff = jack_port_get_buffer( data->port, nframes );
   jack_midi_clear_buffer( buff );
 
-  while ( jack_ringbuffer_read_space( data->buffSize ) > 0 ) {
-    jack_ringbuffer_read( data->buffSize, (char *) &space, (size_t) sizeof(space) );
-    midiData = jack_midi_event_reserve( buff, 0, space );
+  // Scheduled messages are placed at the frame offset they fall on
+  // within this period, late ones at the earliest offset still
+  // available (event offsets must not decrease), and messages due in
+  // a later period are left, along with everything queued after them.
+  // Messages that don't fit in what is left of the port buffer are
+  // carried over to the next period; those that wouldn't even fit in
+  // an empty buffer are dropped.
+  jack_nframes_t cycleStart = jack_last_frame_time( data->client );
+  jack_nframes_t offset = 0;
+  while ( jack_ringbuffer_peek( data->buffOut, (char *) &header, sizeof(header) ) == sizeof(header) ) {
+    if ( header.time ) {
+      int frames = (int) ( jack_time_to_frames( data->client, header.time ) - cycleStart );
+      if ( frames >= (int) nframes ) break;
+      if ( frames > (int) offset ) offset = frames;
+    }
+
+    if ( (size_t) header.size > jack_midi_max_event_size( buff ) ) {
+      if ( jack_midi_get_event_count( buff ) > 0 ) break;
+      jack_ringbuffer_read_advance( data->buffOut, sizeof(header) + header.size );
+      data->outputOverflows.fetch_add( 1, std::memory_order_relaxed );
+      continue;
+    }
 
-    jack_ringbuffer_read( data->buffMessage, (char *) midiData, (size_t) space );
+    midiData = jack_midi_event_reserve( buff, offset, header.size );
+    if ( midiData == NULL ) break;
+
+    jack_ringbuffer_read_advance( data->buffOut, sizeof(header) );
+    jack_ringbuffer_read( data->buffOut, (char *) midiData, (size_t) header.size );
   }
 
   return 0;
 }
 
-MidiOutJack :: MidiOutJack( const std::string clientName ) : MidiOutApi()
+MidiOutJack :: MidiOutJack( const std::string clientName, unsigned int bufferSize,
+                            MidiContextApi *context ) : MidiOutApi()
 {
+  context_ = context;
+  if ( context_ ) context_->retain();
+  this->bufferSize = bufferSize;
   initialize( clientName );
 }
 
@@ -305,8 +722,15 @@ void MidiOutJack :: initialize( const std::string& clientName )
 
   data->port = NULL;
   data->client = NULL;
+  data->outputDrops = 0;
+  data->outputOverflows = 0;
+  data->context = context_ ? static_cast<JackContextData *> (context_->getApiData()) : 0;
   this->clientName = clientName;
 
+  // Initialize output ringbuffer
+  data->buffOut = jack_ringbuffer_create( bufferSize );
+  jack_ringbuffer_mlock( data->buffOut );
+
   connect();
 }
 
@@ -315,10 +739,13 @@ void MidiOutJack :: connect()
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
   if ( data->client )
     return;
-  
-  // Initialize output ringbuffers  
-  data->buffSize = jack_ringbuffer_create( JACK_RINGBUFFER_SIZE );
-  data->buffMessage = jack_ringbuffer_create( JACK_RINGBUFFER_SIZE );
+
+  if ( data->context ) {
+    // Run by the process callback of the context's client.
+    data->client = data->context->client;
+    jackContextUpdate( data->context, data->context->outputs, data, true );
+    return;
+  }
 
   // Initialize JACK client
   if (( data->client = jack_client_open( clientName.c_str(), JackNoStartServer, NULL )) == 0) {
@@ -337,13 +764,16 @@ MidiOutJack :: ~MidiOutJack()
   closePort();
   
   // Cleanup
-  jack_ringbuffer_free( data->buffSize );
-  jack_ringbuffer_free( data->buffMessage );
-  if ( data->client ) {
+  if ( data->context ) {
+    jackContextUpdate( data->context, data->context->outputs, data, false );
+  }
+  else if ( data->client ) {
     jack_client_close( data->client );
   }
+  jack_ringbuffer_free( data->buffOut );
 
   delete data;
+  if ( context_ ) context_->release();
 }
 
 void MidiOutJack :: openPort( unsigned int portNumber, const std::string portName )
@@ -383,6 +813,11 @@ void MidiOutJack :: openVirtualPort( const std::string portName )
   }
 }
 
+unsigned int MidiOutJack :: probePortCount()
+{
+  return jackProbePortCount( JackPortIsInput );
+}
+
 unsigned int MidiOutJack :: getPortCount()
 {
   int count = 0;
@@ -443,15 +878,63 @@ void MidiOutJack :: closePort()
   data->port = NULL;
 }
 
-void MidiOutJack :: sendMessage( std::vector<unsigned char> *message )
+void MidiOutJack :: sendMessage( const unsigned char *message, size_t size )
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+
+  if ( !jackQueueMessage( data->buffOut, message, size, 0 ) )
+    data->outputDrops.fetch_add( 1, std::memory_order_relaxed );
+
+  reportDroppedMessages();
+}
+
+bool MidiOutJack :: trySendMessage( const unsigned char *message, size_t size )
 {
-  int nBytes = message->size();
   JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  return jackQueueMessage( data->buffOut, message, size, 0 );
+}
+
+void MidiOutJack :: sendMessages( const size_t *offsets, const unsigned char *message, unsigned int count,
+                                  const double *timeStamps, bool deltaTime )
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  jack_time_t now = jack_get_time();
+  double time = 0.0;
+
+  for ( unsigned int i=0; i<count; ++i ) {
+    jack_time_t due = 0;
+    if ( timeStamps ) {
+      time = deltaTime ? time + timeStamps[i] : timeStamps[i];
+      due = now + ( time > 0.0 ? (jack_time_t) ( time * 1000000.0 ) : 0 );
+    }
 
-  // Write full message to buffer
-  jack_ringbuffer_write( data->buffMessage, ( const char * ) &( *message )[0],
-                         message->size() );
-  jack_ringbuffer_write( data->buffSize, ( char * ) &nBytes, sizeof( nBytes ) );
+    // Stop at the first message that doesn't fit, so that the ones
+    // which do go out are not reordered.
+    if ( !jackQueueMessage( data->buffOut, message + offsets[i], offsets[i+1] - offsets[i], due ) ) {
+      data->outputDrops.fetch_add( count - i, std::memory_order_relaxed );
+      break;
+    }
+  }
+
+  reportDroppedMessages();
+}
+
+void MidiOutJack :: reportDroppedMessages( void )
+{
+  JackMidiData *data = static_cast<JackMidiData *> (apiData_);
+  unsigned int drops = data->outputDrops.exchange( 0, std::memory_order_relaxed );
+  unsigned int overflows = data->outputOverflows.exchange( 0, std::memory_order_relaxed );
+  if ( drops == 0 && overflows == 0 ) return;
+  MidiStats::add( stats_.drops, drops + overflows );
+
+  std::ostringstream ost;
+  ost << "MidiOutJack::sendMessage: ";
+  if ( drops ) ost << drops << " message(s) dropped because the output buffer is full";
+  if ( drops && overflows ) ost << ", ";
+  if ( overflows ) ost << overflows << " message(s) dropped because they exceed the JACK port buffer";
+  ost << '.';
+  errorString_ = ost.str();
+  error( RtMidiError::WARNING, errorString_ );
 }
 
 #endif  // __UNIX_JACK__
@@ -52,17 +52,29 @@
 
 #if defined(__UNIX_JACK__)
 
+class MidiContextJack: public MidiContextApi
+{
+ public:
+  MidiContextJack( const std::string clientName );
+  ~MidiContextJack( void );
+  RtMidi::Api getCurrentApi( void ) { return RtMidi::UNIX_JACK; };
+};
+
 class MidiInJack: public MidiInApi
 {
  public:
-  MidiInJack( const std::string clientName, unsigned int queueSizeLimit );
+  MidiInJack( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize,
+              MidiContextApi *context = 0 );
   ~MidiInJack( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::UNIX_JACK; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
+  void setRealtimeCallback( RtMidiIn::RtMidiRealtimeCallback callback, void *userData );
+  void applyThreadOptions( void );
 
  protected:
   std::string clientName;
@@ -74,21 +86,28 @@ class MidiInJack: public MidiInApi
 class MidiOutJack: public MidiOutApi
 {
  public:
-  MidiOutJack( const std::string clientName );
+  MidiOutJack( const std::string clientName, unsigned int bufferSize, MidiContextApi *context = 0 );
   ~MidiOutJack( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::UNIX_JACK; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
-  void sendMessage( std::vector<unsigned char> *message );
+  void sendMessage( const unsigned char *message, size_t size );
+  bool trySendMessage( const unsigned char *message, size_t size );
+  void sendMessages( const size_t *offsets, const unsigned char *data, unsigned int count,
+                     const double *timeStamps, bool deltaTime );
 
  protected:
   std::string clientName;
 
+  unsigned int bufferSize;
+
   void connect( void );
   void initialize( const std::string& clientName );
+  void reportDroppedMessages( void );
 };
 
 #endif
@@ -38,6 +38,8 @@
 
 #include "RtMidi.h"
 #include "RtMidiWinMM.h"
+#include <atomic>
+#include <cstring>
 #include <sstream>
 
 //*********************************************************************//
@@ -59,8 +61,19 @@
 #include <windows.h>
 #include <mmsystem.h>
 
-#define  RT_SYSEX_BUFFER_SIZE 1024
-#define  RT_SYSEX_BUFFER_COUNT 4
+// A lock-free stack of free buffer indices.
+struct WinMMBufferStack {
+  int *next;                               // next free buffer, or -1
+  std::atomic<unsigned long long> head;    // tag << 32 | ( index + 1 )
+};
+
+// A sysex output header of the asynchronous mode, with the size of
+// its data buffer (the header is prepared again with the length of
+// each message that differs from the last).
+struct WinMMOutputBuffer {
+  MIDIHDR header;
+  unsigned int capacity;
+};
 
 // A structure to hold variables related to the CoreMIDI API
 // implementation.
@@ -68,11 +81,76 @@ struct WinMidiData {
   HMIDIIN inHandle;    // Handle to Midi Input Device
   HMIDIOUT outHandle;  // Handle to Midi Output Device
   DWORD lastTime;
-  MidiInApi::MidiMessage message;
-  LPMIDIHDR sysexBuffer[RT_SYSEX_BUFFER_COUNT];
-  CRITICAL_SECTION _mutex; // [Patrice] see https://groups.google.com/forum/#!topic/mididev/6OUjHutMpEo
+  unsigned long long startTime; // on the clock of RtMidi::getCurrentTime(), at midiInStart()
+
+  // The sysex input buffers.  Those handed back by the driver go to a
+  // lock-free free list, from which they are requeued; see
+  // winmmRefillBuffers().
+  LPMIDIHDR *sysexBuffer;
+  unsigned int sysexBufferCount;
+  WinMMBufferStack sysexFree;
+  std::atomic<int> queuedBuffers;              // held by the driver
+  std::atomic<int> requeuing;                  // callbacks currently requeuing
+  std::atomic<bool> closing;
+  std::atomic<unsigned int> bufferUnderruns;   // times the driver ran out of buffers
+
+  // The sysex output headers of the asynchronous mode, which the
+  // driver hands back to midiOutputCallback() once sent.
+  WinMMOutputBuffer *outBuffer;
+  unsigned int outBufferCount;
+  WinMMBufferStack outFree;
+  std::atomic<int> pendingSysex;               // held by the driver
+  RtMidiOut::RtMidiSysexSentCallback sentCallback;
+  void *sentUserData;
 };
 
+// A Treiber stack of buffer indices.  The tag, bumped by every
+// update, keeps a concurrent pop from acting on a stale head.
+static void winmmPushFree( WinMMBufferStack *stack, unsigned int index )
+{
+  unsigned long long head = stack->head.load();
+  unsigned long long next;
+  do {
+    stack->next[index] = (int) ( head & 0xFFFFFFFF ) - 1;
+    next = ( ( ( head >> 32 ) + 1 ) << 32 ) | ( index + 1 );
+  } while ( !stack->head.compare_exchange_weak( head, next ) );
+}
+
+static int winmmPopFree( WinMMBufferStack *stack )
+{
+  unsigned long long head = stack->head.load();
+  unsigned long long next;
+  int index;
+  do {
+    index = (int) ( head & 0xFFFFFFFF ) - 1;
+    if ( index < 0 ) return -1;
+    next = ( ( ( head >> 32 ) + 1 ) << 32 ) | (unsigned int) ( stack->next[index] + 1 );
+  } while ( !stack->head.compare_exchange_weak( head, next ) );
+  return index;
+}
+
+// Hand the free sysex buffers back to the driver.  Nothing is
+// requeued once closePort() has set the closing flag, and closePort()
+// waits for callbacks already past the check before resetting the
+// driver, so no lock is taken here.
+static void winmmRefillBuffers( WinMidiData *data )
+{
+  data->requeuing.fetch_add( 1 );
+  if ( !data->closing.load() ) {
+    int index;
+    while ( ( index = winmmPopFree( &data->sysexFree ) ) >= 0 ) {
+      MMRESULT result = midiInAddBuffer( data->inHandle, data->sysexBuffer[index], sizeof(MIDIHDR) );
+      if ( result != MMSYSERR_NOERROR ) {
+        winmmPushFree( &data->sysexFree, index );
+        std::cerr << "\nRtMidiIn::midiInputCallback: error sending sysex to Midi device!!\n\n";
+        break;
+      }
+      data->queuedBuffers.fetch_add( 1 );
+    }
+  }
+  data->requeuing.fetch_sub( 1 );
+}
+
 //*********************************************************************//
 //  API: Windows MM
 //  Class Definitions: MidiInWinMM
@@ -91,93 +169,60 @@ static void CALLBACK midiInputCallback( HMIDIIN /*hmin*/,
   WinMidiData *apiData = static_cast<WinMidiData *> (data->apiData);
 
   // Calculate time stamp.
-  if ( data->firstMessage == true ) {
-    apiData->message.timeStamp = 0.0;
+  double timeStamp = 0.0;
+  if ( data->firstMessage == true )
     data->firstMessage = false;
-  }
-  else apiData->message.timeStamp = (double) ( timestamp - apiData->lastTime ) * 0.001;
+  else timeStamp = (double) ( timestamp - apiData->lastTime ) * 0.001;
   apiData->lastTime = timestamp;
 
+  // The input time counts milliseconds from midiInStart().
+  unsigned long long time = apiData->startTime + timestamp * 1000000ULL;
+
   if ( inputStatus == MIM_DATA ) { // Channel or system message
 
-    // Make sure the first byte is a status byte.
+    // The message is packed in the parameter, status byte first, and
+    // goes through the parser like any other bytes, so that a
+    // realtime message may come in the middle of a sysex message.
     unsigned char status = (unsigned char) (midiMessage & 0x000000FF);
-    if ( !(status & 0x80) ) return;
-
-    // Determine the number of bytes in the MIDI message.
-    unsigned short nBytes = 1;
-    if ( status < 0xC0 ) nBytes = 3;
-    else if ( status < 0xE0 ) nBytes = 2;
-    else if ( status < 0xF0 ) nBytes = 3;
-    else if ( status == 0xF1 ) {
-      if ( data->ignoreFlags & 0x02 ) return;
-      else nBytes = 2;
-    }
-    else if ( status == 0xF2 ) nBytes = 3;
-    else if ( status == 0xF3 ) nBytes = 2;
-    else if ( status == 0xF8 && (data->ignoreFlags & 0x02) ) {
-      // A MIDI timing tick message and we're ignoring it.
-      return;
-    }
-    else if ( status == 0xFE && (data->ignoreFlags & 0x04) ) {
-      // A MIDI active sensing message and we're ignoring it.
-      return;
-    }
+    unsigned int nBytes = MidiInApi::MidiParser::lengths[status];
+    if ( nBytes == 0 ) return;
 
-    // Copy bytes to our MIDI message.
-    unsigned char *ptr = (unsigned char *) &midiMessage;
-    for ( int i=0; i<nBytes; ++i ) apiData->message.bytes.push_back( *ptr++ );
+    unsigned char bytes[3];
+    for ( unsigned int i=0; i<nBytes; ++i ) bytes[i] = (unsigned char) ( midiMessage >> ( 8 * i ) );
+    data->receive( bytes, nBytes, timeStamp, time );
+    return;
   }
-  else { // Sysex message ( MIM_LONGDATA or MIM_LONGERROR )
-    MIDIHDR *sysex = ( MIDIHDR *) midiMessage; 
-    if ( !( data->ignoreFlags & 0x01 ) && inputStatus != MIM_LONGERROR ) {  
-      // Sysex message and we're not ignoring it
-      for ( int i=0; i<(int)sysex->dwBytesRecorded; ++i )
-        apiData->message.bytes.push_back( sysex->lpData[i] );
-    }
-
-    // The WinMM API requires that the sysex buffer be requeued after
-    // input of each sysex message.  Even if we are ignoring sysex
-    // messages, we still need to requeue the buffer in case the user
-    // decides to not ignore sysex messages in the future.  However,
-    // it seems that WinMM calls this function with an empty sysex
-    // buffer when an application closes and in this case, we should
-    // avoid requeueing it, else the computer suddenly reboots after
-    // one or two minutes.
-    if ( apiData->sysexBuffer[sysex->dwUser]->dwBytesRecorded > 0 ) {
-      //if ( sysex->dwBytesRecorded > 0 ) {
-      EnterCriticalSection( &(apiData->_mutex) );
-      MMRESULT result = midiInAddBuffer( apiData->inHandle, apiData->sysexBuffer[sysex->dwUser], sizeof(MIDIHDR) );
-      LeaveCriticalSection( &(apiData->_mutex) );
-      if ( result != MMSYSERR_NOERROR )
-        std::cerr << "\nRtMidiIn::midiInputCallback: error sending sysex to Midi device!!\n\n";
 
-      if ( data->ignoreFlags & 0x01 ) return;
-    }
-    else return;
+  // Sysex message ( MIM_LONGDATA or MIM_LONGERROR )
+  MIDIHDR *sysex = ( MIDIHDR *) midiMessage; 
+  if ( sysex->dwBytesRecorded > 0 && apiData->queuedBuffers.fetch_sub( 1 ) == 1 ) {
+    apiData->bufferUnderruns.fetch_add( 1, std::memory_order_relaxed );
+    MidiApi::MidiStats::add( data->stats.overruns );
   }
 
-  if ( data->usingCallback ) {
-    RtMidiIn::RtMidiCallback callback = (RtMidiIn::RtMidiCallback) data->userCallback;
-    callback( apiData->message.timeStamp, &apiData->message.bytes, data->userData );
-  }
-  else {
-    // As long as we haven't reached our queue size limit, push the message.
-    if ( data->queue.size < data->queue.ringSize ) {
-      data->queue.ring[data->queue.back++] = apiData->message;
-      if ( data->queue.back == data->queue.ringSize )
-        data->queue.back = 0;
-      data->queue.size++;
-    }
-    else
-      std::cerr << "\nRtMidiIn: message queue limit reached!!\n\n";
+  // A message may be split across buffers; the parser keeps its state
+  // from one to the next, and drops the message of a buffer in error.
+  if ( inputStatus == MIM_LONGERROR )
+    data->parser.reset();
+  else if ( sysex->dwBytesRecorded > 0 )
+    data->receive( (const unsigned char *) sysex->lpData, (unsigned int) sysex->dwBytesRecorded, timeStamp, time );
+
+  // The WinMM API requires that the sysex buffer be requeued after
+  // input of each sysex message.  Even if we are ignoring sysex
+  // messages, we still need to requeue the buffer in case the user
+  // decides to not ignore sysex messages in the future.  However,
+  // it seems that WinMM calls this function with an empty sysex
+  // buffer when an application closes and in this case, we should
+  // avoid requeueing it, else the computer suddenly reboots after
+  // one or two minutes.  The bytes have been delivered (or copied
+  // into a message still being assembled) by now.
+  if ( sysex->dwBytesRecorded > 0 ) {
+    winmmPushFree( &apiData->sysexFree, (unsigned int) sysex->dwUser );
+    winmmRefillBuffers( apiData );
   }
-
-  // Clear the vector for the next input message.
-  apiData->message.bytes.clear();
 }
 
-MidiInWinMM :: MidiInWinMM( const std::string clientName, unsigned int queueSizeLimit ) : MidiInApi( queueSizeLimit )
+MidiInWinMM :: MidiInWinMM( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize ) : MidiInApi( queueSizeLimit, sysexQueueSize )
 {
   initialize( clientName );
 }
@@ -187,10 +232,8 @@ MidiInWinMM :: ~MidiInWinMM()
   // Close a connection if it exists.
   closePort();
 
-  WinMidiData *data = static_cast<WinMidiData *> (apiData_);
-  DeleteCriticalSection( &(data->_mutex) );
-
   // Cleanup.
+  WinMidiData *data = static_cast<WinMidiData *> (apiData_);
   delete data;
 }
 
@@ -208,12 +251,16 @@ void MidiInWinMM :: initialize( const std::string& /*clientName*/ )
   WinMidiData *data = (WinMidiData *) new WinMidiData;
   apiData_ = (void *) data;
   inputData_.apiData = (void *) data;
-  data->message.bytes.clear();  // needs to be empty for first input message
+  data->sysexBuffer = 0;
+  data->sysexBufferCount = 0;
+  data->sysexFree.next = 0;
+  data->bufferUnderruns = 0;
+}
 
-  if ( !InitializeCriticalSectionAndSpinCount(&(data->_mutex), 0x00000400) ) {
-    errorString_ = "MidiInWinMM::initialize: InitializeCriticalSectionAndSpinCount failed.";
-    error( RtMidiError::WARNING, errorString_ );
-  }
+unsigned int MidiInWinMM :: getSysexBufferUnderruns( void )
+{
+  WinMidiData *data = static_cast<WinMidiData *> (apiData_);
+  return data->bufferUnderruns.load( std::memory_order_relaxed );
 }
 
 void MidiInWinMM :: openPort( unsigned int portNumber, const std::string /*portName*/ )
@@ -251,11 +298,18 @@ void MidiInWinMM :: openPort( unsigned int portNumber, const std::string /*portN
     return;
   }
 
-  // Allocate and init the sysex buffers.
-  for ( int i=0; i<RT_SYSEX_BUFFER_COUNT; ++i ) {
+  // Allocate and init the sysex buffers, as set by setBufferSize().
+  data->sysexBufferCount = inputData_.bufferCount;
+  data->sysexBuffer = new LPMIDIHDR[ data->sysexBufferCount ];
+  data->sysexFree.next = new int[ data->sysexBufferCount ];
+  data->sysexFree.head = 0;
+  data->queuedBuffers = 0;
+  data->requeuing = 0;
+  data->closing = false;
+  for ( unsigned int i=0; i<data->sysexBufferCount; ++i ) {
     data->sysexBuffer[i] = (MIDIHDR*) new char[ sizeof(MIDIHDR) ];
-    data->sysexBuffer[i]->lpData = new char[ RT_SYSEX_BUFFER_SIZE ];
-    data->sysexBuffer[i]->dwBufferLength = RT_SYSEX_BUFFER_SIZE;
+    data->sysexBuffer[i]->lpData = new char[ inputData_.bufferSize ];
+    data->sysexBuffer[i]->dwBufferLength = inputData_.bufferSize;
     data->sysexBuffer[i]->dwUser = i; // We use the dwUser parameter as buffer indicator
     data->sysexBuffer[i]->dwFlags = 0;
 
@@ -275,8 +329,10 @@ void MidiInWinMM :: openPort( unsigned int portNumber, const std::string /*portN
       error( RtMidiError::DRIVER_ERROR, errorString_ );
       return;
     }
+    data->queuedBuffers.fetch_add( 1 );
   }
 
+  data->startTime = RtMidi::getCurrentTime();
   result = midiInStart( data->inHandle );
   if ( result != MMSYSERR_NOERROR ) {
     midiInClose( data->inHandle );
@@ -299,11 +355,16 @@ void MidiInWinMM :: closePort( void )
 {
   if ( connected_ ) {
     WinMidiData *data = static_cast<WinMidiData *> (apiData_);
-    EnterCriticalSection( &(data->_mutex) );
+
+    // Stop requeuing buffers, and let any callback doing so finish,
+    // before the driver hands them all back.
+    data->closing = true;
+    while ( data->requeuing.load() > 0 )
+      Sleep( 0 );
     midiInReset( data->inHandle );
     midiInStop( data->inHandle );
 
-    for ( int i=0; i<RT_SYSEX_BUFFER_COUNT; ++i ) {
+    for ( unsigned int i=0; i<data->sysexBufferCount; ++i ) {
       int result = midiInUnprepareHeader(data->inHandle, data->sysexBuffer[i], sizeof(MIDIHDR));
       delete [] data->sysexBuffer[i]->lpData;
       delete [] data->sysexBuffer[i];
@@ -315,12 +376,23 @@ void MidiInWinMM :: closePort( void )
       }
     }
 
+    delete [] data->sysexBuffer;
+    delete [] data->sysexFree.next;
+    data->sysexBuffer = 0;
+    data->sysexFree.next = 0;
+    data->sysexBufferCount = 0;
+
     midiInClose( data->inHandle );
+    inputData_.parser.reset();
     connected_ = false;
-    LeaveCriticalSection( &(data->_mutex) );
   }
 }
 
+unsigned int MidiInWinMM :: probePortCount()
+{
+  return midiInGetNumDevs();
+}
+
 unsigned int MidiInWinMM :: getPortCount()
 {
   return midiInGetNumDevs();
@@ -365,6 +437,26 @@ std::string MidiInWinMM :: getPortName( unsigned int portNumber )
 //  Class Definitions: MidiOutWinMM
 //*********************************************************************//
 
+// Called by the driver when an asynchronous sysex message has been
+// sent (or returned by midiOutReset()), after which its header can be
+// reused.
+static void CALLBACK midiOutputCallback( HMIDIOUT /*hmout*/,
+                                         UINT outputStatus,
+                                         DWORD_PTR instancePtr,
+                                         DWORD_PTR param1,
+                                         DWORD /*param2*/ )
+{
+  if ( outputStatus != MOM_DONE ) return;
+
+  WinMidiData *data = (WinMidiData *) instancePtr;
+  LPMIDIHDR header = (LPMIDIHDR) param1;
+  if ( data->sentCallback )
+    data->sentCallback( (const unsigned char *) header->lpData, header->dwBufferLength, data->sentUserData );
+
+  winmmPushFree( &data->outFree, (unsigned int) header->dwUser );
+  data->pendingSysex.fetch_sub( 1 );
+}
+
 MidiOutWinMM :: MidiOutWinMM( const std::string clientName ) : MidiOutApi()
 {
   initialize( clientName );
@@ -393,6 +485,15 @@ void MidiOutWinMM :: initialize( const std::string& /*clientName*/ )
   // Save our api-specific connection information.
   WinMidiData *data = (WinMidiData *) new WinMidiData;
   apiData_ = (void *) data;
+  data->outBuffer = 0;
+  data->outBufferCount = 0;
+  data->outFree.next = 0;
+  data->pendingSysex = 0;
+}
+
+unsigned int MidiOutWinMM :: probePortCount()
+{
+  return midiOutGetNumDevs();
 }
 
 unsigned int MidiOutWinMM :: getPortCount()
@@ -457,26 +558,86 @@ void MidiOutWinMM :: openPort( unsigned int portNumber, const std::string /*port
     return;
   }
 
+  // The completion callback is only needed for asynchronous sysex
+  // output, as set by setAsyncSysex().
   WinMidiData *data = static_cast<WinMidiData *> (apiData_);
-  MMRESULT result = midiOutOpen( &data->outHandle,
-                                 portNumber,
-                                 (DWORD)NULL,
-                                 (DWORD)NULL,
-                                 CALLBACK_NULL );
+  MMRESULT result;
+  if ( asyncSysexCount_ > 0 )
+    result = midiOutOpen( &data->outHandle,
+                          portNumber,
+                          (DWORD_PTR)&midiOutputCallback,
+                          (DWORD_PTR)data,
+                          CALLBACK_FUNCTION );
+  else
+    result = midiOutOpen( &data->outHandle,
+                          portNumber,
+                          (DWORD)NULL,
+                          (DWORD)NULL,
+                          CALLBACK_NULL );
   if ( result != MMSYSERR_NOERROR ) {
     errorString_ = "MidiOutWinMM::openPort: error creating Windows MM MIDI output port.";
     error( RtMidiError::DRIVER_ERROR, errorString_ );
     return;
   }
 
+  // Allocate and prepare the sysex output headers.
+  data->sentCallback = sysexSentCallback_;
+  data->sentUserData = sysexSentUserData_;
+  data->outBufferCount = asyncSysexCount_;
+  data->outBuffer = new WinMMOutputBuffer[ data->outBufferCount ]();
+  data->outFree.next = new int[ data->outBufferCount ];
+  data->outFree.head = 0;
+  data->pendingSysex = 0;
+  for ( unsigned int i=0; i<data->outBufferCount; ++i ) {
+    WinMMOutputBuffer *buffer = &data->outBuffer[i];
+    buffer->capacity = 1024;
+    buffer->header.lpData = new char[ buffer->capacity ];
+    buffer->header.dwBufferLength = buffer->capacity;
+    buffer->header.dwUser = i; // We use the dwUser parameter as buffer indicator
+    buffer->header.dwFlags = 0;
+    result = midiOutPrepareHeader( data->outHandle, &buffer->header, sizeof(MIDIHDR) );
+    if ( result != MMSYSERR_NOERROR ) {
+      releaseBuffers( i );
+      midiOutClose( data->outHandle );
+      errorString_ = "MidiOutWinMM::openPort: error preparing sysex header.";
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return;
+    }
+    winmmPushFree( &data->outFree, i );
+  }
+
   connected_ = true;
 }
 
+// Free the sysex output headers, of which the first \e prepared are
+// prepared with the (still open) output handle.
+void MidiOutWinMM :: releaseBuffers( unsigned int prepared )
+{
+  WinMidiData *data = static_cast<WinMidiData *> (apiData_);
+  for ( unsigned int i=0; i<data->outBufferCount; ++i ) {
+    if ( i < prepared )
+      midiOutUnprepareHeader( data->outHandle, &data->outBuffer[i].header, sizeof(MIDIHDR) );
+    delete [] data->outBuffer[i].header.lpData;
+  }
+  delete [] data->outBuffer;
+  delete [] data->outFree.next;
+  data->outBuffer = 0;
+  data->outFree.next = 0;
+  data->outBufferCount = 0;
+}
+
 void MidiOutWinMM :: closePort( void )
 {
   if ( connected_ ) {
     WinMidiData *data = static_cast<WinMidiData *> (apiData_);
     midiOutReset( data->outHandle );
+
+    // The reset returns the pending sysex headers, though their
+    // callbacks may still be running.
+    while ( data->pendingSysex.load() > 0 )
+      Sleep( 1 );
+    releaseBuffers( data->outBufferCount );
+
     midiOutClose( data->outHandle );
     connected_ = false;
   }
@@ -489,11 +650,11 @@ void MidiOutWinMM :: openVirtualPort( std::string /*portName*/ )
   error( RtMidiError::WARNING, errorString_ );
 }
 
-void MidiOutWinMM :: sendMessage( std::vector<unsigned char> *message )
+void MidiOutWinMM :: sendMessage( const unsigned char *message, size_t size )
 {
   if ( !connected_ ) return;
 
-  unsigned int nBytes = static_cast<unsigned int>(message->size());
+  unsigned int nBytes = static_cast<unsigned int>(size);
   if ( nBytes == 0 ) {
     errorString_ = "MidiOutWinMM::sendMessage: message argument is empty!";
     error( RtMidiError::WARNING, errorString_ );
@@ -502,7 +663,14 @@ void MidiOutWinMM :: sendMessage( std::vector<unsigned char> *message )
 
   MMRESULT result;
   WinMidiData *data = static_cast<WinMidiData *> (apiData_);
-  if ( message->at(0) == 0xF0 ) { // Sysex message
+  if ( message[0] == 0xF0 && data->outBufferCount > 0 ) { // Asynchronous sysex
+    if ( queueSysex( message, nBytes ) == 0 ) {
+      MidiStats::add( stats_.drops );
+      errorString_ = "MidiOutWinMM::sendMessage: no sysex output buffer available, message discarded.";
+      error( RtMidiError::WARNING, errorString_ );
+    }
+  }
+  else if ( message[0] == 0xF0 ) { // Sysex message
 
     // Allocate buffer for sysex data.
     char *buffer = (char *) malloc( nBytes );
@@ -513,7 +681,7 @@ void MidiOutWinMM :: sendMessage( std::vector<unsigned char> *message )
     }
 
     // Copy data to buffer.
-    for ( unsigned int i=0; i<nBytes; ++i ) buffer[i] = message->at(i);
+    for ( unsigned int i=0; i<nBytes; ++i ) buffer[i] = message[i];
 
     // Create and prepare MIDIHDR structure.
     MIDIHDR sysex;
@@ -554,7 +722,7 @@ void MidiOutWinMM :: sendMessage( std::vector<unsigned char> *message )
     DWORD packet;
     unsigned char *ptr = (unsigned char *) &packet;
     for ( unsigned int i=0; i<nBytes; ++i ) {
-      *ptr = message->at(i);
+      *ptr = message[i];
       ++ptr;
     }
 
@@ -567,5 +735,61 @@ void MidiOutWinMM :: sendMessage( std::vector<unsigned char> *message )
   }
 }
 
-#endif  // __WINDOWS_MM__
+bool MidiOutWinMM :: trySendMessage( const unsigned char *message, size_t size )
+{
+  WinMidiData *data = static_cast<WinMidiData *> (apiData_);
+  if ( !connected_ || data->outBufferCount == 0 || size == 0 || message[0] != 0xF0 ) {
+    sendMessage( message, size );
+    return true;
+  }
+
+  return queueSysex( message, static_cast<unsigned int>(size) ) != 0;
+}
+
+// Hand a sysex message to the driver in a free output header.  This
+// returns 1 once the message is queued, 0 if no header is free and -1
+// on errors, which have been reported.
+int MidiOutWinMM :: queueSysex( const unsigned char *bytes, unsigned int nBytes )
+{
+  WinMidiData *data = static_cast<WinMidiData *> (apiData_);
+  int index = winmmPopFree( &data->outFree );
+  if ( index < 0 ) return 0;
+
+  // A free header is not used by the driver, so it can be prepared
+  // again for the length of the message, in a larger buffer if the
+  // message does not fit.
+  WinMMOutputBuffer *buffer = &data->outBuffer[index];
+  MMRESULT result;
+  if ( nBytes > buffer->capacity || buffer->header.dwBufferLength != nBytes ) {
+    midiOutUnprepareHeader( data->outHandle, &buffer->header, sizeof(MIDIHDR) );
+    if ( nBytes > buffer->capacity ) {
+      delete [] buffer->header.lpData;
+      buffer->capacity = nBytes;
+      buffer->header.lpData = new char[ buffer->capacity ];
+    }
+    buffer->header.dwBufferLength = nBytes;
+    buffer->header.dwFlags = 0;
+    result = midiOutPrepareHeader( data->outHandle, &buffer->header, sizeof(MIDIHDR) );
+    if ( result != MMSYSERR_NOERROR ) {
+      winmmPushFree( &data->outFree, index );
+      errorString_ = "MidiOutWinMM::sendMessage: error preparing sysex header.";
+      error( RtMidiError::DRIVER_ERROR, errorString_ );
+      return -1;
+    }
+  }
+
+  memcpy( buffer->header.lpData, bytes, nBytes );
+  data->pendingSysex.fetch_add( 1 );
+  result = midiOutLongMsg( data->outHandle, &buffer->header, sizeof(MIDIHDR) );
+  if ( result != MMSYSERR_NOERROR ) {
+    data->pendingSysex.fetch_sub( 1 );
+    winmmPushFree( &data->outFree, index );
+    errorString_ = "MidiOutWinMM::sendMessage: error sending sysex message.";
+    error( RtMidiError::DRIVER_ERROR, errorString_ );
+    return -1;
+  }
 
+  return 1;
+}
+
+#endif  // __WINDOWS_MM__
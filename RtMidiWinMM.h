@@ -55,14 +55,16 @@
 class MidiInWinMM: public MidiInApi
 {
  public:
-  MidiInWinMM( const std::string clientName, unsigned int queueSizeLimit );
+  MidiInWinMM( const std::string clientName, unsigned int queueSizeLimit, unsigned int sysexQueueSize );
   ~MidiInWinMM( void );
   RtMidi::Api getCurrentApi( void ) { return RtMidi::WINDOWS_MM; };
   void openPort( unsigned int portNumber, const std::string portName );
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
+  unsigned int getSysexBufferUnderruns( void );
 
  protected:
   void initialize( const std::string& clientName );
@@ -78,11 +80,16 @@ class MidiOutWinMM: public MidiOutApi
   void openVirtualPort( const std::string portName );
   void closePort( void );
   unsigned int getPortCount( void );
+  static unsigned int probePortCount( void );
   std::string getPortName( unsigned int portNumber );
-  void sendMessage( std::vector<unsigned char> *message );
+  void sendMessage( const unsigned char *message, size_t size );
+  bool trySendMessage( const unsigned char *message, size_t size );
 
  protected:
   void initialize( const std::string& clientName );
+  void releaseBuffers( unsigned int prepared );
+  int queueSysex( const unsigned char *bytes, unsigned int nBytes );
+  bool allowsRunningStatus( void ) const { return true; }
 };
 
 #endif
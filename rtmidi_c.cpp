@@ -3,6 +3,16 @@
 #include "rtmidi_c.h"
 #include "RtMidi.h"
 
+/* The state kept for an input device, in RtMidiWrapper::data.  The
+   message vector is reused by every call, and a message that did not
+   fit the caller's buffer is held there until it is read. */
+struct RtMidiInData {
+    RtMidiInData () : pending (false), timeStamp (0.0) {}
+    std::vector<unsigned char> message;
+    bool pending;
+    double timeStamp;
+};
+
 /* misc */
 int rtmidi_sizeof_rtmidi_api ()
 {
@@ -99,10 +109,34 @@ const char* rtmidi_get_port_name (RtMidiPtr device, unsigned int portNumber)
     } catch (const RtMidiError & err) {
         device->ok  = false;
         device->msg = err.what ();
-        return "";
+        return strdup ("");
+    }
+}
+
+size_t rtmidi_get_port_name_into (RtMidiPtr device, unsigned int portNumber, char *name, size_t capacity)
+{
+    try {
+        std::string portName = ((RtMidi*) device->ptr)->getPortName (portNumber);
+        if (capacity > 0) {
+            size_t length = portName.size () < capacity ? portName.size () : capacity - 1;
+            memcpy (name, portName.data (), length);
+            name[length] = '\0';
+        }
+        return portName.size ();
+
+    } catch (const RtMidiError & err) {
+        device->ok  = false;
+        device->msg = err.what ();
+        if (capacity > 0) name[0] = '\0';
+        return 0;
     }
 }
 
+void rtmidi_free (void *ptr)
+{
+    free (ptr);
+}
+
 /* RtMidiIn API */
 RtMidiInPtr rtmidi_in_create_default ()
 {
@@ -112,11 +146,13 @@ RtMidiInPtr rtmidi_in_create_default ()
         RtMidiIn* rIn = new RtMidiIn ();
         
         wrp->ptr = (void*) rIn;
+        wrp->data = (void*) new RtMidiInData ();
         wrp->ok  = true;
         wrp->msg = "";
     
     } catch (const RtMidiError & err) {
         wrp->ptr = 0;
+        wrp->data = 0;
         wrp->ok  = false;
         wrp->msg = err.what ();
     }
@@ -133,11 +169,13 @@ RtMidiInPtr rtmidi_in_create (enum RtMidiApi api, const char *clientName, unsign
         RtMidiIn* rIn = new RtMidiIn ((RtMidi::Api) api, name, queueSizeLimit);
         
         wrp->ptr = (void*) rIn;
+        wrp->data = (void*) new RtMidiInData ();
         wrp->ok  = true;
         wrp->msg = "";
 
     } catch (const RtMidiError & err) {
-        wrp->ptr = 0; 
+        wrp->ptr = 0;
+        wrp->data = 0;
         wrp->ok  = false;
         wrp->msg = err.what ();
     }
@@ -148,6 +186,7 @@ RtMidiInPtr rtmidi_in_create (enum RtMidiApi api, const char *clientName, unsign
 void rtmidi_in_free (RtMidiInPtr device)
 {
     delete (RtMidiIn*) device->ptr;
+    delete (RtMidiInData*) device->data;
     delete device;
 }
 
@@ -209,22 +248,27 @@ void rtmidi_in_ignore_types (RtMidiInPtr device, bool midiSysex, bool midiTime,
 	((RtMidiIn*) device->ptr)->ignoreTypes (midiSysex, midiTime, midiSense);
 }
 
+void rtmidi_in_set_message_filter (RtMidiInPtr device, const unsigned char *filter, unsigned short channels)
+{
+	((RtMidiIn*) device->ptr)->setMessageFilter (filter, channels);
+}
+
 double rtmidi_in_get_message (RtMidiInPtr device, 
                               unsigned char **message, 
                               size_t * size)
 {
+    *message = NULL;
+    *size = 0;
     try {
-        // FIXME: use allocator to achieve efficient buffering
-        std::vector<unsigned char> *v = new std::vector<unsigned char> ();
-        double ret = ((RtMidiIn*) device->ptr)->getMessage (v);
-        *size = v->size ();
-
-        if (v->size () > 0) {
-            *message = (unsigned char *) 
-                        malloc (sizeof (unsigned char *) * (int) v->size ());
-            memcpy (*message, v->data (), (int) v->size ());
+        RtMidiInData *data = (RtMidiInData*) device->data;
+        double ret = data->pending ? data->timeStamp : ((RtMidiIn*) device->ptr)->getMessage (&data->message);
+        data->pending = false;
+        *size = data->message.size ();
+
+        if (data->message.size () > 0) {
+            *message = (unsigned char *) malloc (data->message.size ());
+            memcpy (*message, data->message.data (), data->message.size ());
         }
-        delete v;
         return ret;
     } 
     catch (const RtMidiError & err) {
@@ -239,6 +283,100 @@ double rtmidi_in_get_message (RtMidiInPtr device,
     }
 }
 
+double rtmidi_in_get_message_into (RtMidiInPtr device,
+                                   unsigned char *message,
+                                   size_t capacity,
+                                   size_t *size)
+{
+    try {
+        /* A message too large for the buffer is kept for the next
+           call, and its size is returned with a negative time stamp. */
+        RtMidiInData *data = (RtMidiInData*) device->data;
+        if (!data->pending)
+            data->timeStamp = ((RtMidiIn*) device->ptr)->getMessage (&data->message);
+        *size = data->message.size ();
+
+        if (data->message.size () > capacity) {
+            data->pending = true;
+            return -1;
+        }
+        data->pending = false;
+        if (data->message.size () > 0)
+            memcpy (message, data->message.data (), data->message.size ());
+        return data->timeStamp;
+    }
+    catch (const RtMidiError & err) {
+        device->ok  = false;
+        device->msg = err.what ();
+        *size = 0;
+        return -1;
+    }
+    catch (...) {
+        device->ok  = false;
+        device->msg = "Unknown error";
+        *size = 0;
+        return -1;
+    }
+}
+
+int rtmidi_in_get_messages (RtMidiInPtr device,
+                            double *timeStamps,
+                            size_t *offsets,
+                            unsigned char *data,
+                            size_t dataSize,
+                            unsigned int maxCount)
+{
+    try {
+        /* A message held back by rtmidi_in_get_message_into() comes first. */
+        RtMidiInData *held = (RtMidiInData*) device->data;
+        if (!held->pending || maxCount == 0)
+            return (int) ((RtMidiIn*) device->ptr)->getMessages (timeStamps, offsets, data, dataSize, maxCount);
+
+        size_t length = held->message.size ();
+        offsets[0] = 0;
+        if (length > dataSize) return 0;
+        memcpy (data, held->message.data (), length);
+        timeStamps[0] = held->timeStamp;
+        held->pending = false;
+
+        unsigned int count = ((RtMidiIn*) device->ptr)->getMessages (timeStamps + 1, offsets + 1, data + length,
+                                                                     dataSize - length, maxCount - 1);
+        for (unsigned int i = 1; i <= count + 1; i++)
+            offsets[i] += length;
+        return (int) count + 1;
+    }
+    catch (const RtMidiError & err) {
+        device->ok  = false;
+        device->msg = err.what ();
+        return -1;
+    }
+    catch (...) {
+        device->ok  = false;
+        device->msg = "Unknown error";
+        return -1;
+    }
+}
+
+int rtmidi_in_subscribe (RtMidiInPtr device, bool dropNewest)
+{
+	return ((RtMidiIn*) device->ptr)->subscribe (dropNewest ? RtMidiIn::DROP_NEWEST : RtMidiIn::DROP_OLDEST);
+}
+
+int rtmidi_in_subscribe_callback (RtMidiInPtr device, RtMidiCViewCallback callback, void *userData)
+{
+	return ((RtMidiIn*) device->ptr)->subscribe (callback, userData);
+}
+
+void rtmidi_in_unsubscribe (RtMidiInPtr device, int subscriber)
+{
+	((RtMidiIn*) device->ptr)->unsubscribe (subscriber);
+}
+
+size_t rtmidi_in_poll (RtMidiInPtr device, int subscriber, unsigned char *message, size_t capacity, double *timeStamp)
+{
+	return ((RtMidiIn*) device->ptr)->poll (subscriber, message, capacity, timeStamp);
+}
+
 /* RtMidiOut API */
 RtMidiOutPtr rtmidi_out_create_default ()
 {
@@ -248,11 +386,13 @@ RtMidiOutPtr rtmidi_out_create_default ()
         RtMidiOut* rOut = new RtMidiOut ();
         
         wrp->ptr = (void*) rOut;
+        wrp->data = 0;
         wrp->ok  = true;
         wrp->msg = "";
     
     } catch (const RtMidiError & err) {
         wrp->ptr = 0;
+        wrp->data = 0;
         wrp->ok  = false;
         wrp->msg = err.what ();
     }
@@ -269,11 +409,13 @@ RtMidiOutPtr rtmidi_out_create (enum RtMidiApi api, const char *clientName)
         RtMidiOut* rOut = new RtMidiOut ((RtMidi::Api) api, name);
         
         wrp->ptr = (void*) rOut;
+        wrp->data = 0;
         wrp->ok  = true;
         wrp->msg = "";
     
     } catch (const RtMidiError & err) {
         wrp->ptr = 0;
+        wrp->data = 0;
         wrp->ok  = false;
         wrp->msg = err.what ();
     }
@@ -304,11 +446,28 @@ enum RtMidiApi rtmidi_out_get_current_api (RtMidiPtr device)
 int rtmidi_out_send_message (RtMidiOutPtr device, const unsigned char *message, int length)
 {
     try {
-        // FIXME: use allocator to achieve efficient buffering
-        std::vector<unsigned char> *v = new std::vector<unsigned char> (length);
-        memcpy (v->data (), message, length);
-        ((RtMidiOut*) device->ptr)->sendMessage (v);
-        delete v;
+        ((RtMidiOut*) device->ptr)->sendMessage (message, length);
+        return 0;
+    }
+    catch (const RtMidiError & err) {
+        device->ok  = false;
+        device->msg = err.what ();
+        return -1;
+    }
+    catch (...) {
+        device->ok  = false;
+        device->msg = "Unknown error";
+        return -1;
+    }
+}
+
+int rtmidi_out_send_messages (RtMidiOutPtr device,
+                              const size_t *offsets,
+                              const unsigned char *data,
+                              unsigned int count)
+{
+    try {
+        ((RtMidiOut*) device->ptr)->sendMessages (offsets, data, count);
         return 0;
     }
     catch (const RtMidiError & err) {
@@ -322,3 +481,36 @@ int rtmidi_out_send_message (RtMidiOutPtr device, const unsigned char *message,
         return -1;
     }
 }
+
+int rtmidi_out_schedule_messages (RtMidiOutPtr device,
+                                  const double *timeStamps,
+                                  const size_t *offsets,
+                                  const unsigned char *data,
+                                  unsigned int count,
+                                  bool deltaTime)
+{
+    try {
+        ((RtMidiOut*) device->ptr)->scheduleMessages (timeStamps, offsets, data, count, deltaTime);
+        return 0;
+    }
+    catch (const RtMidiError & err) {
+        device->ok  = false;
+        device->msg = err.what ();
+        return -1;
+    }
+    catch (...) {
+        device->ok  = false;
+        device->msg = "Unknown error";
+        return -1;
+    }
+}
+
+void rtmidi_out_set_output_compression (RtMidiOutPtr device, bool runningStatus, double coalesceTime)
+{
+	((RtMidiOut*) device->ptr)->setOutputCompression (runningStatus, coalesceTime);
+}
+
+void rtmidi_out_flush_output (RtMidiOutPtr device)
+{
+	((RtMidiOut*) device->ptr)->flushOutput ();
+}
@@ -15,6 +15,7 @@ extern "C" {
 
 struct RtMidiWrapper {
     void* ptr;
+    void* data;  /* private state of the binding */
     bool  ok;
     const char* msg;
 };
@@ -30,7 +31,7 @@ typedef RtMidiWrapper* RtMidiOutPtr;
     RT_MIDI_API_UNIX_JACK,      /*!< The Jack Low-Latency MIDI Server API. */
     RT_MIDI_API_WINDOWS_MM,     /*!< The Microsoft Multimedia MIDI API. */
     RT_MIDI_API_WINDOWS_KS,     /*!< The Microsoft Kernel Streaming MIDI API. */
-    RT_MIDI_API_RTMIDI_DUMMY    /*!< A compilable but non-functional API. */
+    RT_MIDI_API_RTMIDI_DUMMY    /*!< An in-process loopback between virtual ports. */
   };
 
 enum RtMidiErrorType {
@@ -40,6 +41,7 @@ enum RtMidiErrorType {
 };
 
 typedef void(* RtMidiCCallback) (double timeStamp, const unsigned char* message, void *userData);
+typedef void(* RtMidiCViewCallback) (double timeStamp, const unsigned char* message, size_t size, void *userData);
 
 RTMIDIAPI int rtmidi_sizeof_rtmidi_api ();
 
@@ -51,7 +53,10 @@ RTMIDIAPI void rtmidi_open_port (RtMidiPtr device, unsigned int portNumber, cons
 RTMIDIAPI void rtmidi_open_virtual_port (RtMidiPtr device, const char *portName);
 RTMIDIAPI void rtmidi_close_port (RtMidiPtr device);
 RTMIDIAPI unsigned int rtmidi_get_port_count (RtMidiPtr device);
-RTMIDIAPI const char* rtmidi_get_port_name (RtMidiPtr device, unsigned int portNumber);
+RTMIDIAPI const char* rtmidi_get_port_name (RtMidiPtr device, unsigned int portNumber); // free with rtmidi_free(), empty on error.
+RTMIDIAPI size_t rtmidi_get_port_name_into (RtMidiPtr device, unsigned int portNumber,
+                                            char *name, size_t capacity); // return full length, truncate to capacity.
+RTMIDIAPI void rtmidi_free (void *ptr);
 
 /* RtMidiIn API */
 RTMIDIAPI RtMidiInPtr rtmidi_in_create_default ();
@@ -61,7 +66,16 @@ RTMIDIAPI enum RtMidiApi rtmidi_in_get_current_api (RtMidiPtr device);
 RTMIDIAPI void rtmidi_in_set_callback (RtMidiInPtr device, RtMidiCCallback callback, void *userData);
 RTMIDIAPI void rtmidi_in_cancel_callback (RtMidiInPtr device);
 RTMIDIAPI void rtmidi_in_ignore_types (RtMidiInPtr device, bool midiSysex, bool midiTime, bool midiSense);
-RTMIDIAPI double rtmidi_in_get_message (RtMidiInPtr device, unsigned char **message, size_t * size);
+RTMIDIAPI void rtmidi_in_set_message_filter (RtMidiInPtr device, const unsigned char *filter, unsigned short channels); // 256 entries, or NULL.
+RTMIDIAPI double rtmidi_in_get_message (RtMidiInPtr device, unsigned char **message, size_t * size); // free with rtmidi_free(), NULL if empty.
+RTMIDIAPI double rtmidi_in_get_message_into (RtMidiInPtr device, unsigned char *message, size_t capacity, size_t *size);
+RTMIDIAPI int rtmidi_in_get_messages (RtMidiInPtr device, double *timeStamps, size_t *offsets,
+                                      unsigned char *data, size_t dataSize, unsigned int maxCount);
+RTMIDIAPI int rtmidi_in_subscribe (RtMidiInPtr device, bool dropNewest); // return -1 on error.
+RTMIDIAPI int rtmidi_in_subscribe_callback (RtMidiInPtr device, RtMidiCViewCallback callback, void *userData);
+RTMIDIAPI void rtmidi_in_unsubscribe (RtMidiInPtr device, int subscriber);
+RTMIDIAPI size_t rtmidi_in_poll (RtMidiInPtr device, int subscriber, unsigned char *message, size_t capacity,
+                                 double *timeStamp); // return 0 if none, or the size, unread if above capacity.
 
 /* RtMidiOut API */
 RTMIDIAPI RtMidiOutPtr rtmidi_out_create_default ();
@@ -69,6 +83,12 @@ RTMIDIAPI RtMidiOutPtr rtmidi_out_create (enum RtMidiApi api, const char *client
 RTMIDIAPI void rtmidi_out_free (RtMidiOutPtr device);
 RTMIDIAPI enum RtMidiApi rtmidi_out_get_current_api (RtMidiPtr device);
 RTMIDIAPI int rtmidi_out_send_message (RtMidiOutPtr device, const unsigned char *message, int length);
+RTMIDIAPI int rtmidi_out_send_messages (RtMidiOutPtr device, const size_t *offsets,
+                                        const unsigned char *data, unsigned int count);
+RTMIDIAPI int rtmidi_out_schedule_messages (RtMidiOutPtr device, const double *timeStamps, const size_t *offsets,
+                                            const unsigned char *data, unsigned int count, bool deltaTime);
+RTMIDIAPI void rtmidi_out_set_output_compression (RtMidiOutPtr device, bool runningStatus, double coalesceTime);
+RTMIDIAPI void rtmidi_out_flush_output (RtMidiOutPtr device);
 
 
 #ifdef __cplusplus
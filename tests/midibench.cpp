@@ -0,0 +1,324 @@
+//*****************************************//
+//  midibench.cpp
+//
+//  Benchmark of the MIDI input and output path, over a loopback
+//  between an RtMidiOut virtual port and an RtMidiIn connected to it,
+//  on each compiled API.  It measures the latency of single messages,
+//  the throughput of 3-byte and sysex messages, and the rate at which
+//  messages are dequeued by a callback or by getMessage().  The byte
+//  stream parser used by the APIs that receive raw bytes is measured
+//  on its own.
+//
+//  The results are written to stdout as one JSON object per line,
+//  with the progress on stderr.
+//
+//*****************************************//
+
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <algorithm>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "RtMidi.h"
+
+void usage( void ) {
+  std::cout << "\nuseage: midibench <count>\n";
+  std::cout << "    where count = number of messages per test (default = 10000).\n\n";
+  exit( 0 );
+}
+
+// Platform-dependent sleep routines.
+#if defined(__WINDOWS_MM__)
+  #include <windows.h>
+  #define SLEEP( milliseconds ) Sleep( (DWORD) milliseconds )
+#else // Unix variants
+  #include <unistd.h>
+  #define SLEEP( milliseconds ) usleep( (unsigned long) (milliseconds * 1000.0) )
+#endif
+
+// The time without input after which the messages still missing are
+// counted as lost.
+const unsigned long long IDLE_TIMEOUT = 2000000000ULL;
+
+// The state shared with the input callback.
+struct Receiver
+{
+  std::atomic<unsigned int> count;
+  std::atomic<unsigned long long> bytes;
+  std::atomic<unsigned long long> lastTime;
+
+  Receiver() : count(0), bytes(0), lastTime(0) {}
+  void reset( void ) { count = 0; bytes = 0; lastTime = 0; }
+};
+
+void receive( double /*deltatime*/, std::vector< unsigned char > *message, void *userData )
+{
+  Receiver *receiver = (Receiver *) userData;
+  receiver->bytes.fetch_add( message->size(), std::memory_order_relaxed );
+  receiver->lastTime.store( RtMidi::getCurrentTime(), std::memory_order_relaxed );
+  receiver->count.fetch_add( 1, std::memory_order_release );
+}
+
+// Wait until target messages have been received, or input stopped for
+// IDLE_TIMEOUT, and return whether all have been.
+bool waitFor( Receiver &receiver, unsigned int target )
+{
+  unsigned int count = receiver.count.load( std::memory_order_acquire );
+  unsigned long long since = RtMidi::getCurrentTime();
+  while ( count < target ) {
+    std::this_thread::yield();
+    unsigned int now = receiver.count.load( std::memory_order_acquire );
+    if ( now != count ) {
+      count = now;
+      since = RtMidi::getCurrentTime();
+    }
+    else if ( RtMidi::getCurrentTime() - since > IDLE_TIMEOUT )
+      return false;
+  }
+  return true;
+}
+
+double percentile( const std::vector<unsigned long long> &sorted, double p )
+{
+  if ( sorted.empty() ) return 0.0;
+  size_t i = (size_t) ( p * ( sorted.size() - 1 ) + 0.5 );
+  return sorted[i] * 0.001;
+}
+
+// Latency of single messages, each sent once the previous one arrived.
+void benchLatency( const std::string &api, RtMidiIn *midiin, RtMidiOut *midiout, Receiver &receiver,
+                   unsigned int count )
+{
+  std::vector<unsigned long long> samples;
+  unsigned char message[3] = { 0x90, 0, 64 };
+  receiver.reset();
+  midiin->setCallback( &receive, &receiver );
+  for ( unsigned int i=0; i<count; i++ ) {
+    message[1] = i & 0x7F;
+    unsigned long long start = RtMidi::getCurrentTime();
+    midiout->sendMessage( message, 3 );
+    if ( !waitFor( receiver, i + 1 ) ) break;
+    samples.push_back( receiver.lastTime.load( std::memory_order_relaxed ) - start );
+  }
+  midiin->cancelCallback();
+
+  std::sort( samples.begin(), samples.end() );
+  printf( "{\"api\": \"%s\", \"test\": \"latency\", \"count\": %u, \"received\": %u, "
+          "\"p50_us\": %.2f, \"p90_us\": %.2f, \"p99_us\": %.2f, \"max_us\": %.2f}\n",
+          api.c_str(), count, (unsigned int) samples.size(), percentile( samples, 0.5 ),
+          percentile( samples, 0.9 ), percentile( samples, 0.99 ), percentile( samples, 1.0 ) );
+}
+
+// Sustained rate of messages of the given size sent back to back.
+void benchThroughput( const std::string &api, RtMidiIn *midiin, RtMidiOut *midiout, Receiver &receiver,
+                      unsigned int count, unsigned int size )
+{
+  std::vector<unsigned char> message( size, 0x40 );
+  if ( size > 3 ) {
+    message[0] = 0xF0;
+    message[size-1] = 0xF7;
+  }
+  else
+    message[0] = 0xB0;
+
+  receiver.reset();
+  midiin->setCallback( &receive, &receiver );
+  unsigned long long start = RtMidi::getCurrentTime();
+  for ( unsigned int i=0; i<count; i++ )
+    midiout->sendMessage( &message[0], size );
+  waitFor( receiver, count );
+  unsigned long long end = receiver.lastTime.load( std::memory_order_relaxed );
+  midiin->cancelCallback();
+
+  unsigned int received = receiver.count.load();
+  double seconds = end > start ? ( end - start ) * 0.000000001 : 0.0;
+  if ( size <= 3 )
+    printf( "{\"api\": \"%s\", \"test\": \"throughput\", \"size\": %u, \"count\": %u, \"received\": %u, "
+            "\"messages_per_s\": %.0f}\n", api.c_str(), size, count, received,
+            seconds > 0.0 ? received / seconds : 0.0 );
+  else
+    printf( "{\"api\": \"%s\", \"test\": \"sysex\", \"size\": %u, \"count\": %u, \"received\": %u, "
+            "\"mb_per_s\": %.3f}\n", api.c_str(), size, count, received,
+            seconds > 0.0 ? receiver.bytes.load() / seconds * 0.000001 : 0.0 );
+}
+
+void sendBurst( RtMidiOut *midiout, unsigned int count )
+{
+  unsigned char message[3] = { 0xB0, 7, 0 };
+  for ( unsigned int i=0; i<count; i++ ) {
+    message[2] = i & 0x7F;
+    midiout->sendMessage( message, 3 );
+  }
+}
+
+// Rate at which a burst is dequeued by a callback, and by polling
+// getMessage() from this thread while another one sends it.
+void benchDequeue( const std::string &api, RtMidiIn *midiin, RtMidiOut *midiout, Receiver &receiver,
+                   unsigned int count )
+{
+  receiver.reset();
+  midiin->setCallback( &receive, &receiver );
+  unsigned long long start = RtMidi::getCurrentTime();
+  std::thread sender( sendBurst, midiout, count );
+  waitFor( receiver, count );
+  unsigned long long end = receiver.lastTime.load( std::memory_order_relaxed );
+  sender.join();
+  midiin->cancelCallback();
+
+  unsigned int received = receiver.count.load();
+  double seconds = end > start ? ( end - start ) * 0.000000001 : 0.0;
+  printf( "{\"api\": \"%s\", \"test\": \"dequeue\", \"mode\": \"callback\", \"count\": %u, \"received\": %u, "
+          "\"messages_per_s\": %.0f}\n", api.c_str(), count, received,
+          seconds > 0.0 ? received / seconds : 0.0 );
+
+  std::vector<unsigned char> message;
+  unsigned long long polling = 0;
+  received = 0;
+  start = RtMidi::getCurrentTime();
+  end = start;
+  sender = std::thread( sendBurst, midiout, count );
+  while ( received < count && RtMidi::getCurrentTime() - end < IDLE_TIMEOUT ) {
+    unsigned long long before = RtMidi::getCurrentTime();
+    midiin->getMessage( &message );
+    if ( message.empty() ) {
+      std::this_thread::yield();
+      continue;
+    }
+    end = RtMidi::getCurrentTime();
+    polling += end - before;
+    received++;
+  }
+  sender.join();
+
+  seconds = end > start ? ( end - start ) * 0.000000001 : 0.0;
+  printf( "{\"api\": \"%s\", \"test\": \"dequeue\", \"mode\": \"getMessage\", \"count\": %u, \"received\": %u, "
+          "\"messages_per_s\": %.0f, \"ns_per_message\": %.1f}\n", api.c_str(), count, received,
+          seconds > 0.0 ? received / seconds : 0.0, received ? (double) polling / received : 0.0 );
+}
+
+// Rate of the byte stream parser over a buffer of notes in running
+// status and sysex messages with clock bytes inside, parsed in
+// packets of 256 bytes.
+void benchParser( unsigned int count )
+{
+  std::vector<unsigned char> stream;
+  for ( unsigned int i=0; i<count; i++ ) {
+    if ( i % 64 == 0 ) stream.push_back( 0x90 );
+    stream.push_back( i & 0x7F );
+    stream.push_back( 64 );
+    if ( i % 256 == 255 ) {
+      stream.push_back( 0xF0 );
+      for ( unsigned int j=0; j<128; j++ ) {
+        if ( j % 32 == 0 ) stream.push_back( 0xF8 );
+        stream.push_back( j );
+      }
+      stream.push_back( 0xF7 );
+    }
+  }
+
+  MidiInApi::MidiParser parser;
+  MidiInApi::MidiParsed parsed;
+  unsigned long long messages = 0;
+  unsigned long long start = RtMidi::getCurrentTime();
+  for ( size_t i=0; i<stream.size(); i += 256 ) {
+    unsigned int size = (unsigned int) std::min( stream.size() - i, (size_t) 256 );
+    unsigned int offset = 0;
+    while ( parser.parse( &stream[i], size, &offset, &parsed ) )
+      if ( !parsed.sysex || parsed.last ) messages++;
+  }
+  unsigned long long end = RtMidi::getCurrentTime();
+
+  double seconds = end > start ? ( end - start ) * 0.000000001 : 0.0;
+  printf( "{\"api\": \"none\", \"test\": \"parse\", \"bytes\": %u, \"messages\": %llu, "
+          "\"mb_per_s\": %.3f}\n", (unsigned int) stream.size(), messages,
+          seconds > 0.0 ? stream.size() / seconds * 0.000001 : 0.0 );
+}
+
+bool benchApi( RtMidi::Api api, const std::string &name, unsigned int count )
+{
+  RtMidiOut *midiout = 0;
+  RtMidiIn *midiin = 0;
+  Receiver receiver;
+  bool done = false;
+
+  try {
+    midiout = new RtMidiOut( api, "midibench" );
+    // The queue holds a whole burst, so that getMessage() is measured
+    // rather than the limit of the queue.
+    midiin = new RtMidiIn( api, "midibench input", count );
+    midiin->ignoreTypes( false, false, false );
+
+    midiout->openVirtualPort( "midibench" );
+    if ( !midiout->isPortOpen() ) {
+      std::cerr << name << ": virtual ports are not supported, skipped.\n";
+      goto cleanup;
+    }
+    SLEEP( 100 ); // let the port be announced
+
+    unsigned int nPorts = midiin->getPortCount();
+    for ( unsigned int i=0; i<nPorts; i++ ) {
+      std::string portName = midiin->getPortName( i );
+      if ( portName.find( "midibench" ) != std::string::npos &&
+           portName.find( "midibench input" ) == std::string::npos ) {
+        midiin->openPort( i, "midibench input" );
+        break;
+      }
+    }
+    if ( !midiin->isPortOpen() ) {
+      std::cerr << name << ": the virtual output port was not found, skipped.\n";
+      goto cleanup;
+    }
+    SLEEP( 100 ); // let the connection be made
+
+    std::cerr << name << ": latency\n";
+    benchLatency( name, midiin, midiout, receiver, std::min( count, 1000u ) );
+    std::cerr << name << ": throughput\n";
+    benchThroughput( name, midiin, midiout, receiver, count, 3 );
+    std::cerr << name << ": sysex\n";
+    const unsigned int sizes[] = { 256, 1024, 8192, 32768 };
+    for ( unsigned int i=0; i<sizeof(sizes)/sizeof(sizes[0]); i++ )
+      benchThroughput( name, midiin, midiout, receiver, std::max( 16u, ( 1u << 20 ) / sizes[i] ), sizes[i] );
+    std::cerr << name << ": dequeue\n";
+    benchDequeue( name, midiin, midiout, receiver, count );
+    done = true;
+  }
+  catch ( RtMidiError &error ) {
+    error.printMessage();
+  }
+
+ cleanup:
+  delete midiin;
+  delete midiout;
+  return done;
+}
+
+int main( int argc, char *argv[] )
+{
+  unsigned int count = 10000;
+  if ( argc > 2 ) usage();
+  if ( argc == 2 ) count = (unsigned int) atoi( argv[1] );
+  if ( count == 0 ) usage();
+
+  std::map<int, std::string> apiMap;
+  apiMap[RtMidi::MACOSX_CORE] = "core";
+  apiMap[RtMidi::WINDOWS_MM] = "winmm";
+  apiMap[RtMidi::UNIX_JACK] = "jack";
+  apiMap[RtMidi::LINUX_ALSA] = "alsa";
+  apiMap[RtMidi::RTMIDI_DUMMY] = "dummy";
+
+  std::vector< RtMidi::Api > apis;
+  RtMidi :: getCompiledApi( apis );
+
+  std::cerr << "parser\n";
+  benchParser( count );
+
+  unsigned int benched = 0;
+  for ( unsigned int i=0; i<apis.size(); i++ )
+    if ( benchApi( apis[i], apiMap[ apis[i] ], count ) ) benched++;
+
+  return benched > 0 ? 0 : 1;
+}
@@ -0,0 +1,94 @@
+//*****************************************//
+//  midifile.cpp
+//
+//  Simple program to record MIDI input to a
+//  Standard MIDI File with RtMidiRecorder, and
+//  to play such a file with RtMidiPlayer.
+//
+//*****************************************//
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+#include "RtMidi.h"
+#include "RtMidiFile.h"
+
+void usage( void ) {
+  // Error function in case of incorrect command-line
+  // argument specifications.
+  std::cout << "\nuseage: midifile record|play <file> <port>\n";
+  std::cout << "    where file = the Standard MIDI File to write or read,\n";
+  std::cout << "    and port = the device to use (default = 0).\n\n";
+  exit( 0 );
+}
+
+// Platform-dependent sleep routines.
+#if defined(__WINDOWS_MM__)
+  #include <windows.h>
+  #define SLEEP( milliseconds ) Sleep( (DWORD) milliseconds )
+#else // Unix variants
+  #include <unistd.h>
+  #define SLEEP( milliseconds ) usleep( (unsigned long) (milliseconds * 1000.0) )
+#endif
+
+void record( const std::string &path, unsigned int port )
+{
+  RtMidiIn midiin;
+  if ( port >= midiin.getPortCount() ) {
+    std::cout << "No input port #" << port << "!" << std::endl;
+    return;
+  }
+
+  std::cout << "\nRecording " << midiin.getPortName( port ) << " to " << path << " ... press <enter> to stop.\n";
+  midiin.openPort( port );
+  midiin.ignoreTypes( false, false, false );
+
+  RtMidiRecorder recorder;
+  recorder.open( path );
+  recorder.attach( midiin );
+  char input;
+  std::cin.get( input );
+  recorder.close();
+
+  std::cout << recorder.getMessageCount() << " message(s) recorded, " << recorder.getDrops() << " dropped.\n";
+}
+
+void play( const std::string &path, unsigned int port )
+{
+  RtMidiOut midiout;
+  if ( port >= midiout.getPortCount() ) {
+    std::cout << "No output port #" << port << "!" << std::endl;
+    return;
+  }
+
+  RtMidiPlayer player;
+  player.open( path );
+  std::cout << "\nPlaying " << path << " (" << player.getDuration() << " seconds) to "
+            << midiout.getPortName( port ) << " ...\n";
+  midiout.openPort( port );
+
+  player.start( midiout );
+  while ( player.isPlaying() ) SLEEP( 100 );
+}
+
+int main( int argc, char *argv[] )
+{
+  // Minimal command-line check.
+  if ( argc < 3 || argc > 4 ) usage();
+
+  std::string mode = argv[1];
+  unsigned int port = 0;
+  if ( argc == 4 ) port = (unsigned int) atoi( argv[3] );
+
+  try {
+    if ( mode == "record" ) record( argv[2], port );
+    else if ( mode == "play" ) play( argv[2], port );
+    else usage();
+  }
+  catch ( RtMidiError &error ) {
+    error.printMessage();
+    return 1;
+  }
+
+  return 0;
+}